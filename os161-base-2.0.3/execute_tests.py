@@ -14,7 +14,40 @@ stats = [
     "Page Faults (Disk)",
     "Page Faults from ELF",
     "Page Faults from Swapfile",
-    "Swapfile Writes"
+    "Swapfile Writes",
+    "Swapfile Writes Avoided (Uniform)",
+    "Swapfile Reads Avoided (Uniform)",
+    "KSM Frames Merged",
+    "KSM Merges Broken",
+    "Page Table Pages Reclaimed",
+    "Page Table Pages Swapped Out",
+    "Page Table Pages Swapped In",
+    "Text Pages Shared",
+    "Readahead Pages Loaded",
+    "Readahead Hits",
+    "Readahead Pages Wasted",
+    "Pages Loaded Eagerly",
+    "Pages Prefetched by Profile",
+    "Pages Shared by Fork",
+    "Copy-on-Write Copies",
+    "Stack Growths",
+    "Heap Pages Released",
+    "Page Faults from Mapped Files",
+    "Mapped Pages Written Back",
+    "Mapped Pages Dropped",
+    "Pages Prefetched by madvise",
+    "Advised Pages Evicted First",
+    "Pages Freed by madvise",
+    "Pages Prefetched on a Stride",
+    "Stride Prefetch Hits",
+    "Stride Prefetched Pages Wasted",
+    "Reads Mapped to the Zero Page",
+    "Zero Page Writes",
+    "Faults Waiting on a Busy Page",
+    "Duplicate Loads Avoided",
+    "Kernel TLB Faults (kseg2)",
+    "Pages Mapped by vmalloc",
+    "Pages Freed by Shrinkers"
 ]
 
 programs = [
@@ -24,7 +57,10 @@ programs = [
     "matmult",
     "hugematmult1",
     "hugematmult2",
-    "ctest"
+    "ctest",
+    "mmapscan",
+    "madvscan",
+    "faultpar"
 ]
 
 tests = [
@@ -88,7 +124,7 @@ def close_instance(proc):
         return None
 
     output = proc.before
-    test_result_rows = [o.strip() for o in output.split("\n")][-12:-2]
+    test_result_rows = [o.strip() for o in output.split("\n")][-(len(stats) + 2):-2]
 
     proc.close()
     return [r.split(" ")[-1] for r in test_result_rows]
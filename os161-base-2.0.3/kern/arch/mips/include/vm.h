@@ -121,10 +121,9 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* first page to invalidate */
+	unsigned ts_npages;
+	unsigned *ts_acked;		/* counts the CPUs done, see vfree */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -35,6 +35,8 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <addrspace.h>
+#include <copyinout.h>
 
 
 /*
@@ -81,6 +83,14 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err = 0;
+#if OPT_HEAP
+	vaddr_t heapbreak;
+#endif
+#if OPT_MMAP
+	vaddr_t mapaddr;
+	int mmap_fd;
+	off_t mmap_offset;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -131,6 +141,70 @@ syscall(struct trapframe *tf)
 	        /* TODO: just avoid crash */
  	        sys__exit((int)tf->tf_a0);
                 break;
+#if OPT_FILETABLE
+	    case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0,
+			       (int)tf->tf_a1,
+			       (mode_t)tf->tf_a2,
+			       &retval);
+		break;
+	    case SYS_close:
+		err = sys_close((int)tf->tf_a0);
+		break;
+#endif
+#endif
+#if OPT_FORK
+	    case SYS_fork:
+		err = sys_fork(tf, &retval);
+		break;
+	    case SYS_getpid:
+		err = sys_getpid(&retval);
+		break;
+	    case SYS_waitpid:
+		err = sys_waitpid((pid_t)tf->tf_a0,
+				  (userptr_t)tf->tf_a1,
+				  (int)tf->tf_a2,
+				  &retval);
+		break;
+#endif
+#if OPT_HEAP
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &heapbreak);
+		retval = (int32_t)heapbreak;
+		break;
+#endif
+#if OPT_MMAP
+	    case SYS_mmap:
+		/* fd and the aligned 64-bit offset are on the user stack */
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &mmap_fd, sizeof(mmap_fd));
+		if (err == 0) {
+			err = copyin((const_userptr_t)(tf->tf_sp + 24), &mmap_offset, sizeof(mmap_offset));
+		}
+		if (err == 0) {
+			err = sys_mmap((vaddr_t)tf->tf_a0,
+				       (size_t)tf->tf_a1,
+				       (int)tf->tf_a2,
+				       (int)tf->tf_a3,
+				       mmap_fd, mmap_offset,
+				       &mapaddr);
+			retval = (int32_t)mapaddr;
+		}
+		break;
+	    case SYS_munmap:
+		err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+#endif
+#if OPT_MADVISE
+	    case SYS_madvise:
+		err = sys_madvise((vaddr_t)tf->tf_a0,
+				  (size_t)tf->tf_a1,
+				  (int)tf->tf_a2);
+		break;
+	    case SYS_mincore:
+		err = sys_mincore((vaddr_t)tf->tf_a0,
+				  (size_t)tf->tf_a1,
+				  (userptr_t)tf->tf_a2);
+		break;
 #endif
 
 	    default:
@@ -179,5 +253,22 @@ syscall(struct trapframe *tf)
 void
 enter_forked_process(struct trapframe *tf)
 {
+#if OPT_FORK
+	struct trapframe child_tf;
+
+	/* the copy made by sys_fork lives on the heap, move it here */
+	child_tf = *tf;
+	kfree(tf);
+
+	/* fork returns 0 in the child */
+	child_tf.tf_v0 = 0;
+	child_tf.tf_a3 = 0;
+	child_tf.tf_epc += 4;
+
+	as_activate();
+
+	mips_usermode(&child_tf);
+#else
 	(void)tf;
+#endif
 }
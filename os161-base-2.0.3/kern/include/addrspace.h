@@ -37,15 +37,74 @@
 
 #include "opt-dumbvm.h"
 #include "opt-DEMANDVM.h"
+#include "opt-readahead.h"
+#include "opt-eagerload.h"
+#include "opt-launchprof.h"
+#include "opt-stackgrow.h"
+#include "opt-heap.h"
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-stride.h"
+#include "opt-asrwlock.h"
+#include "opt-objcache.h"
+#if OPT_EAGERLOAD
+#include <kern/time.h>
+#endif
 
 #if OPT_DEMANDVM
 #define SEGMENT_TEXT    1
 #define SEGMENT_DATA    2
 #define SEGMENT_STACK   3 
+#define SEGMENT_HEAP    4
+#define SEGMENT_MMAP    5
+
+#define AS_REGIONS_INIT 4       /* slots of the region array of a new address space */
+#endif
+
+#if OPT_STRIDE
+#define AS_STRIDE_STREAMS   4   /* access streams followed at the same time */
+#define AS_STRIDE_MAX       64  /* largest stride detected, in pages */
+#define AS_STRIDE_CONFIRM   2   /* repetitions of a stride before prefetching */
+#define AS_STRIDE_DEPTH     4   /* pages prefetched ahead of a confirmed stream */
+#define AS_STRIDE_QUEUE     16  /* prefetches waiting for the stride thread */
 #endif
 
 struct vnode;
+struct pt_directory;
+struct pt_entry;
+struct iovec;
+struct launch_profile;
+struct rwlock;
+
+#if OPT_DEMANDVM
+/*
+ * A region of the address space: one of its segments, the kind of the
+ * segment and where its entries start in the page table. The regions
+ * of an address space are kept sorted by address and never overlap,
+ * so that the region of a fault is found with a binary search.
+ */
+struct as_region {
+	struct segment  *ar_seg;
+	int             ar_type;                /* SEGMENT_* */
+	unsigned        ar_ptbase;              /* page table index of the first page
+	                                           (of the top page for the stack) */
+};
+#endif
 
+#if OPT_STRIDE
+/*
+ * An access stream of the address space, as seen by its page faults:
+ * the last page faulted and the distance, in pages and possibly
+ * negative, between its last two faults. Once the same stride has
+ * been seen AS_STRIDE_CONFIRM times in a row the next pages of the
+ * stream are prefetched.
+ */
+struct as_stream {
+	vaddr_t         st_last;                /* last page, 0 if the stream is unused */
+	int             st_stride;              /* in pages, 0 while not trained */
+	unsigned        st_confidence;          /* repetitions of the stride */
+};
+#endif
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -64,10 +123,41 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #elif OPT_DEMANDVM
-        struct segment  *as_text;
-        struct segment  *as_data;
-        struct segment  *as_stack;
-	struct pt_entry *as_ptable;
+	struct as_region *as_regions;           /* sorted by address */
+	unsigned        as_nregions;
+	unsigned        as_maxregions;          /* slots allocated in as_regions */
+	struct segment  *as_stack;              /* also among the regions, the last one */
+	struct pt_directory *as_ptable;
+#if OPT_ASRWLOCK
+	struct rwlock   *as_lock;               /* shared by faults and lookups,
+	                                           exclusive to change the regions */
+#endif
+#if OPT_HEAP
+	struct segment  *as_heap;               /* from the end of the elf to the break */
+	size_t          as_heap_maxpages;       /* entries reserved for the heap */
+#endif
+#if OPT_MMAP
+	vaddr_t         as_mmap_base;           /* window of the file mappings */
+	size_t          as_mmap_maxpages;       /* entries reserved for the window */
+	unsigned        as_mmap_ptbase;         /* page table index of the window */
+#endif
+#if OPT_EAGERLOAD
+	bool            as_exec_pending;        /* first instruction not run yet */
+	struct timespec as_exec_start;
+#endif
+#if OPT_LAUNCHPROF
+	struct launch_profile *as_profile;      /* startup recorded or replayed */
+#endif
+#if OPT_STRIDE
+	struct as_stream as_streams[AS_STRIDE_STREAMS];
+	unsigned        as_stream_next;         /* stream replaced by a new one */
+	unsigned        as_pf_faults;           /* faults given to the streams */
+	unsigned        as_pf_predictions;      /* faults predicted by a stream */
+	unsigned        as_pf_correct;          /* predicted faults which came */
+	unsigned        as_pf_issued;           /* pages prefetched */
+	unsigned        as_pf_hits;             /* prefetched pages then accessed */
+	unsigned        as_pf_dropped;          /* prefetches not queued, queue full */
+#endif
 #endif
 };
 
@@ -110,6 +200,12 @@ struct addrspace {
  *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
+ *
+ * With asrwlock, the callers of the other functions hold as_lock:
+ * shared for the faults and the lookups, exclusive for the calls
+ * which add, remove or resize a region (as_sbrk, as_mmap, as_munmap,
+ * as_grow_stack, as_madvise). An address space being loaded is not
+ * seen by any other thread yet and needs no lock.
  */
 
 struct addrspace *as_create(void);
@@ -122,7 +218,8 @@ void              as_destroy(struct addrspace *);
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
                                    off_t elf_offset,
-                                   size_t elfsize);
+                                   size_t elfsize,
+                                   int writeable);
 #else
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
@@ -136,10 +233,56 @@ int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
 #if OPT_DEMANDVM
+#if OPT_OBJCACHE
+void              as_bootstrap(void);
+#endif
 int               as_define_pt(struct addrspace *as);
+struct as_region *as_get_region(struct addrspace *as, vaddr_t vaddr);
 int               as_get_segment_type(struct addrspace *as, vaddr_t vaddr);
 bool              as_check_in_elf(struct addrspace *as, vaddr_t vaddr);
 int               as_load_page(struct addrspace *as,struct vnode *vnode, vaddr_t faultaddress);
+#if OPT_READAHEAD
+bool              as_load_cluster(struct addrspace *as, struct vnode *vnode, vaddr_t faultaddress,
+                                  struct pt_entry *pt_row, unsigned char status);
+void              as_readahead_hit(struct addrspace *as, vaddr_t vaddr);
+#endif
+#if OPT_EAGERLOAD
+void              as_set_eager(unsigned threshold, unsigned textpages);
+void              as_prefault(struct addrspace *as, struct vnode *vnode);
+void              as_exec_started(struct addrspace *as, const struct timespec *start);
+void              as_exec_done(struct addrspace *as);
+void              as_print_exec_stats(void);
+#endif
+#if OPT_HEAP
+int               as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak);
+#endif
+#if OPT_MMAP
+int               as_mmap(struct addrspace *as, size_t len, bool writable, bool shared,
+                          struct vnode *v, off_t offset, vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+struct segment   *as_get_mapping(struct addrspace *as, vaddr_t vaddr);
+int               as_load_mapped(struct addrspace *as, vaddr_t vaddr, struct pt_entry *pt_row);
+#endif
+#if OPT_MADVISE
+int               as_madvise(struct addrspace *as, struct vnode *vnode,
+                             vaddr_t start, vaddr_t end, int advice);
+int               as_mincore(struct addrspace *as, vaddr_t start, unsigned npages,
+                             unsigned char *vec);
+#endif
+#if OPT_STRIDE
+void              as_stride_bootstrap(void);
+void              as_stride_fault(struct addrspace *as, struct vnode *vnode, vaddr_t vaddr);
+void              as_stride_hit(struct addrspace *as);
+#endif
+#if OPT_STACKGROW
+bool              as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+void              as_set_stack_max(unsigned maxpages);
+void              as_print_stack_max(void);
+#endif
+#if OPT_LAUNCHPROF
+void              as_prefetch(struct addrspace *as, struct vnode *vnode,
+                              const vaddr_t *pages, unsigned npages);
+#endif
 #endif
 
 /*
@@ -153,6 +296,12 @@ int load_elf(struct vnode *v, vaddr_t *entrypoint);
 
 #if OPT_DEMANDVM
 void load_page(struct vnode *v, off_t offset, paddr_t page_paddr,size_t size);
+#if OPT_READAHEAD || OPT_EAGERLOAD
+void load_iovec(struct vnode *v, off_t offset, struct iovec *iov, unsigned niov);
+#endif
+#if OPT_READAHEAD
+void load_pages(struct vnode *v, off_t offset, const paddr_t *pages, unsigned npages);
+#endif
 #endif
 
 #endif /* _ADDRSPACE_H_ */
@@ -2,22 +2,100 @@
 #define _COREMAP_H_
 
 #include <pt.h>
+#include <spinlock.h>
 #include "opt-DEMANDVM.h"
+#include "opt-ksm.h"
+#include "opt-sharedtext.h"
+#include "opt-fork.h"
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-fastexit.h"
+#include "opt-pin.h"
+#include "opt-shrinker.h"
 
 #if OPT_DEMANDVM
 
+/*
+ * Reverse mapping of a shared frame: besides cm_ptentry, every other
+ * page table entry mapping the frame is kept in the cm_rmap list.
+ */
+struct cm_rmap
+{
+    struct pt_entry     *rm_ptentry;
+    struct cm_rmap      *rm_next;
+};
+
 struct cm_entry
 {
     unsigned char       cm_free : 1;
     unsigned long       cm_size_alloc : 20;      
-    unsigned char       cm_lock : 1;
+    unsigned char       cm_pin : 8;             /*  pins, the frame is not evicted nor merged */
+    unsigned char       cm_ksm : 1;             /*  frame shared by a same-page merge   */
+    unsigned char       cm_pcache : 1;          /*  text page indexed by the page cache */
+    unsigned char       cm_cold : 1;            /*  advised as not needed, evicted first */
+    unsigned int        cm_refcount : 16;       /*  page table entries mapping the frame */
     struct pt_entry     *cm_ptentry;            /*  page table entry of the page living 
                                                     in this frame, NULL if kernel page  */
+    struct cm_rmap      *cm_rmap;               /*  other entries if the frame is shared */
 };
 
+/* protects the coremap and the page table entries it points to */
+extern struct spinlock cm_spinlock;
+
 void        coremap_bootstrap(void);
+void        coremap_pin_bootstrap(void);
+bool        coremap_wait_unpinned(paddr_t addr);
 paddr_t     coremap_getppages(int npages, struct pt_entry *ptentry);
 void        coremap_freeppages(paddr_t addr);
+void        coremap_put_upage(paddr_t addr, struct pt_entry *ptentry);
+unsigned    coremap_refcount(paddr_t addr);
+struct cm_rmap *coremap_unshare(paddr_t addr, struct pt_entry *ptentry);
+void        coremap_set_ptentry(paddr_t addr, struct pt_entry *ptentry);
+int         coremap_nframes(void);
+struct cm_rmap *coremap_rmap_alloc(void);
+void        coremap_rmap_free(struct cm_rmap *node);
+#if OPT_SHRINKER
+unsigned    coremap_shrink(unsigned npages);
+#endif
+bool        coremap_is_ksm(paddr_t addr);
+
+#if OPT_SHAREDTEXT
+struct vnode;
+paddr_t     coremap_text_lookup(struct vnode *v, vaddr_t vaddr, struct pt_entry *ptentry,
+                                unsigned char status, struct cm_rmap *node);
+void        coremap_text_insert(struct vnode *v, vaddr_t vaddr, struct pt_entry *ptentry);
+#endif
+
+#if OPT_FORK
+void        coremap_share(paddr_t addr, struct pt_entry *ptentry, struct cm_rmap *node);
+#endif
+
+#if OPT_MMAP
+void        coremap_file_written(struct pt_entry *ptentry, bool shared);
+void        coremap_file_sync(struct pt_entry *ptentry);
+#if OPT_FORK
+void        coremap_file_share(struct pt_entry *ptentry);
+#endif
+#endif
+
+#if OPT_MADVISE
+void        coremap_set_cold(paddr_t addr);
+#endif
+
+#if OPT_FASTEXIT
+void        coremap_drop_upage(paddr_t addr, struct pt_entry *ptentry);
+#endif
+
+#if OPT_PIN
+void        coremap_pin(paddr_t addr);
+void        coremap_unpin(paddr_t addr);
+#endif
+
+#if OPT_KSM
+bool        coremap_ksm_candidate(int index);
+bool        coremap_ksm_merge(int target, int source, struct cm_rmap *node);
+unsigned    coremap_ksm_saved(void);
+#endif
 
 #endif /* OPT_DEMANDVM */
 
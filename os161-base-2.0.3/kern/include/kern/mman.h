@@ -0,0 +1,29 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap() and munmap().
+ */
+
+/* Protection of a mapping, ORed together. */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Type of a mapping, exactly one of them. */
+#define MAP_SHARED    1	/* Writes are carried through to the file. */
+#define MAP_PRIVATE   2	/* Writes are private to the process. */
+
+/* Returned by mmap() on failure. */
+#define MAP_FAILED    ((void *)-1)
+
+/* Advice given to madvise(). */
+#define MADV_NORMAL      0	/* No particular access pattern. */
+#define MADV_RANDOM      1	/* Random accesses, no readahead. */
+#define MADV_SEQUENTIAL  2	/* Sequential accesses, maximum readahead. */
+#define MADV_WILLNEED    3	/* The pages will be needed soon. */
+#define MADV_DONTNEED    4	/* The pages will not be needed soon. */
+#define MADV_FREE        5	/* The contents of the pages can be discarded. */
+
+#endif /* _KERN_MMAN_H_ */
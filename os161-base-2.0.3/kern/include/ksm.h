@@ -0,0 +1,27 @@
+#ifndef _KSM_H_
+#define _KSM_H_
+
+#include <types.h>
+#include "opt-ksm.h"
+
+#if OPT_KSM
+
+/*
+ * Same-page merging.
+ *
+ * A kernel thread periodically hashes the resident user frames and
+ * merges the ones with identical contents into a single frame, shared
+ * copy-on-write by all the page table entries that mapped them (see
+ * coremap_ksm_merge). A frame is considered only if its hash did not
+ * change since the previous pass, so pages being written are skipped.
+ */
+
+#define KSM_SLEEP_SECS  1       /*  pause between two passes          */
+#define KSM_NBUCKETS    256     /*  buckets of the hash table         */
+
+void    ksm_bootstrap(void);
+void    ksm_print_stats(void);
+
+#endif /* OPT_KSM */
+
+#endif /* _KSM_H_ */
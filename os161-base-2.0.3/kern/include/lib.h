@@ -125,6 +125,10 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_shrink gives back the heap pages kept only by the free blocks
+ * of the per-cpu caches and returns how many; it does nothing without
+ * them, as the other pages go back as soon as they are empty.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +136,7 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+unsigned kheap_shrink(unsigned npages);
 
 /*
  * C string functions.
@@ -0,0 +1,33 @@
+#ifndef _MMAP_H_
+#define _MMAP_H_
+
+#include <types.h>
+#include "opt-mmap.h"
+
+#if OPT_MMAP
+
+/*
+ * File backing of the frames of mapped pages.
+ *
+ * A frame loaded from a mapped file records the vnode, the offset and
+ * the length of the file data it holds, so that an eviction can drop
+ * it when it is clean, or write it back when it has been modified
+ * through a shared mapping. A frame written through a private mapping
+ * loses its file backing and is swapped as an anonymous page.
+ *
+ * mmap_frame_set and mmap_frame_clear must be called holding
+ * cm_spinlock, without it mmap_frame_mapped is only a hint.
+ * mmap_writeback sleeps, the frame is pinned (cm_pin) instead.
+ */
+
+struct vnode;
+
+void    mmap_bootstrap(void);
+void    mmap_frame_set(int index, struct vnode *v, off_t offset, size_t size);
+void    mmap_frame_clear(int index);
+bool    mmap_frame_mapped(int index);
+void    mmap_writeback(int index);
+
+#endif /* OPT_MMAP */
+
+#endif /* _MMAP_H_ */
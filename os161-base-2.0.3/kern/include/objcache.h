@@ -0,0 +1,40 @@
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+#include <types.h>
+#include "opt-objcache.h"
+#include "opt-shrinker.h"
+
+#if OPT_OBJCACHE
+
+/*
+ * Caches of kernel objects of a single type. The objects are carved
+ * from one-page slabs at their exact size, instead of being rounded
+ * up to the next kmalloc class, and they are kept constructed while
+ * free: the constructor runs when an object is first carved, the
+ * destructor only when its slab goes back to the coremap. What the
+ * constructor sets up (a lock, a semaphore) must be handed back to
+ * the cache in the same state, unheld and at its initial value.
+ *
+ * Objects too large for two of them to fit in a slab are taken from
+ * kmalloc one at a time, and up to OBJCACHE_DEPOT of them are kept
+ * constructed after being freed.
+ */
+
+#define OBJCACHE_DEPOT      8       /*  free large objects kept by a cache  */
+
+struct objcache;
+
+struct objcache *objcache_create(const char *name, size_t size,
+                                 int (*ctor)(void *obj), void (*dtor)(void *obj));
+void            objcache_destroy(struct objcache *oc);
+void           *objcache_alloc(struct objcache *oc);
+void            objcache_free(struct objcache *oc, void *obj);
+void            objcache_printstats(void);
+#if OPT_SHRINKER
+unsigned        objcache_shrink(unsigned npages);
+#endif
+
+#endif /* OPT_OBJCACHE */
+
+#endif /* _OBJCACHE_H_ */
@@ -0,0 +1,39 @@
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+#include <types.h>
+#include "opt-syscalls.h"
+#include "opt-filetable.h"
+
+#if OPT_FILETABLE
+
+#if !OPT_SYSCALLS
+#error "filetable requires syscalls"
+#endif
+
+/*
+ * Files opened by a process. Descriptors 0, 1 and 2 stay bound to
+ * the console, the others index p_filetable. Every open file is
+ * private to its process: fork gives the child its own copy, at the
+ * same offset.
+ */
+
+#define FILETABLE_FIRST     3       /*  first descriptor of a file          */
+#define FILETABLE_IOSIZE    4096    /*  bytes moved by a single VOP call    */
+
+struct proc;
+struct vnode;
+
+struct openfile {
+    struct vnode    *of_vnode;
+    off_t           of_offset;
+    int             of_accmode;     /*  O_RDONLY, O_WRONLY or O_RDWR        */
+};
+
+struct openfile *openfile_get(int fd);
+void            openfile_closeall(struct proc *p);
+int             openfile_copyall(struct proc *src, struct proc *dst);
+
+#endif /* OPT_FILETABLE */
+
+#endif /* _OPENFILE_H_ */
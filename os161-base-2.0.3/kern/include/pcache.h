@@ -0,0 +1,37 @@
+#ifndef _PCACHE_H_
+#define _PCACHE_H_
+
+#include <types.h>
+#include "opt-sharedtext.h"
+
+#if OPT_SHAREDTEXT
+
+/*
+ * Page cache of the text segments.
+ *
+ * Frames holding a text page loaded from an executable are indexed
+ * by (vnode, virtual address), so that other processes running the
+ * same executable map the same frame instead of reading the page
+ * again. Sharers are tracked by the coremap reference count and
+ * reverse map; a cached frame leaves the cache when its last sharer
+ * unmaps it or when it is evicted.
+ *
+ * All the functions but pcache_bootstrap and pcache_print_stats must
+ * be called holding cm_spinlock.
+ */
+
+#define PCACHE_NBUCKETS 128
+
+struct vnode;
+
+void    pcache_bootstrap(void);
+int     pcache_lookup(struct vnode *v, vaddr_t vaddr);
+bool    pcache_insert(struct vnode *v, vaddr_t vaddr, int index);
+void    pcache_remove(int index);
+void    pcache_shared(void);
+void    pcache_unshared(unsigned nframes);
+void    pcache_print_stats(void);
+
+#endif /* OPT_SHAREDTEXT */
+
+#endif /* _PCACHE_H_ */
@@ -40,10 +40,24 @@
 #include <pt.h>
 #include "opt-DEMANDVM.h"
 #include "opt-waitpid.h"
+#include "opt-fork.h"
+#include "opt-filetable.h"
+#include "opt-fastexit.h"
+#if OPT_FILETABLE
+#include <limits.h>
+#endif
+#if OPT_FASTEXIT
+#include <kern/time.h>
+#endif
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct openfile;
+
+#if OPT_FORK
+#define PROC_MAX 128	/* processes alive at the same time */
+#endif
 
 /*
  * Process structure.
@@ -82,6 +96,22 @@ struct proc {
 	int status;  			/*	exit status of the process	*/
 	struct semaphore *p_sem;
 #endif
+
+#if OPT_FASTEXIT
+	struct timespec p_exit_start;	/* time of the call to _exit */
+#endif
+
+#if OPT_FORK
+	pid_t p_pid;			/* process id */
+	struct proc *p_parent;		/* forking process, NULL if none or exited */
+	bool p_reaped;			/* claimed by a waitpid of the parent */
+	bool p_orphan;			/* the parent exited first, nobody waits */
+	bool p_exited;			/* called _exit */
+#endif
+
+#if OPT_FILETABLE
+	struct openfile *p_filetable[OPEN_MAX];	/* NULL if the descriptor is free */
+#endif
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -113,4 +143,18 @@ struct addrspace *proc_setas(struct addrspace *);
 int proc_wait(struct proc *proc);
 #endif
 
+#if OPT_FORK
+/* Find the process with the given pid, NULL if none. */
+struct proc *proc_search_pid(pid_t pid);
+
+/* Claim the child with the given pid for a waitpid of parent. */
+int proc_claim_child(pid_t pid, struct proc *parent, struct proc **child);
+
+/* Give up the children of an exiting process. */
+void proc_orphan_children(struct proc *parent);
+
+/* Mark the process as exited, true if nobody will wait for it. */
+bool proc_set_exited(struct proc *proc);
+#endif
+
 #endif /* _PROC_H_ */
@@ -0,0 +1,58 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <types.h>
+#include <kern/time.h>
+#include "opt-launchprof.h"
+
+#if OPT_LAUNCHPROF
+
+/*
+ * Launch profiles.
+ *
+ * The pages a program faults in during its startup (the first
+ * PROFILE_WINDOW_MS milliseconds, at most PROFILE_MAX_PAGES pages)
+ * are recorded and saved in a file of the emu filesystem, named after
+ * the program. The next runprogram of the same binary finds the
+ * profile and prefetches those pages in batches before entering user
+ * mode. A profile is discarded if the size of the binary changed.
+ */
+
+#define PROFILE_MAX_PAGES   64
+#define PROFILE_WINDOW_MS   500
+#define PROFILE_PREFIX      "emu0:/PROF_"
+#define PROFILE_MAGIC       0x50524f46      /*  "PROF"  */
+
+struct vnode;
+struct addrspace;
+
+/* content of a profile file */
+struct profile_data {
+    uint32_t            pd_magic;
+    uint32_t            pd_elfsize;         /*  size of the binary when recorded    */
+    uint32_t            pd_npages;
+    vaddr_t             pd_pages[PROFILE_MAX_PAGES];
+};
+
+struct launch_profile {
+    char                *lp_path;           /*  file holding the profile            */
+    bool                lp_replayed;        /*  started with a valid profile        */
+    bool                lp_recording;
+    bool                lp_startup;         /*  within the startup window           */
+    bool                lp_first;           /*  first instruction not run yet       */
+    unsigned            lp_faults;          /*  faults during the startup window    */
+    struct timespec     lp_start;
+    struct profile_data lp_data;
+};
+
+struct launch_profile  *profile_create(const char *progname, const struct timespec *start);
+void                    profile_begin(struct launch_profile *lp, struct vnode *v);
+void                    profile_prefetch(struct launch_profile *lp, struct addrspace *as,
+                                         struct vnode *v);
+void                    profile_fault(struct launch_profile *lp, vaddr_t vaddr);
+void                    profile_end(struct launch_profile *lp);
+void                    profile_print_stats(void);
+
+#endif /* OPT_LAUNCHPROF */
+
+#endif /* _PROFILE_H_ */
@@ -6,6 +6,14 @@
 #include "opt-DEMANDVM.h"
 #include "opt-noswap_rdonly.h"
 #include "opt-swap.h"
+#include "opt-uniformfill.h"
+#include "opt-ptswap.h"
+#include "opt-fork.h"
+#include "opt-heap.h"
+#include "opt-madvise.h"
+#include "opt-zeropage.h"
+#include "opt-fastexit.h"
+#include "opt-pagebusy.h"
 #include <swapfile.h>
 
 #if OPT_DEMANDVM
@@ -14,7 +22,8 @@
 #define IN_MEMORY 1
 #define IN_SWAP 2
 #define IN_MEMORY_RDONLY 3
-
+#define IN_FILL 4               /*  page is one repeated word, kept in the entry */
+#define IN_ZERO 5               /*  never written, mapped read-only to the zero frame */
 
 
 struct pt_entry
@@ -25,14 +34,76 @@ struct pt_entry
 #else
     unsigned int    pt_swap_index : 12;
 #endif
-    unsigned char   pt_status : 2;
+    unsigned char   pt_status : 3;
+    unsigned char   pt_cow : 1;         /*  frame shared, copy it on write */
+    unsigned char   pt_ra : 1;          /*  read ahead, not accessed yet   */
+    unsigned char   pt_dirty : 1;       /*  written through a file mapping */
+    unsigned char   pt_pf : 1;          /*  prefetched on a stride, not accessed yet */
+    unsigned char   pt_busy : 1;        /*  being loaded or swapped out, see pt_wait_busy */
+};
+
+/*
+ * The page table is a directory of leaves, each of them one page of
+ * entries. Leaves are allocated on the first access, and a leaf whose
+ * pages are all out of memory can be moved to swap (see pt_reclaim).
+ * The state and the pin count of the leaves are protected by
+ * cm_spinlock, as the entries themselves.
+ */
+#define PT_LEAF_ENTRIES     (PAGE_SIZE / sizeof(struct pt_entry))
+
+#define PT_LEAF_ABSENT      0   /*  no page, every entry NOT_LOADED  */
+#define PT_LEAF_RESIDENT    1
+#define PT_LEAF_LOADING     2   /*  being allocated or swapped in    */
+#define PT_LEAF_SWAPPING    3   /*  being written to swap            */
+#define PT_LEAF_SWAPPED     4
+
+#define PT_RECLAIM_SCAN     8   /*  leaves examined by a single pt_reclaim */
+
+struct pt_leaf
+{
+    struct pt_entry     *pl_entries;        /*  page of entries, NULL if not resident   */
+    unsigned int        pl_status;
+    unsigned int        pl_pin;             /*  faults in progress on the leaf          */
+    unsigned int        pl_swap_index;      /*  valid if PT_LEAF_SWAPPED                */
+    struct pt_leaf      *pl_prev;           /*  list of the resident leaves             */
+    struct pt_leaf      *pl_next;
 };
 
+struct pt_directory
+{
+    unsigned long       pd_nentries;
+    unsigned long       pd_maxentries;      /*  entries the directory can grow to   */
+    unsigned long       pd_nleaves;
+    struct pt_leaf      *pd_leaves;
+};
+
+void                pt_bootstrap(void);
 struct pt_entry     *pt_get_entry(struct addrspace *as, const vaddr_t vaddr);
-struct pt_entry     *pt_create(unsigned long pagetable_size);
-void                pt_empty(struct pt_entry* pt, int size);
-void                pt_destroy(struct pt_entry*);
+void                pt_put_entry(struct addrspace *as, const vaddr_t vaddr);
+#if OPT_MADVISE
+unsigned char       pt_peek_status(struct addrspace *as, const vaddr_t vaddr);
+#endif
+struct pt_directory *pt_create(unsigned long pagetable_size, unsigned long max_size);
+void                pt_grow(struct pt_directory *pt, unsigned long pagetable_size);
+void                pt_empty(struct pt_directory *pt);
+bool                pt_free_entry(struct pt_entry *pt_row);
+void                pt_destroy(struct pt_directory *pt);
+#if OPT_FORK
+int                 pt_copy(struct pt_directory *src, struct pt_directory *dst);
+#endif
+#if OPT_PTSWAP
+paddr_t             pt_reclaim(void);
+#endif
 void                pt_set_entry(struct pt_entry *pt_row, paddr_t paddr, unsigned int swap_index, unsigned char status);
+#if OPT_PAGEBUSY
+void                pt_busy_bootstrap(void);
+bool                pt_wait_busy(struct pt_entry *pt_row);
+void                pt_unbusy(struct pt_entry *pt_row);
+#endif
+#if OPT_UNIFORMFILL
+void                pt_set_fill(struct pt_entry *pt_row, uint32_t word);
+uint32_t            pt_get_fill(struct pt_entry *pt_row);
+#endif
 
 #endif /* OPT_DEMANDVM */
 
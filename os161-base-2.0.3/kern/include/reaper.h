@@ -0,0 +1,39 @@
+#ifndef _REAPER_H_
+#define _REAPER_H_
+
+#include <types.h>
+#include "opt-waitpid.h"
+#include "opt-fastexit.h"
+
+#if OPT_FASTEXIT
+
+#if !OPT_WAITPID
+#error "fastexit requires waitpid"
+#endif
+
+/*
+ * Deferred address space teardown.
+ *
+ * An exiting process hands its address space over to a kernel thread,
+ * the reaper, before waking its waiter, so that the waiter does not
+ * pay for the release of the frames and of the swap slots. The ELF
+ * vnode of the process is kept open until the address space has been
+ * destroyed, as the shared text pages are indexed by it. When the
+ * reaper is turned off the address space is destroyed by proc_destroy
+ * as before. The time from _exit to the return of the waiter is
+ * recorded in both cases.
+ */
+
+struct addrspace;
+struct vnode;
+struct timespec;
+
+void    reaper_bootstrap(void);
+bool    reaper_defer(struct addrspace *as, struct vnode *v);
+void    reaper_set(bool enabled);
+void    reaper_exit_done(const struct timespec *start);
+void    reaper_print_stats(void);
+
+#endif /* OPT_FASTEXIT */
+
+#endif /* _REAPER_H_ */
@@ -3,20 +3,79 @@
 
 #include <types.h>
 #include "opt-DEMANDVM.h"
+#include "opt-readahead.h"
+#include "opt-eagerload.h"
+#include "opt-stackgrow.h"
+#include "opt-heap.h"
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-objcache.h"
 
 #if OPT_DEMANDVM
 
+#if OPT_READAHEAD
+#define SEG_RA_MIN      1       /*  bounds of the readahead window, in pages  */
+#define SEG_RA_INIT     4
+#define SEG_RA_MAX      16
+#endif
+
+#if OPT_EAGERLOAD
+#define SEG_EAGER_THRESHOLD 8   /*  default: segments up to 8 pages are loaded eagerly    */
+#define SEG_EAGER_TEXT      2   /*  default: eager pages at the start of a larger text    */
+#define SEG_EAGER_STACK     1   /*  pages at the top of the stack allocated eagerly       */
+#define SEG_EAGER_MAX       32  /*  upper bound of the above                              */
+#endif
+
+#if OPT_STACKGROW
+#define SEG_STACK_INIT      2       /*  pages of the stack at exec time                 */
+#define SEG_STACK_MAX       1024    /*  default limit of the stack, in pages            */
+#define SEG_STACK_WINDOW    32      /*  faults this far below the stack extend it       */
+#define SEG_STACK_GUARD     16      /*  pages always left unmapped above the data       */
+#endif
+
+#if OPT_HEAP
+#define SEG_HEAP_MAX        4096    /*  limit of the heap, in pages                     */
+#endif
+
+#if OPT_MMAP
+#define SEG_MMAP_MAX        4096    /*  pages of the window of the file mappings        */
+#define SEG_MMAP_GUARD      16      /*  pages left unmapped below the stack             */
+#endif
+
+struct vnode;
+
 struct segment {
     vaddr_t     seg_first_vaddr;    /*  actual first address of the segment         */
     vaddr_t     seg_last_vaddr;     /*  last address of the segment                 */
     size_t      seg_elf_size;       /*  size of the segment within the elf          */
     off_t       seg_elf_offset;     /*  offset of the segment within the elf        */
     size_t      seg_npages;         /*  size of the segment in pages                */
+#if OPT_READAHEAD
+    unsigned    seg_ra_window;      /*  pages read ahead of a fault                 */
+    unsigned    seg_ra_issued;      /*  pages read ahead by the last cluster        */
+    unsigned    seg_ra_hits;        /*  of them, the ones accessed since            */
+#endif
+#if OPT_EAGERLOAD
+    unsigned    seg_eager;          /*  pages loaded at exec time, from the start
+                                        of the segment (from the top for the stack)  */
+#endif
+#if OPT_MMAP
+    struct vnode *seg_vnode;        /*  mapped file, NULL for the elf segments      */
+    bool        seg_writable;
+    bool        seg_shared;         /*  writes are carried through to the file      */
+#endif
+#if OPT_MADVISE
+    int         seg_advice;         /*  access pattern given by madvise, MADV_*     */
+#endif
 };
 
 struct segment *segment_create(void);
 void            segment_define(struct segment *seg, off_t elf_offset, vaddr_t base_vaddr, vaddr_t first_vaddr, vaddr_t last_vaddr, size_t npages, size_t elfsize); 
+struct segment *segment_copy(const struct segment *seg);
 void            segment_destroy(struct segment *seg);
+#if OPT_OBJCACHE
+void            segment_bootstrap(void);
+#endif
 
 #endif /* OPT_DEMANDVM */
 
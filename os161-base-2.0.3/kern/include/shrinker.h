@@ -0,0 +1,38 @@
+#ifndef _SHRINKER_H_
+#define _SHRINKER_H_
+
+#include <types.h>
+#include "opt-DEMANDVM.h"
+#include "opt-shrinker.h"
+
+#if OPT_SHRINKER
+
+#if !OPT_DEMANDVM
+#error "shrinker requires DEMANDVM"
+#endif
+
+/*
+ * Memory kept by kernel caches and given back under pressure.
+ *
+ * When a kernel allocation finds no free frame, the coremap calls the
+ * registered shrinkers before evicting user pages. A shrinker gives
+ * back what its subsystem can spare and returns the pages it released
+ * to the coremap. The shrinkers of SHRINK_OBJECTS free cached objects;
+ * those of SHRINK_HEAP run after them and return the kmalloc pages
+ * the objects were keeping. Shrinkers run with no spinlock held and
+ * must not allocate memory.
+ */
+
+#define SHRINKER_MAX    8
+
+#define SHRINK_OBJECTS  0
+#define SHRINK_HEAP     1
+
+void        shrinker_register(const char *name, int level,
+                              unsigned (*shrink)(unsigned npages));
+unsigned    shrinker_run(unsigned npages);
+void        shrinker_print_stats(void);
+
+#endif /* OPT_SHRINKER */
+
+#endif /* _SHRINKER_H_ */
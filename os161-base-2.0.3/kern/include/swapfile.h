@@ -3,19 +3,52 @@
 
 #include <types.h>
 #include "opt-swap.h"
+#include "opt-fastexit.h"
 
 #if OPT_SWAP
 
 #define SWAPFILE_SIZE 9 * 1024 * 1024
-#define SWAP_INDEX_SIZE 12 /* Calculated as upper(log_2(SWAPFILE_SIZE/PAGE_SIZE)) */
 #define SWAPFILE_NAME "emu0:/SWAPFILE"
 #define SWAPFILE_NPAGES SWAPFILE_SIZE/PAGE_SIZE
+#define SWAP_CLUSTER_MAX 16 /* max pages written by a single swap_out_cluster */
+
+/*
+ * Swap is made of up to SWAP_MAX_AREAS areas, each of them either a
+ * file opened through the VFS or a raw disk device (e.g. lhd0:) used
+ * directly through DEVOP_IO. A swap index is made of the area number
+ * in the upper SWAP_AREA_BITS bits and of the slot within the area in
+ * the lower SWAP_SLOT_BITS bits.
+ */
+#define SWAP_MAX_AREAS 4
+#define SWAP_AREA_BITS 2    /* upper(log_2(SWAP_MAX_AREAS))         */
+#define SWAP_SLOT_BITS 14   /* at most 64 MB of swap per area       */
+#define SWAP_INDEX_SIZE (SWAP_AREA_BITS + SWAP_SLOT_BITS)
+#define SWAP_AREA_MAXPAGES (1 << SWAP_SLOT_BITS)
+
+#define SWAP_INDEX(area, slot) (((area) << SWAP_SLOT_BITS) | (slot))
+#define SWAP_INDEX_AREA(index) ((index) >> SWAP_SLOT_BITS)
+#define SWAP_INDEX_SLOT(index) ((index) & (SWAP_AREA_MAXPAGES - 1))
+
+/* Default priorities: the higher the priority, the earlier it is filled */
+#define SWAP_PRIO_FILE 0
+#define SWAP_PRIO_RAW  1
 
 void            swap_bootstrap(void);
 void            swap_in(paddr_t page_paddr, unsigned int swap_index);
 unsigned int    swap_out(paddr_t page_paddr);
+int             swap_out_cluster(const paddr_t *pages, unsigned npages, unsigned int *first_index);
 void            swap_free(unsigned int swap_index);
+void            swap_dup(unsigned int swap_index);
 void            swap_destroy(void);
+#if OPT_FASTEXIT
+void            swap_free_begin(void);
+void            swap_free_locked(unsigned int swap_index);
+void            swap_free_end(void);
+#endif
+
+int             swap_add(const char *name, int priority);
+int             swap_remove(const char *name);
+void            swap_print_areas(void);
 
 #endif /* OPT_SWAP */
 
@@ -0,0 +1,52 @@
+#ifndef _SWAPMAP_H_
+#define _SWAPMAP_H_
+
+#include <types.h>
+#include "opt-swap.h"
+
+#if OPT_SWAP
+
+/*
+ * Swap slot allocator.
+ *
+ * Slots are tracked one bit each in 32-bit words, grouped in clusters
+ * of SWAPMAP_CLUSTER_SLOTS slots with a free counter per cluster, so
+ * that full clusters are skipped without looking at their bits.
+ * Allocation is next-fit: the search starts from a rotating cursor
+ * placed right after the last allocated slot, thus consecutive
+ * evictions end up in consecutive slots of the swap area.
+ *
+ * A slot can be shared by several page table entries (see swapmap_dup):
+ * sm_refs counts the references beyond the first one, and the slot is
+ * released when the last one is freed.
+ *
+ * The allocator does no locking, the caller has to serialize the
+ * accesses (swapfile.c does it with swaplock).
+ */
+
+#define SWAPMAP_WORD_SLOTS      32
+#define SWAPMAP_CLUSTER_WORDS   8
+#define SWAPMAP_CLUSTER_SLOTS   (SWAPMAP_WORD_SLOTS * SWAPMAP_CLUSTER_WORDS)
+
+struct swapmap {
+    unsigned    sm_nslots;          /*  number of slots                         */
+    unsigned    sm_nwords;          /*  number of words of sm_map               */
+    unsigned    sm_nclusters;       /*  number of clusters                      */
+    unsigned    sm_nfree;           /*  number of free slots                    */
+    unsigned    sm_cursor;          /*  next slot from which to search          */
+    uint32_t    *sm_map;            /*  one bit per slot, set if used           */
+    uint16_t    *sm_cluster_free;   /*  free slots of each cluster              */
+    uint16_t    *sm_refs;           /*  extra references of each slot           */
+};
+
+struct swapmap *swapmap_create(unsigned nslots);
+void            swapmap_destroy(struct swapmap *sm);
+int             swapmap_alloc(struct swapmap *sm, unsigned *slot);
+int             swapmap_alloc_run(struct swapmap *sm, unsigned npages, unsigned *first);
+void            swapmap_free(struct swapmap *sm, unsigned slot);
+void            swapmap_dup(struct swapmap *sm, unsigned slot);
+bool            swapmap_isset(struct swapmap *sm, unsigned slot);
+
+#endif /* OPT_SWAP */
+
+#endif /* _SWAPMAP_H_ */
@@ -139,4 +139,42 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at the same time, a writer
+ * holds it alone. Once a writer is waiting, new readers wait as well,
+ * so that writers are not starved: a reader must thus never acquire
+ * the lock again while holding it.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+	struct wchan *rw_wchan;
+	struct spinlock rw_lock;
+        volatile unsigned rw_readers;           /* holding it shared */
+        volatile unsigned rw_writers_waiting;
+        struct thread *volatile rw_writer;      /* holding it exclusive */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared, as soon as no writer
+ *                           holds it or waits for it.
+ *    rwlock_release_read  - Free a shared hold of the lock.
+ *    rwlock_acquire_write - Get the lock exclusive, once it is free.
+ *    rwlock_release_write - Free the lock, held exclusive by the
+ *                           current thread.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
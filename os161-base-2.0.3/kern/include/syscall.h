@@ -33,6 +33,16 @@
 
 #include <cdefs.h> /* for __DEAD */
 #include <opt-syscalls.h>
+#include <opt-fork.h>
+#include <opt-heap.h>
+#include <opt-filetable.h>
+#include <opt-mmap.h>
+#include <opt-madvise.h>
+
+/* the address space calls live in vm_syscall.c, built with the heap */
+#if OPT_MADVISE && !OPT_HEAP
+#error "madvise requires the heap option"
+#endif
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -65,6 +75,31 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 int sys_write(int fd, userptr_t buf_ptr, size_t size);
 int sys_read(int fd, userptr_t buf_ptr, size_t size);
 void sys__exit(int status);
+#if OPT_FILETABLE
+int sys_open(userptr_t path, int openflags, mode_t mode, int *retval);
+int sys_close(int fd);
+#endif
+#endif
+
+#if OPT_FORK
+int sys_fork(struct trapframe *ctf, pid_t *retval);
+int sys_getpid(pid_t *retval);
+int sys_waitpid(pid_t pid, userptr_t statusp, int options, pid_t *retval);
+#endif
+
+#if OPT_HEAP
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+#endif
+
+#if OPT_MMAP
+int sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd, off_t offset,
+             vaddr_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+#endif
+
+#if OPT_MADVISE
+int sys_madvise(vaddr_t addr, size_t len, int advice);
+int sys_mincore(vaddr_t addr, size_t len, userptr_t vec);
 #endif
 
 #endif /* _SYSCALL_H_ */
@@ -40,6 +40,7 @@
 #include <pt.h>
 #include <machine/vm.h>
 #include "opt-DEMANDVM.h"
+#include "opt-pin.h"
 
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
@@ -59,10 +60,17 @@ void    free_kpages(vaddr_t addr);
 
 #if OPT_DEMANDVM
 /* Allocate/free user pages */
-void    free_upage(paddr_t addr);
+void    free_upage(paddr_t addr, struct pt_entry *pt_row);
 paddr_t alloc_upage(struct pt_entry *pt_row);
 #endif
 
+#if OPT_PIN
+/* Pin the frames of a user range of curproc for I/O from the kernel */
+#define VM_PIN_MAXPAGES     16      /* pages pinned by a single vm_pin */
+int     vm_pin(vaddr_t start, size_t len, bool write, paddr_t *frames);
+void    vm_unpin(const paddr_t *frames, unsigned npages);
+#endif
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void    vm_tlbshootdown(const struct tlbshootdown *);
 
@@ -3,6 +3,7 @@
 
 #include <types.h>
 #include "opt-DEMANDVM.h"
+#include "opt-vmalloc.h"
 
 #if OPT_DEMANDVM
 
@@ -13,11 +14,17 @@
  *      Set ro to true to insert as read-only.
  * 
  *  tlb_remove: remove a virtual address from the TLB if is present.
+ *
+ *  tlb_insert_kernel: as tlb_insert, for a writable kernel page of
+ *      kseg2; not counted among the user faults.
  */
 void tlb_invalidate(void);
 void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro);
 void tlb_remove_by_vaddr(vaddr_t vaddr);
 void tlb_remove_by_paddr(paddr_t paddr);
+#if OPT_VMALLOC
+void tlb_insert_kernel(vaddr_t vaddr, paddr_t paddr);
+#endif
 
 #endif /* OPT_DEMANDVM */
 
@@ -0,0 +1,37 @@
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+#include <types.h>
+#include "opt-DEMANDVM.h"
+#include "opt-vmalloc.h"
+
+#if OPT_VMALLOC
+
+#if !OPT_DEMANDVM
+#error "vmalloc requires DEMANDVM"
+#endif
+
+/*
+ * Kernel allocations of several pages which do not need contiguous
+ * frames. The frames are taken one at a time and mapped at consecutive
+ * addresses of a window at the start of kseg2, which goes through the
+ * TLB: the mappings are kept in a kernel page table and loaded by
+ * vmalloc_fault on a miss. kmalloc hands its allocations above one
+ * page to vmalloc, and falls back to contiguous kseg0 frames only
+ * before vmalloc_bootstrap or once the window is full.
+ */
+
+struct tlbshootdown;
+
+#define VMALLOC_BASE    MIPS_KSEG2
+#define VMALLOC_PAGES   1024        /*  size of the window, 4M  */
+
+void    vmalloc_bootstrap(void);
+void   *vmalloc(unsigned npages);
+void    vfree(void *ptr);
+void    vmalloc_tlbshootdown(const struct tlbshootdown *ts);
+int     vmalloc_fault(int faulttype, vaddr_t faultaddress);
+
+#endif /* OPT_VMALLOC */
+
+#endif /* _VMALLOC_H_ */
@@ -11,6 +11,41 @@
 #define VMSTAT_PAGE_FAULT_ELF 7
 #define VMSTAT_PAGE_FAULT_SWAP 8
 #define VMSTAT_SWAP_WRITE 9
+#define VMSTAT_SWAP_WRITE_UNIFORM 10
+#define VMSTAT_SWAP_READ_UNIFORM 11
+#define VMSTAT_KSM_MERGE 12
+#define VMSTAT_KSM_BROKEN 13
+#define VMSTAT_PT_RECLAIM 14
+#define VMSTAT_PT_SWAP_OUT 15
+#define VMSTAT_PT_SWAP_IN 16
+#define VMSTAT_PCACHE_HIT 17
+#define VMSTAT_RA_LOADED 18
+#define VMSTAT_RA_HIT 19
+#define VMSTAT_RA_WASTE 20
+#define VMSTAT_EAGER_LOADED 21
+#define VMSTAT_PROFILE_PREFETCHED 22
+#define VMSTAT_COW_SHARED 23
+#define VMSTAT_COW_COPY 24
+#define VMSTAT_STACK_GROW 25
+#define VMSTAT_HEAP_RELEASED 26
+#define VMSTAT_MMAP_READ 27
+#define VMSTAT_MMAP_WRITEBACK 28
+#define VMSTAT_MMAP_DROPPED 29
+#define VMSTAT_MADV_PREFETCHED 30
+#define VMSTAT_MADV_COLD_EVICTED 31
+#define VMSTAT_MADV_FREED 32
+#define VMSTAT_STRIDE_PREFETCHED 33
+#define VMSTAT_STRIDE_HIT 34
+#define VMSTAT_STRIDE_WASTE 35
+#define VMSTAT_ZERO_MAPPED 36
+#define VMSTAT_ZERO_COPY 37
+#define VMSTAT_BUSY_WAIT 38
+#define VMSTAT_BUSY_AVOIDED 39
+#define VMSTAT_KTLB_FAULT 40
+#define VMSTAT_VMALLOC_PAGES 41
+#define VMSTAT_SHRINK_PAGES 42
+
+#define VMSTAT_COUNT 43
 
 void vmstats_hit(unsigned int stat);
 void vmstats_print(void);
@@ -61,6 +61,23 @@
 #if OPT_SWAP
 #include <swapfile.h>
 #endif
+#include "opt-ksm.h"
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#include "opt-sharedtext.h"
+#include "opt-eagerload.h"
+#if OPT_SHAREDTEXT
+#include <pcache.h>
+#endif
+#include "opt-launchprof.h"
+#include "opt-shrinker.h"
+#if OPT_SHRINKER
+#include <shrinker.h>
+#endif
+#if OPT_LAUNCHPROF
+#include <profile.h>
+#endif
 /*
  * These two pieces of data are maintained by the makefiles and build system.
  * buildconfig is the name of the config file the kernel was configured with.
@@ -163,6 +180,21 @@ shutdown(void)
 
 	kprintf("Shutting down.\n");
 
+#if OPT_KSM
+	ksm_print_stats();
+#endif
+#if OPT_SHAREDTEXT
+	pcache_print_stats();
+#endif
+#if OPT_EAGERLOAD
+	as_print_exec_stats();
+#endif
+#if OPT_LAUNCHPROF
+	profile_print_stats();
+#endif
+#if OPT_SHRINKER
+	shrinker_print_stats();
+#endif
 #if OPT_STATS
 	vmstats_print();
 #endif
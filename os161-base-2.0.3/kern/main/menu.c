@@ -46,6 +46,29 @@
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-waitpid.h"
+#include "opt-swap.h"
+#if OPT_SWAP
+#include <swapfile.h>
+#endif
+#include "opt-ksm.h"
+#include "opt-fastexit.h"
+#include "opt-eagerload.h"
+#include "opt-stackgrow.h"
+#include "opt-objcache.h"
+#include "opt-shrinker.h"
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#if OPT_FASTEXIT
+#include <reaper.h>
+#endif
+#if OPT_OBJCACHE
+#include <objcache.h>
+#endif
+#if OPT_SHRINKER
+#include <shrinker.h>
+#include <coremap.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -498,6 +521,226 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_OBJCACHE
+static
+int
+cmd_objcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	objcache_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_SHRINKER
+/*
+ * Command for the shrinker stats; with "run", first call the
+ * shrinkers as if the whole memory was asked for.
+ */
+static
+int
+cmd_shrink(int nargs, char **args)
+{
+	unsigned freed;
+
+	if (nargs == 2 && !strcmp(args[1], "run")) {
+		freed = shrinker_run(coremap_nframes());
+		kprintf("%u pages freed\n", freed);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: shr [run]\n");
+		return EINVAL;
+	}
+
+	shrinker_print_stats();
+
+	return 0;
+}
+#endif
+
+#if OPT_SWAP
+/*
+ * Command for adding a swap area: a file path, or a raw disk
+ * device name with the trailing colon (e.g. lhd0:).
+ */
+static
+int
+cmd_swapon(int nargs, char **args)
+{
+	int priority;
+	size_t len;
+
+	if (nargs != 2 && nargs != 3) {
+		kprintf("Usage: swapon file|device: [priority]\n");
+		return EINVAL;
+	}
+
+	len = strlen(args[1]);
+	if (nargs == 3) {
+		priority = atoi(args[2]);
+	}
+	else {
+		priority = (len > 0 && args[1][len - 1] == ':') ?
+			SWAP_PRIO_RAW : SWAP_PRIO_FILE;
+	}
+
+	return swap_add(args[1], priority);
+}
+
+static
+int
+cmd_swapoff(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: swapoff file|device:\n");
+		return EINVAL;
+	}
+
+	result = swap_remove(args[1]);
+	if (result == EBUSY) {
+		kprintf("swapoff: %s still in use, draining: it goes away "
+			"once its pages are gone\n", args[1]);
+	}
+	return result;
+}
+
+static
+int
+cmd_swapinfo(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	swap_print_areas();
+
+	return 0;
+}
+#endif
+
+#if OPT_EAGERLOAD
+/*
+ * Parse a page count of the eager command: digits only, so that a
+ * negative or garbled argument is not taken as a huge unsigned.
+ */
+static
+int
+eager_pages(const char *arg, unsigned *pages)
+{
+	const char *p;
+
+	if (*arg == '\0') {
+		return EINVAL;
+	}
+	for (p = arg; *p != '\0'; p++) {
+		if (*p < '0' || *p > '9') {
+			return EINVAL;
+		}
+	}
+	*pages = atoi(arg);
+	return 0;
+}
+
+static
+int
+cmd_eager(int nargs, char **args)
+{
+	unsigned threshold, textpages;
+
+	if (nargs != 1 && nargs != 3) {
+		kprintf("Usage: eager [threshold textpages]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 3) {
+		if (eager_pages(args[1], &threshold) ||
+		    eager_pages(args[2], &textpages)) {
+			kprintf("eager: threshold and textpages must be "
+				"non-negative page counts\n");
+			kprintf("Usage: eager [threshold textpages]\n");
+			return EINVAL;
+		}
+		as_set_eager(threshold, textpages);
+	}
+	as_print_exec_stats();
+
+	return 0;
+}
+#endif
+
+#if OPT_STACKGROW
+static
+int
+cmd_stack(int nargs, char **args)
+{
+	int maxpages;
+
+	if (nargs != 1 && nargs != 2) {
+		kprintf("Usage: stack [maxpages]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		maxpages = atoi(args[1]);
+		if (maxpages <= 0) {
+			kprintf("stack: maxpages must be positive\n");
+			kprintf("Usage: stack [maxpages]\n");
+			return EINVAL;
+		}
+		as_set_stack_max(maxpages);
+	}
+	as_print_stack_max();
+
+	return 0;
+}
+#endif
+
+#if OPT_KSM
+static
+int
+cmd_ksm(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	ksm_print_stats();
+
+	return 0;
+}
+#endif
+
+#if OPT_FASTEXIT
+static
+int
+cmd_reap(int nargs, char **args)
+{
+	if (nargs != 1 && nargs != 2) {
+		kprintf("Usage: reap [on|off]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		if (!strcmp(args[1], "on")) {
+			reaper_set(true);
+		}
+		else if (!strcmp(args[1], "off")) {
+			reaper_set(false);
+		}
+		else {
+			kprintf("Usage: reap [on|off]\n");
+			return EINVAL;
+		}
+	}
+	reaper_print_stats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -540,6 +783,23 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if OPT_SWAP
+	"[swapon]  Add a swap area           ",
+	"[swapoff] Remove a swap area        ",
+	"[swapinfo] Show swap areas          ",
+#endif
+#if OPT_KSM
+	"[ksm]     Show same-page merging    ",
+#endif
+#if OPT_EAGERLOAD
+	"[eager]   Set eager loading policy  ",
+#endif
+#if OPT_STACKGROW
+	"[stack]   Set the stack size limit  ",
+#endif
+#if OPT_FASTEXIT
+	"[reap]    Set deferred exit teardown",
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -605,6 +865,12 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_OBJCACHE
+	"[oc] Object cache stats             ",
+#endif
+#if OPT_SHRINKER
+	"[shr] Shrinker stats                ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -648,6 +914,23 @@ static struct {
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
+#if OPT_SWAP
+	{ "swapon",	cmd_swapon },
+	{ "swapoff",	cmd_swapoff },
+	{ "swapinfo",	cmd_swapinfo },
+#endif
+#if OPT_KSM
+	{ "ksm",	cmd_ksm },
+#endif
+#if OPT_EAGERLOAD
+	{ "eager",	cmd_eager },
+#endif
+#if OPT_STACKGROW
+	{ "stack",	cmd_stack },
+#endif
+#if OPT_FASTEXIT
+	{ "reap",	cmd_reap },
+#endif
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -656,6 +939,12 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_OBJCACHE
+	{ "oc",         cmd_objcachestats },
+#endif
+#if OPT_SHRINKER
+	{ "shr",        cmd_shrink },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -43,6 +43,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -51,22 +52,238 @@
 #include <vfs.h>
 #include <synch.h>
 #include "opt-waitpid.h"
+#include "opt-syscalls.h"
+#include "opt-fork.h"
+#include "opt-fastexit.h"
+#include "opt-objcache.h"
+#include <limits.h>
+#include <openfile.h>
+#if OPT_FASTEXIT
+#include <reaper.h>
+#endif
+#if OPT_OBJCACHE
+#include <objcache.h>
+#endif
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+#if OPT_FORK
+#if !OPT_WAITPID || !OPT_SYSCALLS
+#error "fork requires the waitpid and syscalls options"
+#endif
+
+/*
+ * Process table: the pid of a process is its index plus PID_MIN.
+ */
+static struct proc *proc_table[PROC_MAX];
+static int proc_last_index = -1;	/* last slot assigned */
+static struct spinlock proc_table_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Assign a pid to the process, searching round robin from the last
+ * one assigned. Returns false if the table is full.
+ */
+static bool
+proc_add_pid(struct proc *proc)
+{
+  int i, index;
+
+  spinlock_acquire(&proc_table_lock);
+  for (i = 1; i <= PROC_MAX; i++) {
+    index = (proc_last_index + i) % PROC_MAX;
+    if (proc_table[index] == NULL) {
+      proc_table[index] = proc;
+      proc_last_index = index;
+      proc->p_pid = index + PID_MIN;
+      spinlock_release(&proc_table_lock);
+      return true;
+    }
+  }
+  spinlock_release(&proc_table_lock);
+
+  return false;
+}
+
+/*
+ * Remove the process from the table. Its children, if any, have been
+ * given up at its exit, see proc_orphan_children.
+ */
+static void
+proc_remove_pid(struct proc *proc)
+{
+  int index = proc->p_pid - PID_MIN;
+
+  KASSERT(index >= 0 && index < PROC_MAX);
+
+  spinlock_acquire(&proc_table_lock);
+  KASSERT(proc_table[index] == proc);
+  proc_table[index] = NULL;
+  spinlock_release(&proc_table_lock);
+}
+
+struct proc *
+proc_search_pid(pid_t pid)
+{
+  struct proc *proc;
+
+  if (pid < PID_MIN || pid >= PID_MIN + PROC_MAX) {
+    return NULL;
+  }
+
+  spinlock_acquire(&proc_table_lock);
+  proc = proc_table[pid - PID_MIN];
+  spinlock_release(&proc_table_lock);
+
+  return proc;
+}
+
+/*
+ * Find the child of parent with the given pid, and mark it as
+ * claimed: only the first waitpid for it gets it, and destroys it.
+ * Processes started from the menu have no parent, they are waited
+ * for by the menu alone. Returns ESRCH if there is no such process,
+ * ECHILD if it is not a child of parent or is already claimed.
+ */
+int
+proc_claim_child(pid_t pid, struct proc *parent, struct proc **child)
+{
+  struct proc *proc;
+
+  KASSERT(parent != NULL);
+
+  if (pid < PID_MIN || pid >= PID_MIN + PROC_MAX) {
+    return ESRCH;
+  }
+
+  spinlock_acquire(&proc_table_lock);
+  proc = proc_table[pid - PID_MIN];
+  if (proc == NULL) {
+    spinlock_release(&proc_table_lock);
+    return ESRCH;
+  }
+  if (proc->p_parent != parent || proc->p_reaped) {
+    spinlock_release(&proc_table_lock);
+    return ECHILD;
+  }
+  proc->p_reaped = true;
+  spinlock_release(&proc_table_lock);
+
+  *child = proc;
+  return 0;
+}
+
+/*
+ * Called by a process at its exit: no waitpid can come for its
+ * children anymore. Those which have exited already are destroyed
+ * here, the others become orphans and are destroyed by their own
+ * thread when they exit (see proc_set_exited).
+ */
+void
+proc_orphan_children(struct proc *parent)
+{
+  struct proc *child;
+  int i;
+
+  KASSERT(parent != NULL);
+
+  spinlock_acquire(&proc_table_lock);
+  for (i = 0; i < PROC_MAX; i++) {
+    child = proc_table[i];
+    if (child == NULL || child->p_parent != parent) {
+      continue;
+    }
+    child->p_parent = NULL;
+    if (!child->p_exited) {
+      child->p_orphan = true;
+      continue;
+    }
+    /* claimed as by a waitpid, the table may change meanwhile */
+    child->p_reaped = true;
+    spinlock_release(&proc_table_lock);
+    proc_wait(child);
+    spinlock_acquire(&proc_table_lock);
+  }
+  spinlock_release(&proc_table_lock);
+}
+
+/*
+ * Mark the process as exited. Returns true if it is an orphan: no
+ * process will wait for it, and its thread destroys it. Otherwise its
+ * parent, or the menu, destroys it in proc_wait. Either the exit or
+ * the exit of the parent comes first, under proc_table_lock, so that
+ * exactly one of the two destroys the process.
+ */
+bool
+proc_set_exited(struct proc *proc)
+{
+  bool orphan;
+
+  spinlock_acquire(&proc_table_lock);
+  proc->p_exited = true;
+  orphan = proc->p_orphan;
+  spinlock_release(&proc_table_lock);
+
+  return orphan;
+}
+#endif
+
 #if OPT_WAITPID
 static void
 proc_init_waitpid(struct proc *proc, const char *name) {
+#if OPT_OBJCACHE
+  /* created with the cached proc, and back at 0 when it is freed */
+  (void)name;
+  KASSERT(proc->p_sem->sem_count == 0);
+#else
   proc->p_sem = sem_create(name, 0);
+#endif
 }
 
 
 static void
 proc_end_waitpid(struct proc *proc) {
+#if OPT_OBJCACHE
+  /* the parent has consumed the V of the exit */
+  KASSERT(proc->p_sem->sem_count == 0);
+#else
   sem_destroy(proc->p_sem);
+#endif
+}
+#endif
+
+#if OPT_OBJCACHE
+static struct objcache *proc_cache;
+
+/*
+ * Constructed state of a cached proc: its waitpid semaphore.
+ */
+static int
+proc_ctor(void *obj) {
+#if OPT_WAITPID
+  struct proc *proc = obj;
+
+  proc->p_sem = sem_create("proc", 0);
+  if (proc->p_sem == NULL) {
+    return ENOMEM;
+  }
+#else
+  (void)obj;
+#endif
+  return 0;
+}
+
+static void
+proc_dtor(void *obj) {
+#if OPT_WAITPID
+  struct proc *proc = obj;
+
+  sem_destroy(proc->p_sem);
+#else
+  (void)obj;
+#endif
 }
 #endif
 
@@ -79,13 +296,21 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
+#if OPT_OBJCACHE
+	proc = objcache_alloc(proc_cache);
+#else
 	proc = kmalloc(sizeof(*proc));
+#endif
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
+#if OPT_OBJCACHE
+		objcache_free(proc_cache, proc);
+#else
 		kfree(proc);
+#endif
 		return NULL;
 	}
 
@@ -97,6 +322,28 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+#if OPT_DEMANDVM
+	proc->p_vnode = NULL;
+#endif
+#if OPT_FILETABLE
+	bzero(proc->p_filetable, sizeof(proc->p_filetable));
+#endif
+
+#if OPT_FORK
+	proc->p_parent = NULL;
+	proc->p_reaped = false;
+	proc->p_orphan = false;
+	proc->p_exited = false;
+	if (!proc_add_pid(proc)) {
+		kfree(proc->p_name);
+#if OPT_OBJCACHE
+		objcache_free(proc_cache, proc);
+#else
+		kfree(proc);
+#endif
+		return NULL;
+	}
+#endif
 
 #if OPT_WAITPID
 	proc_init_waitpid(proc,name);
@@ -114,11 +361,6 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
-
-#if OPT_DEMANDVM
-	vfs_close(proc->p_vnode);
-#endif
-
 	/*
 	 * You probably want to destroy and null out much of the
 	 * process (particularly the address space) at exit time if
@@ -137,6 +379,9 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+#if OPT_FILETABLE
+	openfile_closeall(proc);
+#endif
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -190,15 +435,32 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
+#if OPT_DEMANDVM
+	/*
+	 * closed after the address space, as the shared text pages
+	 * are indexed by the vnode until they are unmapped.
+	 */
+	if (proc->p_vnode != NULL) {
+		vfs_close(proc->p_vnode);
+	}
+#endif
+
 	KASSERT(proc->p_numthreads == 0);
 	spinlock_cleanup(&proc->p_lock);
 
 #if OPT_WAITPID
 	proc_end_waitpid(proc);
 #endif
+#if OPT_FORK
+	proc_remove_pid(proc);
+#endif
 
 	kfree(proc->p_name);
+#if OPT_OBJCACHE
+	objcache_free(proc_cache, proc);
+#else
 	kfree(proc);
+#endif
 }
 
 /*
@@ -207,6 +469,13 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+#if OPT_OBJCACHE
+	proc_cache = objcache_create("proc", sizeof(struct proc),
+				     proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: cannot create the proc cache\n");
+	}
+#endif
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -355,16 +624,25 @@ proc_setas(struct addrspace *newas)
 int proc_wait(struct proc *proc){
 
 	int return_status;
+#if OPT_FASTEXIT
+	struct timespec exit_start;
+#endif
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
 	P(proc -> p_sem);
 	return_status = proc->status;
+#if OPT_FASTEXIT
+	exit_start = proc->p_exit_start;
+#endif
 	/* 
 	 * destroy the address space of the 
 	 * process after getting the exit status
 	 */
 	proc_destroy(proc);		
+#if OPT_FASTEXIT
+	reaper_exit_done(&exit_start);
+#endif
 	return return_status;
 
 }
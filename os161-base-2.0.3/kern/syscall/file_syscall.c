@@ -10,6 +10,324 @@
 #include <copyinout.h>
 #include <syscall.h>
 #include <lib.h>
+#include "opt-filetable.h"
+#include "opt-pin.h"
+#if OPT_FILETABLE
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <openfile.h>
+#endif
+#if OPT_FILETABLE && OPT_PIN
+#include <vm.h>
+#endif
+
+#if OPT_FILETABLE
+/**
+ * @brief open file of the current process bound to fd.
+ * 
+ * @param fd 
+ * @return struct openfile*, NULL if fd is not an open file
+ */
+struct openfile *
+openfile_get(int fd)
+{
+  KASSERT(curproc != NULL);
+
+  if (fd < FILETABLE_FIRST || fd >= OPEN_MAX) {
+    return NULL;
+  }
+  return curproc->p_filetable[fd];
+}
+
+/**
+ * @brief close every file still open by p.
+ * 
+ * @param p 
+ */
+void
+openfile_closeall(struct proc *p)
+{
+  int fd;
+
+  for (fd = FILETABLE_FIRST; fd < OPEN_MAX; fd++) {
+    if (p->p_filetable[fd] != NULL) {
+      vfs_close(p->p_filetable[fd]->of_vnode);
+      kfree(p->p_filetable[fd]);
+      p->p_filetable[fd] = NULL;
+    }
+  }
+}
+
+/**
+ * @brief give dst a copy of every file open by src. On failure the
+ * files copied so far are left in dst, to be closed with it.
+ * 
+ * @param src 
+ * @param dst 
+ * @return int 0 on success, ENOMEM otherwise
+ */
+int
+openfile_copyall(struct proc *src, struct proc *dst)
+{
+  struct openfile *of;
+  int fd;
+
+  for (fd = FILETABLE_FIRST; fd < OPEN_MAX; fd++) {
+    if (src->p_filetable[fd] == NULL) {
+      continue;
+    }
+    of = kmalloc(sizeof(struct openfile));
+    if (of == NULL) {
+      return ENOMEM;
+    }
+    *of = *src->p_filetable[fd];
+    VOP_INCREF(of->of_vnode);
+    dst->p_filetable[fd] = of;
+  }
+
+  return 0;
+}
+
+#if OPT_PIN
+/**
+ * @brief read or write an open file at its offset. Data is moved
+ * straight from or to the user buffer: its pages are pinned (see
+ * vm_pin) and handed to the file system through their kernel
+ * addresses, so that no user page fault, which may have to write
+ * back a mapped page, happens while the file system holds its locks.
+ * 
+ * @param fd 
+ * @param buf_ptr 
+ * @param size 
+ * @param rw 
+ * @return int bytes moved, -1 on error
+ */
+static int
+file_io(int fd, userptr_t buf_ptr, size_t size, enum uio_rw rw)
+{
+  struct openfile *of;
+  struct iovec iov[VM_PIN_MAXPAGES];
+  paddr_t frames[VM_PIN_MAXPAGES];
+  struct uio ku;
+  vaddr_t addr, offset;
+  size_t done, chunk, moved, len;
+  unsigned i, npages;
+  int result;
+
+  of = openfile_get(fd);
+  if (of == NULL ||
+      (rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+      (rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+    return -1;
+  }
+
+  done = 0;
+  result = 0;
+  while (done < size) {
+    /* at most VM_PIN_MAXPAGES pages, the first one may be partial */
+    addr = (vaddr_t)buf_ptr + done;
+    chunk = VM_PIN_MAXPAGES * PAGE_SIZE - addr % PAGE_SIZE;
+    if (chunk > size - done) {
+      chunk = size - done;
+    }
+    npages = (ROUNDUP(addr + chunk, PAGE_SIZE) - (addr & PAGE_FRAME)) / PAGE_SIZE;
+
+    /* a read from the file writes the user pages */
+    result = vm_pin(addr, chunk, rw == UIO_READ, frames);
+    if (result) {
+      break;
+    }
+
+    len = 0;
+    for (i = 0; i < npages; i++) {
+      offset = i == 0 ? addr % PAGE_SIZE : 0;
+      iov[i].iov_kbase = (void *)(PADDR_TO_KVADDR(frames[i]) + offset);
+      iov[i].iov_len = PAGE_SIZE - offset;
+      if (iov[i].iov_len > chunk - len) {
+        iov[i].iov_len = chunk - len;
+      }
+      len += iov[i].iov_len;
+    }
+    ku.uio_iov = iov;
+    ku.uio_iovcnt = npages;
+    ku.uio_offset = of->of_offset;
+    ku.uio_resid = chunk;
+    ku.uio_segflg = UIO_SYSSPACE;
+    ku.uio_rw = rw;
+    ku.uio_space = NULL;
+
+    result = rw == UIO_READ ? VOP_READ(of->of_vnode, &ku) : VOP_WRITE(of->of_vnode, &ku);
+    vm_unpin(frames, npages);
+    if (result) {
+      break;
+    }
+    moved = chunk - ku.uio_resid;
+    of->of_offset = ku.uio_offset;
+    done += moved;
+
+    /* end of file */
+    if (moved < chunk) {
+      break;
+    }
+  }
+
+  if (result && done == 0) {
+    return -1;
+  }
+  return (int)done;
+}
+#else
+/**
+ * @brief read or write an open file at its offset. Data is moved
+ * through a kernel buffer, so that no user page fault, which may
+ * have to write back a mapped page, happens while the file system
+ * holds its locks.
+ * 
+ * @param fd 
+ * @param buf_ptr 
+ * @param size 
+ * @param rw 
+ * @return int bytes moved, -1 on error
+ */
+static int
+file_io(int fd, userptr_t buf_ptr, size_t size, enum uio_rw rw)
+{
+  struct openfile *of;
+  struct iovec iov;
+  struct uio ku;
+  char *kbuf;
+  size_t done, chunk, moved;
+  int result;
+
+  of = openfile_get(fd);
+  if (of == NULL ||
+      (rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+      (rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+    return -1;
+  }
+
+  kbuf = kmalloc(FILETABLE_IOSIZE);
+  if (kbuf == NULL) {
+    return -1;
+  }
+
+  done = 0;
+  result = 0;
+  while (done < size) {
+    chunk = size - done < FILETABLE_IOSIZE ? size - done : FILETABLE_IOSIZE;
+    if (rw == UIO_WRITE) {
+      result = copyin((const_userptr_t)((char *)buf_ptr + done), kbuf, chunk);
+      if (result) {
+        break;
+      }
+    }
+
+    uio_kinit(&iov, &ku, kbuf, chunk, of->of_offset, rw);
+    result = rw == UIO_READ ? VOP_READ(of->of_vnode, &ku) : VOP_WRITE(of->of_vnode, &ku);
+    if (result) {
+      break;
+    }
+    moved = chunk - ku.uio_resid;
+    of->of_offset = ku.uio_offset;
+
+    if (rw == UIO_READ) {
+      result = copyout(kbuf, (userptr_t)((char *)buf_ptr + done), moved);
+      if (result) {
+        break;
+      }
+    }
+    done += moved;
+
+    /* end of file */
+    if (moved < chunk) {
+      break;
+    }
+  }
+
+  kfree(kbuf);
+  if (result && done == 0) {
+    return -1;
+  }
+  return (int)done;
+}
+#endif
+
+/*
+ * open and close of regular files
+ */
+int
+sys_open(userptr_t path, int openflags, mode_t mode, int *retval)
+{
+  struct proc *p = curproc;
+  struct openfile *of;
+  struct vnode *v;
+  char *kpath;
+  int fd, result;
+
+  for (fd = FILETABLE_FIRST; fd < OPEN_MAX; fd++) {
+    if (p->p_filetable[fd] == NULL) {
+      break;
+    }
+  }
+  if (fd == OPEN_MAX) {
+    return EMFILE;
+  }
+
+  kpath = kmalloc(PATH_MAX);
+  if (kpath == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr((const_userptr_t)path, kpath, PATH_MAX, NULL);
+  if (result) {
+    kfree(kpath);
+    return result;
+  }
+
+  of = kmalloc(sizeof(struct openfile));
+  if (of == NULL) {
+    kfree(kpath);
+    return ENOMEM;
+  }
+
+  result = vfs_open(kpath, openflags, mode, &v);
+  kfree(kpath);
+  if (result) {
+    kfree(of);
+    return result;
+  }
+
+  of->of_vnode = v;
+  of->of_offset = 0;
+  of->of_accmode = openflags & O_ACCMODE;
+  p->p_filetable[fd] = of;
+
+  *retval = fd;
+  return 0;
+}
+
+int
+sys_close(int fd)
+{
+  struct openfile *of;
+
+  of = openfile_get(fd);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  curproc->p_filetable[fd] = NULL;
+  vfs_close(of->of_vnode);
+  kfree(of);
+
+  return 0;
+}
+#endif
 
 /*
  * simple file system calls for write/read
@@ -20,6 +338,11 @@ sys_write(int fd, userptr_t buf_ptr, size_t size)
   int i;
   char *p = (char *)buf_ptr;
 
+#if OPT_FILETABLE
+  if (fd >= FILETABLE_FIRST) {
+    return file_io(fd, buf_ptr, size, UIO_WRITE);
+  }
+#endif
   if (fd!=STDOUT_FILENO && fd!=STDERR_FILENO) {
     kprintf("sys_write supported only to stdout\n");
     return -1;
@@ -38,6 +361,12 @@ sys_read(int fd, userptr_t buf_ptr, size_t size)
   int i;
   char *p = (char *)buf_ptr;
 
+#if OPT_FILETABLE
+  if (fd >= FILETABLE_FIRST) {
+    return file_io(fd, buf_ptr, size, UIO_READ);
+  }
+#endif
+
   if (fd!=STDIN_FILENO) {
     kprintf("sys_read supported only to stdin\n");
     return -1;
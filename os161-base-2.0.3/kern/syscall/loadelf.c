@@ -61,7 +61,10 @@
 #include <vnode.h>
 #include <elf.h>
 #include "opt-DEMANDVM.h"
+#include "opt-readahead.h"
+#include "opt-eagerload.h"
 #include <pt.h>
+#include <segment.h>
 
 
 #if OPT_DEMANDVM
@@ -94,6 +97,74 @@ load_page(struct vnode *v, off_t offset, paddr_t page_paddr, size_t size)
 	}
 
 }
+
+#if OPT_READAHEAD || OPT_EAGERLOAD
+/**
+ * @brief load a contiguous portion of the elf file, starting at
+ * offset, scattered over the given kernel buffers, with a single read.
+ * 
+ * @param v vnode of the elf
+ * @param offset offset within the elf
+ * @param iov kernel buffers, modified by the read
+ * @param niov 
+ */
+void
+load_iovec(struct vnode *v, off_t offset, struct iovec *iov, unsigned niov)
+{
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(niov > 0);
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = niov;
+	ku.uio_offset = offset;
+	ku.uio_resid = 0;
+	for (i = 0; i < niov; i++) {
+		ku.uio_resid += iov[i].iov_len;
+	}
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+
+	result = VOP_READ(v, &ku);
+	if (result) {
+		panic("Error loading pages\n");
+	}
+
+	if (ku.uio_resid != 0) {
+		panic("ELF: short read on segment - file truncated?");
+	}
+}
+#endif
+
+#if OPT_READAHEAD
+/**
+ * @brief load npages consecutive full pages from the elf file to the
+ * given frames with a single read.
+ * 
+ * @param v vnode of the elf
+ * @param offset offset within the elf of the first page
+ * @param pages physical addresses of the frames
+ * @param npages 
+ */
+void
+load_pages(struct vnode *v, off_t offset, const paddr_t *pages, unsigned npages)
+{
+	struct iovec iov[SEG_RA_MAX + 1];
+	unsigned i;
+
+	KASSERT(npages > 0 && npages <= SEG_RA_MAX + 1);
+
+	for (i = 0; i < npages; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pages[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	load_iovec(v, offset, iov, npages);
+}
+#endif
 #else
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -283,7 +354,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_offset,
-					  ph.p_filesz);
+					  ph.p_filesz,
+					  ph.p_flags & PF_W);
 #else
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
@@ -16,6 +16,20 @@
 #include <addrspace.h>
 #include <current.h>
 #include <synch.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <vnode.h>
+#include <mips/trapframe.h>
+#include "opt-fork.h"
+#include "opt-filetable.h"
+#include "opt-fastexit.h"
+#include "opt-asrwlock.h"
+#if OPT_FILETABLE
+#include <openfile.h>
+#endif
+#if OPT_FASTEXIT
+#include <reaper.h>
+#endif
 
 /*
  * simple proc management system calls
@@ -25,7 +39,34 @@ sys__exit(int status)
 {
   #if  OPT_WAITPID
   struct proc *p = curproc;
+#if OPT_FASTEXIT || OPT_FORK
+  struct addrspace *as;
+#endif
+#if OPT_FASTEXIT
+  gettime(&p->p_exit_start);
+  /* the address space is destroyed by the reaper, not by the waiter */
+  as = proc_setas(NULL);
+  as_deactivate();
+  if (as != NULL && !reaper_defer(as, p->p_vnode)) {
+    proc_setas(as);
+  }
+#endif
   p->status = status & 0xff;
+#if OPT_FORK
+  /* nobody can wait for the children anymore */
+  proc_orphan_children(p);
+  if (proc_set_exited(p)) {
+    /* nobody waits for this process either: it destroys itself */
+    as = proc_setas(NULL);
+    as_deactivate();
+    proc_remthread(curthread);
+    if (as != NULL) {
+      as_destroy(as);
+    }
+    proc_destroy(p);
+    thread_exit();
+  }
+#endif
   proc_remthread(curthread);
 
   V(p->p_sem);
@@ -50,3 +91,129 @@ sys__exit(int status)
   panic("thread_exit returned (should not happen)\n");
   (void) status; // TODO: status handling
 }
+
+#if OPT_FORK
+/*
+ * Entry point of the thread of a forked process: the trapframe has
+ * been copied on the heap by sys_fork.
+ */
+static void
+call_enter_forked_process(void *tfv, unsigned long dummy)
+{
+  struct trapframe *tf = (struct trapframe *)tfv;
+
+  (void)dummy;
+  enter_forked_process(tf);
+
+  panic("enter_forked_process returned (should not happen)\n");
+}
+
+/*
+ * Create a copy of the current process. The address space is copied
+ * lazily (see as_copy): parent and child share every page until one
+ * of them writes it.
+ */
+int
+sys_fork(struct trapframe *ctf, pid_t *retval)
+{
+  struct trapframe *tf_child;
+  struct proc *newp;
+  int result;
+
+  KASSERT(curproc != NULL);
+
+  newp = proc_create_runprogram(curproc->p_name);
+  if (newp == NULL) {
+    return ENPROC;
+  }
+
+  newp->p_parent = curproc;
+
+  /* the child demand loads from the same executable */
+  VOP_INCREF(curproc->p_vnode);
+  newp->p_vnode = curproc->p_vnode;
+
+#if OPT_ASRWLOCK
+  rwlock_acquire_read(curproc->p_addrspace->as_lock);
+#endif
+  result = as_copy(curproc->p_addrspace, &newp->p_addrspace);
+#if OPT_ASRWLOCK
+  rwlock_release_read(curproc->p_addrspace->as_lock);
+#endif
+  if (result) {
+    proc_destroy(newp);
+    return result;
+  }
+
+#if OPT_FILETABLE
+  result = openfile_copyall(curproc, newp);
+  if (result) {
+    proc_destroy(newp);
+    return result;
+  }
+#endif
+
+  tf_child = kmalloc(sizeof(struct trapframe));
+  if (tf_child == NULL) {
+    proc_destroy(newp);
+    return ENOMEM;
+  }
+  memcpy(tf_child, ctf, sizeof(struct trapframe));
+
+  result = thread_fork(curthread->t_name, newp,
+                       call_enter_forked_process,
+                       (void *)tf_child, 0);
+  if (result) {
+    kfree(tf_child);
+    proc_destroy(newp);
+    return result;
+  }
+
+  *retval = newp->p_pid;
+
+  return 0;
+}
+
+int
+sys_getpid(pid_t *retval)
+{
+  KASSERT(curproc != NULL);
+
+  *retval = curproc->p_pid;
+
+  return 0;
+}
+
+/*
+ * Wait for the given process to exit, and release it.
+ */
+int
+sys_waitpid(pid_t pid, userptr_t statusp, int options, pid_t *retval)
+{
+  struct proc *p;
+  int status;
+  int result;
+
+  if (options != 0) {
+    return EINVAL;
+  }
+
+  /* only the parent can wait, and only once */
+  result = proc_claim_child(pid, curproc, &p);
+  if (result) {
+    return result;
+  }
+
+  status = _MKWAIT_EXIT(proc_wait(p));
+  if (statusp != NULL) {
+    result = copyout(&status, statusp, sizeof(int));
+    if (result) {
+      return result;
+    }
+  }
+
+  *retval = pid;
+
+  return 0;
+}
+#endif
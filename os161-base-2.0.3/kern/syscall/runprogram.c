@@ -44,6 +44,12 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <clock.h>
+#include "opt-eagerload.h"
+#include "opt-launchprof.h"
+#if OPT_LAUNCHPROF
+#include <profile.h>
+#endif
 
 /*
  * Load program "progname" and start running it in usermode.
@@ -58,10 +64,27 @@ runprogram(char *progname)
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
 	int result;
+#if OPT_LAUNCHPROF
+	struct launch_profile *profile;
+#endif
+#if OPT_EAGERLOAD
+	struct timespec start;
+
+	gettime(&start);
+#endif
+#if OPT_LAUNCHPROF
+	/* progname may be destroyed by vfs_open */
+	profile = profile_create(progname, &start);
+#endif
 
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+#if OPT_LAUNCHPROF
+		if (profile != NULL) {
+			profile_end(profile);
+		}
+#endif
 		return result;
 	}
 
@@ -71,13 +94,24 @@ runprogram(char *progname)
 	/* Create a new address space. */
 	as = as_create();
 	if (as == NULL) {
+#if OPT_LAUNCHPROF
+		if (profile != NULL) {
+			profile_end(profile);
+		}
+#endif
 		vfs_close(v);
 		return ENOMEM;
 	}
+#if OPT_LAUNCHPROF
+	as->as_profile = profile;
+#endif
 
 	/* Switch to it and activate it. */
 	proc_setas(as);
 	as_activate();
+#if OPT_EAGERLOAD
+	as_exec_started(as, &start);
+#endif
 
 	/* Load the executable. */
 	result = load_elf(v, &entrypoint);
@@ -109,6 +143,19 @@ runprogram(char *progname)
 	}
 #endif
 
+#if OPT_EAGERLOAD
+	/* Load the pages chosen by the loading policy */
+	as_prefault(as, v);
+#endif
+
+#if OPT_LAUNCHPROF
+	/* Replay the startup of the previous run, or record this one */
+	if (profile != NULL) {
+		profile_begin(profile, v);
+		profile_prefetch(profile, as, v);
+	}
+#endif
+
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
 			  NULL /*userspace addr of environment*/,
@@ -0,0 +1,284 @@
+/*
+ * Address space system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-asrwlock.h"
+#include "opt-pagebusy.h"
+#if OPT_MMAP
+#include <kern/fcntl.h>
+#include <openfile.h>
+#endif
+#if OPT_ASRWLOCK
+#include <synch.h>
+#endif
+#if OPT_MMAP || OPT_MADVISE
+#include <kern/mman.h>
+#include <vm.h>
+#endif
+#if OPT_MADVISE
+#include <current.h>
+#include <copyinout.h>
+
+#define MINCORE_CHUNK   64      /* pages reported by a single copyout */
+#endif
+
+/**
+ * @brief move the break of the current process heap by amount bytes.
+ * 
+ * @param amount bytes to add (or remove, if negative) to the heap
+ * @param retval filled with the previous break
+ * @return int 0 on success, an errno otherwise
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  struct addrspace *as;
+  int result;
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+#if OPT_ASRWLOCK
+  rwlock_acquire_write(as->as_lock);
+#endif
+  result = as_sbrk(as, amount, retval);
+#if OPT_ASRWLOCK
+  rwlock_release_write(as->as_lock);
+#endif
+
+  return result;
+}
+
+#if OPT_MMAP
+/**
+ * @brief map len bytes of the open file fd, from offset, in the
+ * address space of the current process.
+ * 
+ * @param addr hint, not used
+ * @param len 
+ * @param prot PROT_READ, PROT_WRITE, PROT_EXEC
+ * @param flags MAP_SHARED or MAP_PRIVATE
+ * @param fd 
+ * @param offset page aligned
+ * @param retval filled with the address of the mapping
+ * @return int 0 on success, an errno otherwise
+ */
+int
+sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd, off_t offset,
+         vaddr_t *retval)
+{
+  struct addrspace *as;
+  struct openfile *of;
+  bool writable, shared;
+  int result;
+
+  (void)addr;
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+  if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0 ||
+      (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+      (flags != MAP_SHARED && flags != MAP_PRIVATE)) {
+    return EINVAL;
+  }
+
+  of = openfile_get(fd);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  /* the file is always read, and written back only by shared mappings */
+  writable = (prot & PROT_WRITE) != 0;
+  shared = flags == MAP_SHARED;
+  if (of->of_accmode == O_WRONLY ||
+      (writable && shared && of->of_accmode != O_RDWR)) {
+    return EACCES;
+  }
+
+#if OPT_ASRWLOCK
+  rwlock_acquire_write(as->as_lock);
+#endif
+  result = as_mmap(as, len, writable, shared, of->of_vnode, offset, retval);
+#if OPT_ASRWLOCK
+  rwlock_release_write(as->as_lock);
+#endif
+
+  return result;
+}
+
+/**
+ * @brief remove the mapping created by mmap at addr.
+ * 
+ * @param addr 
+ * @param len 
+ * @return int 0 on success, EINVAL if addr and len do not match a mapping
+ */
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+  struct addrspace *as;
+  int result;
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+#if OPT_ASRWLOCK
+  rwlock_acquire_write(as->as_lock);
+#endif
+  result = as_munmap(as, addr, len);
+#if OPT_ASRWLOCK
+  rwlock_release_write(as->as_lock);
+#endif
+
+  return result;
+}
+#endif
+
+#if OPT_MADVISE
+/**
+ * @brief check that the range of a madvise or mincore call starts on
+ * a page and stays in the user address space.
+ * 
+ * @param addr 
+ * @param len 
+ * @return int 0 if valid, EINVAL if addr is not page aligned, ENOMEM
+ * if the range goes beyond the user address space
+ */
+static int
+vm_check_range(vaddr_t addr, size_t len)
+{
+  if (addr % PAGE_SIZE != 0) {
+    return EINVAL;
+  }
+  if (addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+    return ENOMEM;
+  }
+  return 0;
+}
+
+/**
+ * @brief give the VM a hint on the use of the pages of the current
+ * process from addr to addr + len, see as_madvise.
+ * 
+ * @param addr page aligned
+ * @param len 
+ * @param advice MADV_*
+ * @return int 0 on success, an errno otherwise
+ */
+int
+sys_madvise(vaddr_t addr, size_t len, int advice)
+{
+  struct addrspace *as;
+  int result;
+#if OPT_ASRWLOCK
+  bool write;
+#endif
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+  if (advice < MADV_NORMAL || advice > MADV_FREE) {
+    return EINVAL;
+  }
+  result = vm_check_range(addr, len);
+  if (result) {
+    return result;
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+#if OPT_ASRWLOCK
+  /*
+   * the access patterns are attributes of the regions and MADV_FREE
+   * drops pages under the faults. MADV_WILLNEED and MADV_DONTNEED
+   * touch the pages as a fault does, so they run with the faults
+   * during their I/O, the busy entries keeping a page from being
+   * loaded twice.
+   */
+  write = !OPT_PAGEBUSY || (advice != MADV_WILLNEED && advice != MADV_DONTNEED);
+  if (write) {
+    rwlock_acquire_write(as->as_lock);
+  } else {
+    rwlock_acquire_read(as->as_lock);
+  }
+#endif
+  result = as_madvise(as, curproc->p_vnode, addr, addr + ROUNDUP(len, PAGE_SIZE), advice);
+#if OPT_ASRWLOCK
+  if (write) {
+    rwlock_release_write(as->as_lock);
+  } else {
+    rwlock_release_read(as->as_lock);
+  }
+#endif
+
+  return result;
+}
+
+/**
+ * @brief report which pages of the current process from addr to
+ * addr + len are resident, one byte for each page (1 if resident).
+ * 
+ * @param addr page aligned
+ * @param len 
+ * @param vec user buffer of DIVROUNDUP(len, PAGE_SIZE) bytes
+ * @return int 0 on success, an errno otherwise
+ */
+int
+sys_mincore(vaddr_t addr, size_t len, userptr_t vec)
+{
+  struct addrspace *as;
+  unsigned char chunk[MINCORE_CHUNK];
+  size_t npages, done, n;
+  int result;
+
+  as = proc_getas();
+  if (as == NULL) {
+    return EFAULT;
+  }
+
+  result = vm_check_range(addr, len);
+  if (result) {
+    return result;
+  }
+
+  npages = DIVROUNDUP(len, PAGE_SIZE);
+  for (done = 0; done < npages; done += n) {
+    n = npages - done < MINCORE_CHUNK ? npages - done : MINCORE_CHUNK;
+    /* not held across copyout, which can fault */
+#if OPT_ASRWLOCK
+    rwlock_acquire_read(as->as_lock);
+#endif
+    result = as_mincore(as, addr + done * PAGE_SIZE, n, chunk);
+#if OPT_ASRWLOCK
+    rwlock_release_read(as->as_lock);
+#endif
+    if (result) {
+      return result;
+    }
+    result = copyout(chunk, (userptr_t)((vaddr_t)vec + done), n);
+    if (result) {
+      return result;
+    }
+  }
+
+  return 0;
+}
+#endif
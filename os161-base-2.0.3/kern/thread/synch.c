@@ -267,3 +267,112 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	(void)cv;    // suppress warning until code gets written
 	(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rwlock;
+
+        rwlock = kmalloc(sizeof(*rwlock));
+        if (rwlock == NULL) {
+                return NULL;
+        }
+
+        rwlock->rwlock_name = kstrdup(name);
+        if (rwlock->rwlock_name == NULL) {
+                kfree(rwlock);
+                return NULL;
+        }
+
+	rwlock->rw_wchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rw_wchan == NULL) {
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	spinlock_init(&rwlock->rw_lock);
+        rwlock->rw_readers = 0;
+        rwlock->rw_writers_waiting = 0;
+        rwlock->rw_writer = NULL;
+
+        return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(rwlock->rw_readers == 0);
+        KASSERT(rwlock->rw_writer == NULL);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rwlock->rw_lock);
+	wchan_destroy(rwlock->rw_wchan);
+        kfree(rwlock->rwlock_name);
+        kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer != curthread);
+        while (rwlock->rw_writer != NULL || rwlock->rw_writers_waiting > 0) {
+		wchan_sleep(rwlock->rw_wchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_readers++;
+	spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_readers > 0);
+        rwlock->rw_readers--;
+        if (rwlock->rw_readers == 0) {
+		/* only a writer can be waiting */
+		wchan_wakeall(rwlock->rw_wchan, &rwlock->rw_lock);
+        }
+	spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer != curthread);
+        rwlock->rw_writers_waiting++;
+        while (rwlock->rw_writer != NULL || rwlock->rw_readers > 0) {
+		wchan_sleep(rwlock->rw_wchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_writers_waiting--;
+        rwlock->rw_writer = curthread;
+	spinlock_release(&rwlock->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer == curthread);
+        rwlock->rw_writer = NULL;
+	/* both the next writer and the readers held back by it */
+	wchan_wakeall(rwlock->rw_wchan, &rwlock->rw_lock);
+	spinlock_release(&rwlock->rw_lock);
+}
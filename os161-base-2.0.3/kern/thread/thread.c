@@ -52,6 +52,10 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include "opt-waitpid.h"
+#include "opt-objcache.h"
+#if OPT_OBJCACHE
+#include <objcache.h>
+#endif
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -71,6 +75,15 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Set while the secondary CPUs run and can take TLB shootdowns. */
+static bool cpus_started = false;
+
+#if OPT_OBJCACHE
+/* Caches of the thread structures and of the kernel stacks. */
+static struct objcache *thread_cache;
+static struct objcache *stack_cache;
+#endif
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -122,14 +135,22 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
+#if OPT_OBJCACHE
+	thread = objcache_alloc(thread_cache);
+#else
 	thread = kmalloc(sizeof(*thread));
+#endif
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+#if OPT_OBJCACHE
+		objcache_free(thread_cache, thread);
+#else
 		kfree(thread);
+#endif
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -212,7 +233,11 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
+#if OPT_OBJCACHE
+		c->c_curthread->t_stack = objcache_alloc(stack_cache);
+#else
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+#endif
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -277,7 +302,11 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
+#if OPT_OBJCACHE
+		objcache_free(stack_cache, thread->t_stack);
+#else
 		kfree(thread->t_stack);
+#endif
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -286,7 +315,11 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+#if OPT_OBJCACHE
+	objcache_free(thread_cache, thread);
+#else
 	kfree(thread);
+#endif
 }
 
 /*
@@ -364,6 +397,7 @@ thread_shutdown(void)
 	 * We should probably wait for them to stop and shut them off
 	 * on the system board.
 	 */
+	cpus_started = false;
 	ipi_broadcast(IPI_OFFLINE);
 }
 
@@ -375,6 +409,19 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+#if OPT_OBJCACHE
+	/*
+	 * The stacks are a page each: the cache keeps a few of them
+	 * for the next forks instead of going back to the coremap.
+	 */
+	thread_cache = objcache_create("thread", sizeof(struct thread),
+				       NULL, NULL);
+	stack_cache = objcache_create("stack", STACK_SIZE, NULL, NULL);
+	if (thread_cache == NULL || stack_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+#endif
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -442,6 +489,7 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+	cpus_started = true;
 }
 
 /*
@@ -508,7 +556,11 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
+#if OPT_OBJCACHE
+	newthread->t_stack = objcache_alloc(stack_cache);
+#else
 	newthread->t_stack = kmalloc(STACK_SIZE);
+#endif
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
@@ -1166,6 +1218,31 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs but the current one. Returns
+ * the number of CPUs it was sent to. Before thread_start_cpus the
+ * other CPUs have not run and cannot take it, so nothing is sent.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	if (!cpus_started) {
+		return 0;
+	}
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
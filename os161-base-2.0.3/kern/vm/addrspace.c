@@ -36,41 +36,471 @@
 #include <segment.h>
 #include <vm_tlb.h>
 #include <pt.h>
+#include <coremap.h>
 #include "opt-stats.h"
+#include "opt-readahead.h"
+#include "opt-sharedtext.h"
+#include "opt-eagerload.h"
+#include "opt-launchprof.h"
+#include "opt-fork.h"
+#include "opt-stackgrow.h"
+#include "opt-heap.h"
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-stride.h"
+#include "opt-pagebusy.h"
+#include "opt-asrwlock.h"
+#include <kern/iovec.h>
+#include <current.h>
+#include <clock.h>
+#include <synch.h>
 #if OPT_STATS
 #include <vmstats.h>
 #endif
+#if OPT_LAUNCHPROF
+#include <profile.h>
+#endif
+#if OPT_MMAP
+#include <kern/stat.h>
+#include <vnode.h>
+#include <mmap.h>
+#endif
+#if OPT_MADVISE
+#include <kern/mman.h>
+#endif
+#if OPT_OBJCACHE
+#include <objcache.h>
+#endif
+#if OPT_STRIDE
+#include <thread.h>
+#include <wchan.h>
+#endif
 
 
 #define VM_STACKPAGES    18
 
 #if OPT_DEMANDVM
+#if OPT_STACKGROW
+/*	limit of the stacks of the next execs, set with as_set_stack_max	*/
+static unsigned as_stack_max = SEG_STACK_MAX;
+#endif
+
+#if OPT_MMAP
+static void as_mmap_sync(struct addrspace *as, struct segment *seg);
+#endif
+
+#if OPT_STRIDE
+static void as_stride_cancel(struct addrspace *as);
+static void as_print_stride(struct addrspace *as);
+#endif
+
+#if OPT_EAGERLOAD
+/*	loading policy, set with as_set_eager	*/
+static unsigned as_eager_threshold = SEG_EAGER_THRESHOLD;
+static unsigned as_eager_text = SEG_EAGER_TEXT;
+
+/*	exec to first instruction latency	*/
+static struct spinlock as_exec_lock = SPINLOCK_INITIALIZER;
+static unsigned as_exec_count = 0;
+static struct timespec as_exec_total = { 0, 0 };
+static struct timespec as_exec_last = { 0, 0 };
+
+/**
+ * @brief choose how many pages of a segment of npages pages are
+ * loaded at exec time.
+ * 
+ * @param npages 
+ * @param is_text 
+ * @return unsigned 
+ */
+static
+unsigned
+as_eager_policy(size_t npages, bool is_text)
+{
+	if(npages <= as_eager_threshold)
+	{
+		return npages;
+	}
+	if(is_text)
+	{
+		return as_eager_text < npages ? as_eager_text : npages;
+	}
+	return 0;
+}
+#endif
+
+/**
+ * @brief binary search of the regions: count the regions starting at
+ * or below vaddr, so that the last of them is the only one which can
+ * contain it.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return unsigned index of the first region starting above vaddr
+ */
+static
+unsigned
+as_region_index(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = as->as_nregions;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (as->as_regions[mid].ar_seg->seg_first_vaddr <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * @brief insert the segment among the regions, keeping them sorted.
+ * The array of the regions doubles when full.
+ * 
+ * @param as 
+ * @param seg 
+ * @param type SEGMENT_*
+ * @param ptbase page table index of the region
+ * @return int 0 on success, ENOMEM
+ */
+static
+int
+as_add_region(struct addrspace *as, struct segment *seg, int type, unsigned ptbase)
+{
+	struct as_region *regions;
+	unsigned i, max;
+
+	if (as->as_nregions == as->as_maxregions) {
+		max = as->as_maxregions == 0 ? AS_REGIONS_INIT : as->as_maxregions * 2;
+		regions = kmalloc(max * sizeof(struct as_region));
+		if (regions == NULL) {
+			return ENOMEM;
+		}
+		if (as->as_regions != NULL) {
+			memcpy(regions, as->as_regions, as->as_nregions * sizeof(struct as_region));
+			kfree(as->as_regions);
+		}
+		as->as_regions = regions;
+		as->as_maxregions = max;
+	}
+
+	i = as_region_index(as, seg->seg_first_vaddr);
+	memmove(&as->as_regions[i + 1], &as->as_regions[i],
+		(as->as_nregions - i) * sizeof(struct as_region));
+	as->as_regions[i].ar_seg = seg;
+	as->as_regions[i].ar_type = type;
+	as->as_regions[i].ar_ptbase = ptbase;
+	as->as_nregions++;
+
+	return 0;
+}
+
+#if OPT_MMAP
+/**
+ * @brief take the segment out of the regions, without destroying it.
+ * 
+ * @param as 
+ * @param seg 
+ */
+static
+void
+as_remove_region(struct addrspace *as, struct segment *seg)
+{
+	unsigned i;
+
+	i = as_region_index(as, seg->seg_first_vaddr);
+	KASSERT(i > 0 && as->as_regions[i - 1].ar_seg == seg);
+	i--;
+
+	memmove(&as->as_regions[i], &as->as_regions[i + 1],
+		(as->as_nregions - i - 1) * sizeof(struct as_region));
+	as->as_nregions--;
+}
+#endif
+
+/**
+ * @brief destroy the segments of all the regions and the region array.
+ * 
+ * @param as 
+ */
+static
+void
+as_destroy_regions(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i = 0; i < as->as_nregions; i++) {
+		segment_destroy(as->as_regions[i].ar_seg);
+	}
+	if (as->as_regions != NULL) {
+		kfree(as->as_regions);
+	}
+	as->as_regions = NULL;
+	as->as_nregions = 0;
+	as->as_maxregions = 0;
+}
+
+#if OPT_OBJCACHE
+static struct objcache *as_cache = NULL;
+
+/**
+ * @brief constructor of the cached address spaces: their lock is
+ * created once, and is back in the cache unheld.
+ * 
+ * @param obj 
+ * @return int 0 on success, ENOMEM
+ */
+static
+int
+as_ctor(void *obj)
+{
+#if OPT_ASRWLOCK
+	struct addrspace *as = obj;
+
+	as->as_lock = rwlock_create("as_lock");
+	if (as->as_lock == NULL) {
+		return ENOMEM;
+	}
+#else
+	(void)obj;
+#endif
+	return 0;
+}
+
+static
+void
+as_dtor(void *obj)
+{
+#if OPT_ASRWLOCK
+	struct addrspace *as = obj;
+
+	rwlock_destroy(as->as_lock);
+#else
+	(void)obj;
+#endif
+}
+
+/**
+ * @brief create the cache of the address spaces.
+ */
+void
+as_bootstrap(void)
+{
+	as_cache = objcache_create("addrspace", sizeof(struct addrspace), as_ctor, as_dtor);
+	if (as_cache == NULL) {
+		panic("as_bootstrap: cannot create the address space cache\n");
+	}
+}
+#endif
+
+/**
+ * @brief takes the memory of an address space, with its lock.
+ * 
+ * @return struct addrspace* NULL if out of memory
+ */
+static
 struct addrspace *
-as_create(void)
+as_alloc(void)
 {
+#if OPT_OBJCACHE
+	return objcache_alloc(as_cache);
+#else
 	struct addrspace *as;
 
 	as = kmalloc(sizeof(struct addrspace));
 	if (as == NULL) {
 		return NULL;
 	}
+#if OPT_ASRWLOCK
+	as->as_lock = rwlock_create("as_lock");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+#endif
+	return as;
+#endif
+}
+
+static
+void
+as_free(struct addrspace *as)
+{
+#if OPT_OBJCACHE
+	objcache_free(as_cache, as);
+#else
+#if OPT_ASRWLOCK
+	rwlock_destroy(as->as_lock);
+#endif
+	kfree(as);
+#endif
+}
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+
+	as = as_alloc();
+	if (as == NULL) {
+		return NULL;
+	}
 
-	as->as_data = NULL;
-	as->as_text = NULL;
+	as->as_regions = NULL;
+	as->as_nregions = 0;
+	as->as_maxregions = 0;
 	as->as_stack = NULL;
 	as->as_ptable = NULL;
+#if OPT_HEAP
+	as->as_heap = NULL;
+	as->as_heap_maxpages = 0;
+#endif
+#if OPT_MMAP
+	as->as_mmap_base = 0;
+	as->as_mmap_maxpages = 0;
+	as->as_mmap_ptbase = 0;
+#endif
+#if OPT_EAGERLOAD
+	as->as_exec_pending = false;
+#endif
+#if OPT_LAUNCHPROF
+	as->as_profile = NULL;
+#endif
+#if OPT_STRIDE
+	bzero(as->as_streams, sizeof(as->as_streams));
+	as->as_stream_next = 0;
+	as->as_pf_faults = 0;
+	as->as_pf_predictions = 0;
+	as->as_pf_correct = 0;
+	as->as_pf_issued = 0;
+	as->as_pf_hits = 0;
+	as->as_pf_dropped = 0;
+#endif
 
 	return as;
 }
 
+/**
+ * @brief create a copy of the address space for a forked process.
+ * No page is copied: the frames are shared copy-on-write and the
+ * swap slots are shared as well, see pt_copy. The frames of the
+ * shared file mappings are shared without copy-on-write.
+ * 
+ * @param old 
+ * @param ret 
+ * @return int 0 on success, ENOMEM
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
+#if OPT_FORK
+	struct addrspace *newas;
+	struct as_region *region;
+	int result;
+	unsigned i;
+#if OPT_MMAP
+	struct pt_entry *pt_row;
+	vaddr_t page;
+#endif
+
+	KASSERT(old != NULL);
+	KASSERT(old->as_ptable != NULL);
+
+	newas = as_create();
+	if (newas == NULL) {
+		return ENOMEM;
+	}
+
+	newas->as_regions = kmalloc(old->as_maxregions * sizeof(struct as_region));
+	if (newas->as_regions == NULL) {
+		as_free(newas);
+		return ENOMEM;
+	}
+	newas->as_maxregions = old->as_maxregions;
+
+	for (i = 0; i < old->as_nregions; i++) {
+		region = &newas->as_regions[i];
+		*region = old->as_regions[i];
+		region->ar_seg = segment_copy(region->ar_seg);
+		if (region->ar_seg == NULL) {
+			as_destroy_regions(newas);
+			as_free(newas);
+			return ENOMEM;
+		}
+		newas->as_nregions++;
+
+		if (region->ar_type == SEGMENT_STACK) {
+			newas->as_stack = region->ar_seg;
+		}
+#if OPT_HEAP
+		if (region->ar_type == SEGMENT_HEAP) {
+			newas->as_heap = region->ar_seg;
+		}
+#endif
+	}
+#if OPT_HEAP
+	newas->as_heap_maxpages = old->as_heap_maxpages;
+#endif
+#if OPT_MMAP
+	newas->as_mmap_base = old->as_mmap_base;
+	newas->as_mmap_maxpages = old->as_mmap_maxpages;
+	newas->as_mmap_ptbase = old->as_mmap_ptbase;
+#endif
+	newas->as_ptable = pt_create(old->as_ptable->pd_nentries, old->as_ptable->pd_maxentries);
+	if (newas->as_ptable == NULL) {
+		as_destroy_regions(newas);
+		as_free(newas);
+		return ENOMEM;
+	}
+
+	result = pt_copy(old->as_ptable, newas->as_ptable);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
+
+#if OPT_MMAP
+	/*
+	 * the resident pages of the shared mappings are written in place
+	 * by both processes; the others are read again from the file.
+	 */
+	for (i = 0; i < newas->as_nregions; i++) {
+		region = &newas->as_regions[i];
+		if (region->ar_type != SEGMENT_MMAP || !region->ar_seg->seg_shared ||
+		    !region->ar_seg->seg_writable) {
+			continue;
+		}
+		for (page = region->ar_seg->seg_first_vaddr; page < region->ar_seg->seg_last_vaddr;
+		     page += PAGE_SIZE) {
+			pt_row = pt_get_entry(newas, page);
+			if (pt_row == NULL) {
+				as_destroy(newas);
+				return ENOMEM;
+			}
+			coremap_file_share(pt_row);
+			pt_put_entry(newas, page);
+		}
+	}
+#endif
+
+	/*	the shared pages have to fault again before being written	*/
+	tlb_invalidate();
+
+	*ret = newas;
+	return 0;
+#else
 	(void)old;
 	(void)ret;
 	panic("as_copy() still not implemented!");
 
 	return 0;
+#endif
 }
 
 /**
@@ -82,17 +512,46 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
+#if OPT_MMAP
+	unsigned i;
+#endif
+
 	KASSERT(as != NULL);
-	
-	int pt_size = as->as_data->seg_npages + as->as_text->seg_npages + as->as_stack->seg_npages;
 
-	pt_empty(as->as_ptable, pt_size);
+#if OPT_STRIDE
+	/*	before the lock, which the stride thread takes to prefetch	*/
+	as_stride_cancel(as);
+#endif
+#if OPT_ASRWLOCK
+	/*	waits for the faults and lookups still in progress	*/
+	rwlock_acquire_write(as->as_lock);
+#endif
+#if OPT_LAUNCHPROF
+	if(as->as_profile != NULL)
+	{
+		profile_end(as->as_profile);
+	}
+#endif
+#if OPT_STRIDE
+	as_print_stride(as);
+#endif
+#if OPT_MMAP
+	/*	the modified pages of the shared mappings go back to their files	*/
+	for (i = 0; i < as->as_nregions; i++) {
+		if (as->as_regions[i].ar_type == SEGMENT_MMAP) {
+			as_mmap_sync(as, as->as_regions[i].ar_seg);
+		}
+	}
+#endif
+	pt_empty(as->as_ptable);
 	pt_destroy(as->as_ptable);
-	segment_destroy(as->as_text);
-	segment_destroy(as->as_data);
-	segment_destroy(as->as_stack);
+	/*	released after the frames, which refer to the mapped files	*/
+	as_destroy_regions(as);
+#if OPT_ASRWLOCK
+	rwlock_release_write(as->as_lock);
+#endif
 
-	kfree(as);
+	as_free(as);
 }
 
 /**
@@ -130,21 +589,28 @@ as_deactivate(void)
 /**
  * @brief Set up a segment at virtual address FIRST_VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
- * BASE_VADDR + NPAGES*PAGE_SIZE .
+ * BASE_VADDR + NPAGES*PAGE_SIZE . Any number of segments can be
+ * defined: the read-only ones are text, the writeable ones data.
+ * Their page table entries are placed by as_define_pt.
  * 
  * @param as address space of the process
  * @param first_vaddr actual first virtual address of the segment
  * @param memsize size of the segment expressed in bytes
  * @param elf_offset offset of the segment within the elf file
  * @param elfsize size of the segment within the elf file
- * @return int 
+ * @param writeable 
+ * @return int 0 on success, ENOEXEC if the segment overlaps another
+ * one, ENOMEM
  */
 int
-as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_t elf_offset, size_t elfsize)
+as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_t elf_offset, size_t elfsize, int writeable)
 {
+	struct segment *seg;
 	size_t npages;
 	vaddr_t last_vaddr = first_vaddr + memsize;
 	vaddr_t base_vaddr;
+	unsigned i;
+	int result;
 
 	KASSERT(as != NULL);
 	KASSERT(memsize != 0);
@@ -155,24 +621,30 @@ as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_
 
 	/*		compute the address of the first page of the segment	*/
 	base_vaddr = first_vaddr & PAGE_FRAME;
-	
-	if (as->as_text == NULL) {
-		as->as_text = segment_create();
-		segment_define(as->as_text, elf_offset, base_vaddr, first_vaddr, last_vaddr, npages, elfsize);
-		return 0;
+
+	/*	the last region starting below the end is the one which could overlap	*/
+	i = as_region_index(as, last_vaddr - 1);
+	if (last_vaddr <= first_vaddr ||
+	    (i > 0 && as->as_regions[i - 1].ar_seg->seg_last_vaddr > first_vaddr)) {
+		return ENOEXEC;
 	}
 
-	if (as->as_data == NULL) {
-		as->as_data = segment_create();
-		segment_define(as->as_data, elf_offset, base_vaddr, first_vaddr, last_vaddr, npages, elfsize);
-		return 0;
+	seg = segment_create();
+	if (seg == NULL) {
+		return ENOMEM;
 	}
+	segment_define(seg, elf_offset, base_vaddr, first_vaddr, last_vaddr, npages, elfsize);
+#if OPT_EAGERLOAD
+	seg->seg_eager = as_eager_policy(npages, !writeable);
+#endif
 
-	/*
-	 * Support for more than two regions is not available.
-	 */
-	panic("vm: Warning: too many regions");
-	return ENOSYS;
+	result = as_add_region(as, seg, writeable ? SEGMENT_DATA : SEGMENT_TEXT, 0);
+	if (result) {
+		segment_destroy(seg);
+		return result;
+	}
+
+	return 0;
 }
 
 /**
@@ -185,10 +657,31 @@ as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+	int result;
+
 	KASSERT(as != NULL);
 
 	as->as_stack = segment_create();
+	if (as->as_stack == NULL) {
+		return ENOMEM;
+	}
+#if OPT_STACKGROW
+	/*	the stack starts small and grows on faults below it, see as_grow_stack	*/
+	segment_define(as->as_stack, 0, USERSTACK - SEG_STACK_INIT * PAGE_SIZE, USERSTACK - SEG_STACK_INIT * PAGE_SIZE, USERSTACK, SEG_STACK_INIT, 0);
+#else
 	segment_define(as->as_stack, 0, USERSTACK - VM_STACKPAGES * PAGE_SIZE, USERSTACK - VM_STACKPAGES * PAGE_SIZE, USERSTACK, VM_STACKPAGES, 0);
+#endif
+#if OPT_EAGERLOAD
+	as->as_stack->seg_eager = SEG_EAGER_STACK;
+#endif
+
+	/* above all the other regions, its entries are placed by as_define_pt */
+	result = as_add_region(as, as->as_stack, SEGMENT_STACK, 0);
+	if (result) {
+		segment_destroy(as->as_stack);
+		as->as_stack = NULL;
+		return result;
+	}
 	
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -197,7 +690,9 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 }
 
 /**
- * @brief setup the page table for the address space
+ * @brief setup the page table for the address space. The entries of
+ * the elf regions come first, in address order, followed by the heap,
+ * the window of the file mappings and the stack.
  * 
  * @param as 
  * @return int 
@@ -205,81 +700,576 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 int
 as_define_pt(struct addrspace *as)
 {
+	struct as_region *region;
+	vaddr_t elf_end;
+	unsigned i;
+	int npages;
+
 	KASSERT(as != NULL);
+	KASSERT(as->as_nregions > 0);
+	KASSERT(as->as_regions[as->as_nregions - 1].ar_seg == as->as_stack);
+
+	npages = 0;
+	elf_end = 0;
+	for (i = 0; i < as->as_nregions - 1; i++) {
+		region = &as->as_regions[i];
+		region->ar_ptbase = npages;
+		npages += region->ar_seg->seg_npages;
+		elf_end = region->ar_seg->seg_last_vaddr;
+	}
+
+#if OPT_HEAP
+	vaddr_t heap_base;
+	int result;
+
+	/* the heap starts empty at the first page after the elf */
+	heap_base = ROUNDUP(elf_end, PAGE_SIZE);
+	as->as_heap = segment_create();
+	if (as->as_heap == NULL) {
+		return ENOMEM;
+	}
+	segment_define(as->as_heap, 0, heap_base, heap_base, heap_base, 0, 0);
+	as->as_heap_maxpages = SEG_HEAP_MAX;
+	result = as_add_region(as, as->as_heap, SEGMENT_HEAP, npages);
+	if (result) {
+		segment_destroy(as->as_heap);
+		as->as_heap = NULL;
+		return result;
+	}
+	npages += as->as_heap_maxpages;
+#else
+	(void)elf_end;
+#endif
+
+#if OPT_MMAP
+	size_t reserved;
+	vaddr_t lowest;
+
+	/*
+	 * the mappings live in a window right below the lowest address
+	 * the stack can reach, and above the limit of the heap.
+	 */
+#if OPT_STACKGROW
+	reserved = (as_stack_max + SEG_MMAP_GUARD) * PAGE_SIZE;
+#else
+	reserved = (as->as_stack->seg_npages + SEG_MMAP_GUARD) * PAGE_SIZE;
+#endif
+	lowest = heap_base + (as->as_heap_maxpages + SEG_MMAP_GUARD) * PAGE_SIZE;
+	as->as_mmap_maxpages = 0;
+	if (lowest < USERSTACK && USERSTACK - lowest > reserved) {
+		as->as_mmap_maxpages = (USERSTACK - lowest - reserved) / PAGE_SIZE;
+	}
+	if (as->as_mmap_maxpages > SEG_MMAP_MAX) {
+		as->as_mmap_maxpages = SEG_MMAP_MAX;
+	}
+	as->as_mmap_base = USERSTACK - reserved - as->as_mmap_maxpages * PAGE_SIZE;
+	as->as_mmap_ptbase = npages;
+	npages += as->as_mmap_maxpages;
+#endif
 
 	/* Create the page table based on the segments loaded previously */
-	int npages = as->as_data->seg_npages + as->as_text->seg_npages + as->as_stack->seg_npages;
-	as->as_ptable = pt_create(npages);
+	as->as_regions[as->as_nregions - 1].ar_ptbase = npages;
+	npages += as->as_stack->seg_npages;
+#if OPT_STACKGROW
+	/* with room for the stack to grow up to its limit */
+	as->as_ptable = pt_create(npages, npages - as->as_stack->seg_npages + as_stack_max);
+#else
+	as->as_ptable = pt_create(npages, npages);
+#endif
+	if (as->as_ptable == NULL) {
+		return ENOMEM;
+	}
 
 	return 0;
 }
 
+#if OPT_HEAP
 /**
- * @brief retrieve the segment type from which the virtual address belongs to.
+ * @brief move the break of the heap by amount bytes. The pages above
+ * a lower break are released at once, with their frames and swap
+ * slots; the pages below a higher one are zero-filled on their first
+ * fault.
  * 
  * @param as 
- * @param vaddr 
- * @return int 
+ * @param amount 
+ * @param oldbreak filled with the previous break
+ * @return int 0 on success, EINVAL below the start of the heap,
+ * ENOMEM beyond its limit, too close to the stack or if the page
+ * table could not be read back while shrinking
  */
 int
-as_get_segment_type(struct addrspace *as, vaddr_t vaddr)
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
 {
+	struct segment *heap;
+	struct pt_entry *pt_row;
+	vaddr_t old, newbreak, page, limit;
+
 	KASSERT(as != NULL);
-    
-	if (vaddr >= as->as_text->seg_first_vaddr && vaddr < as->as_text->seg_last_vaddr)
-    {
-        return SEGMENT_TEXT;
-    }
+	KASSERT(as->as_heap != NULL);
+
+	heap = as->as_heap;
+	old = heap->seg_last_vaddr;
+
+	if (amount < 0) {
+		if ((vaddr_t)-amount > old - heap->seg_first_vaddr) {
+			return EINVAL;
+		}
+		newbreak = old - (vaddr_t)-amount;
+
+		/*
+		 * release the pages entirely above the new break, from the
+		 * top: if a leaf of the page table cannot be brought back,
+		 * the break stops above the pages still there.
+		 */
+		for (page = ROUNDUP(old, PAGE_SIZE); page > ROUNDUP(newbreak, PAGE_SIZE); ) {
+			page -= PAGE_SIZE;
+			pt_row = pt_get_entry(as, page);
+			if (pt_row == NULL) {
+				if (page + PAGE_SIZE < old) {
+					heap->seg_last_vaddr = page + PAGE_SIZE;
+					heap->seg_npages = DIVROUNDUP(page + PAGE_SIZE - heap->seg_first_vaddr, PAGE_SIZE);
+				}
+				return ENOMEM;
+			}
+			if (pt_free_entry(pt_row)) {
+				tlb_remove_by_vaddr(page);
+#if OPT_STATS
+				vmstats_hit(VMSTAT_HEAP_RELEASED);
+#endif
+			}
+			pt_put_entry(as, page);
+		}
+	}
+	else {
+		limit = heap->seg_first_vaddr + as->as_heap_maxpages * PAGE_SIZE;
+		if ((vaddr_t)amount > limit - old) {
+			return ENOMEM;
+		}
+		newbreak = old + amount;
+#if OPT_STACKGROW
+		if (ROUNDUP(newbreak, PAGE_SIZE) + SEG_STACK_GUARD * PAGE_SIZE > as->as_stack->seg_first_vaddr) {
+			return ENOMEM;
+		}
+#else
+		if (newbreak > as->as_stack->seg_first_vaddr) {
+			return ENOMEM;
+		}
+#endif
+	}
 
-    if (vaddr >= as->as_data->seg_first_vaddr && vaddr < as->as_data->seg_last_vaddr)
-    {
-        return SEGMENT_DATA;
-    }
+	heap->seg_last_vaddr = newbreak;
+	heap->seg_npages = DIVROUNDUP(newbreak - heap->seg_first_vaddr, PAGE_SIZE);
 
-    if (vaddr >= as->as_stack->seg_first_vaddr && vaddr < as->as_stack->seg_last_vaddr)
-    {
-        return SEGMENT_STACK;
-    }
-    
-    return 0;
+	*oldbreak = old;
+	return 0;
 }
+#endif
 
+#if OPT_STACKGROW
 /**
- * @brief retrieve the segment from which the virtual address belongs to.
+ * @brief extend the stack down to the page of vaddr, if it is within
+ * SEG_STACK_WINDOW pages below the stack, the stack stays within the
+ * limit the page table was created with, and at least SEG_STACK_GUARD
+ * pages are left unmapped above the region right below the stack.
  * 
  * @param as 
- * @param vaddr 
- * @return struct segment* 
+ * @param vaddr faulting address
+ * @return true if the stack now contains vaddr
  */
-static
-struct segment *
-as_get_segment(struct addrspace *as, vaddr_t vaddr){
+bool
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_region *region;
+	struct segment *stack;
+	vaddr_t first, lowest;
+	size_t npages, others;
 
 	KASSERT(as != NULL);
+	KASSERT(as->as_ptable != NULL);
+	KASSERT(as->as_nregions > 1);
 
-	switch(as_get_segment_type(as,vaddr)){
-		case SEGMENT_TEXT:
-			return as->as_text;
-		case SEGMENT_DATA:	
-			return as->as_data;
-		case SEGMENT_STACK:	
-			return as->as_stack;
-		default:
-			panic("invalid segment type! (as_get_segment)");
+	region = &as->as_regions[as->as_nregions - 1];
+	stack = as->as_stack;
+	KASSERT(region->ar_seg == stack);
+	first = vaddr & PAGE_FRAME;
+	if (first >= stack->seg_first_vaddr ||
+	    stack->seg_first_vaddr - first > SEG_STACK_WINDOW * PAGE_SIZE) {
+		return false;
 	}
-    return NULL;
+
+	npages = (stack->seg_last_vaddr - first) / PAGE_SIZE;
+	others = region->ar_ptbase;
+	if (others + npages > as->as_ptable->pd_maxentries) {
+		return false;
+	}
+
+	lowest = ROUNDUP(as->as_regions[as->as_nregions - 2].ar_seg->seg_last_vaddr, PAGE_SIZE) +
+		 SEG_STACK_GUARD * PAGE_SIZE;
+	if (first < lowest) {
+		return false;
+	}
+
+	stack->seg_first_vaddr = first;
+	stack->seg_npages = npages;
+	pt_grow(as->as_ptable, others + npages);
+
+#if OPT_STATS
+	vmstats_hit(VMSTAT_STACK_GROW);
+#endif
+
+	return true;
 }
 
 /**
- * @brief check whether the virtual address belongs to a page of
- * the segment which has to be load from the elf file.
+ * @brief set the limit of the stacks, in pages, for the programs
+ * started from now on.
  * 
- * @param as 
- * @param vaddr 
- * @return true if the page has to be loaded from the elf
- * @return false if not
+ * @param maxpages 
  */
-bool as_check_in_elf(struct addrspace *as, vaddr_t vaddr){
+void
+as_set_stack_max(unsigned maxpages)
+{
+	as_stack_max = maxpages < SEG_STACK_INIT ? SEG_STACK_INIT : maxpages;
+}
+
+/**
+ * @brief print the limit of the stacks.
+ */
+void
+as_print_stack_max(void)
+{
+	kprintf("stack: %u pages at most, %u at exec time, guard gap %u pages\n",
+		as_stack_max, SEG_STACK_INIT, SEG_STACK_GUARD);
+}
+#endif
+
+#if OPT_MMAP
+/**
+ * @brief retrieve the file mapping containing vaddr.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return struct segment* of the mapping, NULL if vaddr is not mapped
+ */
+struct segment *
+as_get_mapping(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_region *region;
+
+	region = as_get_region(as, vaddr);
+	if (region == NULL || region->ar_type != SEGMENT_MMAP) {
+		return NULL;
+	}
+
+	return region->ar_seg;
+}
+
+/**
+ * @brief map len bytes of the file v, starting at offset, at the
+ * first hole of the window large enough for them (the address hint
+ * of mmap is not used). The pages are read from the file on their
+ * first fault; the part of the mapping beyond the end of the file is
+ * zero-filled.
+ * 
+ * @param as 
+ * @param len 
+ * @param writable 
+ * @param shared the writes are carried through to the file
+ * @param v 
+ * @param offset page aligned
+ * @param addr filled with the address of the mapping
+ * @return int 0 on success, ENOMEM if there is no room left, or the
+ * error of VOP_STAT
+ */
+int
+as_mmap(struct addrspace *as, size_t len, bool writable, bool shared,
+	struct vnode *v, off_t offset, vaddr_t *addr)
+{
+	struct segment *seg;
+	struct stat st;
+	vaddr_t start, end, window_end;
+	size_t npages, filesize;
+	unsigned i;
+	int result;
+
+	KASSERT(as != NULL);
+	KASSERT(len > 0);
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	if (npages > as->as_mmap_maxpages) {
+		return ENOMEM;
+	}
+
+	/*	first fit: the mappings are met in address order among the regions	*/
+	window_end = as->as_mmap_base + as->as_mmap_maxpages * PAGE_SIZE;
+	start = as->as_mmap_base;
+	for (i = 0; i < as->as_nregions; i++) {
+		if (as->as_regions[i].ar_type != SEGMENT_MMAP) {
+			continue;
+		}
+		seg = as->as_regions[i].ar_seg;
+		if (seg->seg_first_vaddr >= start + npages * PAGE_SIZE) {
+			break;
+		}
+		start = seg->seg_last_vaddr;
+	}
+	if (npages > (window_end - start) / PAGE_SIZE) {
+		return ENOMEM;
+	}
+	end = start + npages * PAGE_SIZE;
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (st.st_size <= offset) {
+		filesize = 0;
+	}
+	else if (st.st_size - offset < (off_t)len) {
+		filesize = st.st_size - offset;
+	}
+	else {
+		filesize = len;
+	}
+
+	seg = segment_create();
+	if (seg == NULL) {
+		return ENOMEM;
+	}
+	segment_define(seg, offset, start, start, end, npages, filesize);
+	result = as_add_region(as, seg, SEGMENT_MMAP,
+			       as->as_mmap_ptbase + (start - as->as_mmap_base) / PAGE_SIZE);
+	if (result) {
+		segment_destroy(seg);
+		return result;
+	}
+	VOP_INCREF(v);
+	seg->seg_vnode = v;
+	seg->seg_writable = writable;
+	seg->seg_shared = shared;
+
+	*addr = start;
+	return 0;
+}
+
+/**
+ * @brief write back the resident pages of a shared mapping which
+ * have been modified since they were loaded.
+ * 
+ * @param as 
+ * @param seg 
+ */
+static void
+as_mmap_sync(struct addrspace *as, struct segment *seg)
+{
+	struct pt_entry *pt_row;
+	vaddr_t page;
+
+	if (!seg->seg_shared || !seg->seg_writable) {
+		return;
+	}
+
+	for (page = seg->seg_first_vaddr; page < seg->seg_last_vaddr; page += PAGE_SIZE) {
+		pt_row = pt_get_entry(as, page);
+		if (pt_row == NULL) {
+			/* a leaf out of memory holds no resident page */
+			continue;
+		}
+		coremap_file_sync(pt_row);
+		pt_put_entry(as, page);
+	}
+}
+
+/**
+ * @brief remove the mapping starting at addr, writing back its
+ * modified pages if it is shared. Only whole mappings can be removed.
+ * 
+ * @param as 
+ * @param addr 
+ * @param len length given to mmap
+ * @return int 0 on success, EINVAL if no mapping matches, ENOMEM if
+ * the page table could not be read back (the mapping stays, with the
+ * pages released so far to be loaded again)
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct segment *seg;
+	struct pt_entry *pt_row;
+	vaddr_t page;
+
+	KASSERT(as != NULL);
+
+	seg = as_get_mapping(as, addr);
+	if (seg == NULL || seg->seg_first_vaddr != addr ||
+	    DIVROUNDUP(len, PAGE_SIZE) != seg->seg_npages) {
+		return EINVAL;
+	}
+
+	as_mmap_sync(as, seg);
+	for (page = seg->seg_first_vaddr; page < seg->seg_last_vaddr; page += PAGE_SIZE) {
+		pt_row = pt_get_entry(as, page);
+		if (pt_row == NULL) {
+			return ENOMEM;
+		}
+		if (pt_free_entry(pt_row)) {
+			tlb_remove_by_vaddr(page);
+		}
+		pt_put_entry(as, page);
+	}
+
+	as_remove_region(as, seg);
+	segment_destroy(seg);
+
+	return 0;
+}
+
+/**
+ * @brief read the page of a file mapping containing vaddr into a new
+ * frame, mapped by pt_row. The frame is filled while it is still a
+ * kernel page, so that it cannot be evicted before its file backing
+ * is recorded.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @param pt_row 
+ * @return int 0 on success, ENOMEM if no frame is left
+ */
+int
+as_load_mapped(struct addrspace *as, vaddr_t vaddr, struct pt_entry *pt_row)
+{
+	struct segment *seg;
+	vaddr_t page, kpage;
+	off_t offset;
+	size_t size;
+	paddr_t paddr;
+
+	seg = as_get_mapping(as, vaddr);
+	KASSERT(seg != NULL);
+
+	page = vaddr & PAGE_FRAME;
+	offset = seg->seg_elf_offset + (page - seg->seg_first_vaddr);
+	size = 0;
+	if (page - seg->seg_first_vaddr < seg->seg_elf_size) {
+		size = seg->seg_elf_size - (page - seg->seg_first_vaddr);
+		if (size > PAGE_SIZE) {
+			size = PAGE_SIZE;
+		}
+	}
+
+	kpage = alloc_kpages(1);
+	if (kpage == 0) {
+		return ENOMEM;
+	}
+	paddr = KVADDR_TO_PADDR(kpage);
+	if (size > 0) {
+		load_page(seg->seg_vnode, offset, paddr, size);
+	}
+
+	spinlock_acquire(&cm_spinlock);
+	coremap_set_ptentry(paddr, pt_row);
+	pt_set_entry(pt_row, paddr, 0, IN_MEMORY);
+	if (size > 0) {
+		mmap_frame_set(paddr / PAGE_SIZE, seg->seg_vnode, offset, size);
+	}
+	spinlock_release(&cm_spinlock);
+
+#if OPT_STATS
+	if (size > 0) {
+		vmstats_hit(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_hit(VMSTAT_MMAP_READ);
+	}
+	else {
+		vmstats_hit(VMSTAT_PAGE_FAULT_ZERO);
+	}
+#endif
+
+	return 0;
+}
+#endif
+
+/**
+ * @brief retrieve the region the virtual address belongs to, with a
+ * binary search of the regions sorted by address. The heap and the
+ * stack move their bounds, but never past their neighbours, so the
+ * order is kept.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return struct as_region* NULL if vaddr is outside every region
+ */
+struct as_region *
+as_get_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_region *region;
+	unsigned i;
+
+	KASSERT(as != NULL);
+
+	i = as_region_index(as, vaddr);
+	if (i == 0) {
+		return NULL;
+	}
+
+	region = &as->as_regions[i - 1];
+	if (vaddr >= region->ar_seg->seg_last_vaddr) {
+		return NULL;
+	}
+
+	return region;
+}
+
+/**
+ * @brief retrieve the segment type from which the virtual address belongs to.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return int SEGMENT_*, 0 if vaddr is outside every region
+ */
+int
+as_get_segment_type(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_region *region;
+
+	region = as_get_region(as, vaddr);
+	if (region == NULL) {
+		return 0;
+	}
+
+	return region->ar_type;
+}
+
+/**
+ * @brief retrieve the segment from which the virtual address belongs to.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return struct segment* 
+ */
+static
+struct segment *
+as_get_segment(struct addrspace *as, vaddr_t vaddr){
+	struct as_region *region;
+
+	region = as_get_region(as, vaddr);
+	if (region == NULL) {
+		panic("invalid segment type! (as_get_segment)");
+	}
+
+	return region->ar_seg;
+}
+
+/**
+ * @brief check whether the virtual address belongs to a page of
+ * the segment which has to be load from the elf file.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return true if the page has to be loaded from the elf
+ * @return false if not
+ */
+bool as_check_in_elf(struct addrspace *as, vaddr_t vaddr){
 	struct segment *seg;
 
 	KASSERT(as != NULL);
@@ -326,7 +1316,9 @@ int as_load_page(struct addrspace *as,struct vnode *vnode, vaddr_t faultaddress)
 	vmstats_hit(VMSTAT_PAGE_FAULT_ELF);
 #endif
 
+	/*	the leaf is already pinned by the caller, it is resident	*/
 	pt_row = pt_get_entry(as,faultaddress);
+	KASSERT(pt_row != NULL);
 	segment = as_get_segment(as,faultaddress);
 
 	/*	assert that the fault address belongs to the segment 	*/
@@ -380,9 +1372,1118 @@ int as_load_page(struct addrspace *as,struct vnode *vnode, vaddr_t faultaddress)
 
 	}
 
+	pt_put_entry(as,faultaddress);
+
 	load_page(vnode,offset,target_addr,size);
 
 	return 0;
 }
 
+#if OPT_READAHEAD
+/**
+ * @brief check whether the page at vaddr is entirely backed by the
+ * elf file, so that it can be read together with its neighbours.
+ * 
+ * @param seg 
+ * @param vaddr page aligned
+ * @return true if the whole page comes from the elf
+ */
+static
+bool
+as_page_full(struct segment *seg, vaddr_t vaddr)
+{
+	return vaddr >= seg->seg_first_vaddr &&
+	       vaddr + PAGE_SIZE <= seg->seg_first_vaddr + seg->seg_elf_size;
+}
+
+/**
+ * @brief load the faulting page together with up to seg_ra_window
+ * following pages of the segment with a single read. The pages read
+ * ahead are marked with pt_ra until they are accessed.
+ * 
+ * The window is adapted on the outcome of the previous cluster of
+ * the segment: doubled if all its pages have been used, halved if
+ * less than half of them have.
+ * 
+ * Frames are allocated as kernel pages and handed to their entries
+ * only once filled, so that allocating the next ones of the cluster
+ * cannot evict them.
+ * 
+ * @param as 
+ * @param vnode 
+ * @param faultaddress 
+ * @param pt_row entry of the faulting page, NOT_LOADED
+ * @param status status of the loaded entries
+ * @return true if loaded, false if the faulting page is not entirely
+ * in the elf and has to be loaded by as_load_page
+ */
+bool as_load_cluster(struct addrspace *as, struct vnode *vnode, vaddr_t faultaddress,
+		     struct pt_entry *pt_row, unsigned char status){
+	struct as_region *region;
+	struct segment *segment;
+	struct pt_entry *rows[SEG_RA_MAX + 1];
+	paddr_t pages[SEG_RA_MAX + 1];
+	vaddr_t base, vaddr;
+	unsigned n, i;
+
+	base = faultaddress & PAGE_FRAME;
+	region = as_get_region(as, faultaddress);
+	KASSERT(region != NULL);
+	segment = region->ar_seg;
+	if(!as_page_full(segment, base))
+	{
+		return false;
+	}
+#if OPT_MADVISE
+	/*	random accesses are never read ahead	*/
+	if(segment->seg_advice == MADV_RANDOM)
+	{
+		return false;
+	}
+#endif
+
+#if OPT_MADVISE
+	/*	sequential ones keep the largest window	*/
+	if(segment->seg_ra_issued > 0 && segment->seg_advice != MADV_SEQUENTIAL)
+#else
+	if(segment->seg_ra_issued > 0)
+#endif
+	{
+		if(segment->seg_ra_hits >= segment->seg_ra_issued)
+		{
+			segment->seg_ra_window = segment->seg_ra_window * 2 > SEG_RA_MAX ?
+						 SEG_RA_MAX : segment->seg_ra_window * 2;
+		}
+		else if(segment->seg_ra_hits * 2 < segment->seg_ra_issued)
+		{
+			segment->seg_ra_window = segment->seg_ra_window / 2 < SEG_RA_MIN ?
+						 SEG_RA_MIN : segment->seg_ra_window / 2;
+		}
+	}
+
+	KASSERT(pt_row->pt_status == NOT_LOADED);
+	rows[0] = pt_row;
+	pages[0] = KVADDR_TO_PADDR(alloc_kpages(1));
+
+	/*	collect the following pages not loaded yet	*/
+	for(n = 1; n <= segment->seg_ra_window; n++)
+	{
+		vaddr = base + n * PAGE_SIZE;
+		if(!as_page_full(segment, vaddr))
+		{
+			break;
+		}
+		rows[n] = pt_get_entry(as, vaddr);
+		if(rows[n] == NULL)
+		{
+			break;
+		}
+#if OPT_PAGEBUSY
+		/*	a page loaded by another thread ends the cluster	*/
+		spinlock_acquire(&cm_spinlock);
+		if(rows[n]->pt_status != NOT_LOADED || rows[n]->pt_busy)
+		{
+			spinlock_release(&cm_spinlock);
+			pt_put_entry(as, vaddr);
+			break;
+		}
+		rows[n]->pt_busy = 1;
+		spinlock_release(&cm_spinlock);
+#else
+		if(rows[n]->pt_status != NOT_LOADED)
+		{
+			pt_put_entry(as, vaddr);
+			break;
+		}
+#endif
+		pages[n] = KVADDR_TO_PADDR(alloc_kpages(1));
+	}
+
+#if OPT_STATS
+	vmstats_hit(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_hit(VMSTAT_PAGE_FAULT_ELF);
+#endif
+
+	load_pages(vnode, segment->seg_elf_offset + (base - segment->seg_first_vaddr), pages, n);
+
+	spinlock_acquire(&cm_spinlock);
+	for(i = 0; i < n; i++)
+	{
+		coremap_set_ptentry(pages[i], rows[i]);
+		pt_set_entry(rows[i], pages[i], 0, status);
+		rows[i]->pt_ra = i > 0;
+#if OPT_PAGEBUSY
+		/*	the faulting page is released by vm_fault	*/
+		if(i > 0)
+		{
+			pt_unbusy(rows[i]);
+		}
+#endif
+	}
+	spinlock_release(&cm_spinlock);
+
+	for(i = 1; i < n; i++)
+	{
+#if OPT_SHAREDTEXT
+		if(region->ar_type == SEGMENT_TEXT)
+		{
+			coremap_text_insert(vnode, base + i * PAGE_SIZE, rows[i]);
+		}
+#endif
+		pt_put_entry(as, base + i * PAGE_SIZE);
+#if OPT_STATS
+		vmstats_hit(VMSTAT_RA_LOADED);
+#endif
+	}
+
+	segment->seg_ra_issued = n - 1;
+	segment->seg_ra_hits = 0;
+
+	return true;
+}
+
+/**
+ * @brief account the first access to a page read ahead.
+ * 
+ * @param as 
+ * @param vaddr 
+ */
+void as_readahead_hit(struct addrspace *as, vaddr_t vaddr){
+	struct segment *segment;
+
+	segment = as_get_segment(as, vaddr);
+	segment->seg_ra_hits++;
+#if OPT_STATS
+	vmstats_hit(VMSTAT_RA_HIT);
+#endif
+}
+#endif
+
+#if OPT_MADVISE || OPT_STRIDE
+/**
+ * @brief retrieve the region having a part in the page, even if it
+ * starts in the middle of it.
+ * 
+ * @param as 
+ * @param page page aligned
+ * @return struct as_region* NULL if the page is outside every region
+ */
+static
+struct as_region *
+as_get_page_region(struct addrspace *as, vaddr_t page)
+{
+	struct as_region *region;
+	unsigned i;
+
+	i = as_region_index(as, page + PAGE_SIZE - 1);
+	if (i == 0) {
+		return NULL;
+	}
+
+	region = &as->as_regions[i - 1];
+	if (region->ar_seg->seg_last_vaddr <= page) {
+		return NULL;
+	}
+
+	return region;
+}
+
+/**
+ * @brief bring a page of the region in memory ahead of its first
+ * access: from the elf or the mapped file if it was never loaded,
+ * from swap if it was swapped out. Pages which would be zero-filled
+ * are left to their fault, which costs no I/O.
+ * 
+ * @param as 
+ * @param vnode elf file of the process
+ * @param region 
+ * @param vaddr within the region
+ * @param pt_row entry of vaddr, pinned by pt_get_entry
+ * @param stride the page is prefetched on a stride, see pt_pf
+ * @return true if the page has been loaded
+ */
+static
+bool
+as_page_in(struct addrspace *as, struct vnode *vnode, struct as_region *region, vaddr_t vaddr,
+	   struct pt_entry *pt_row, bool stride)
+{
+	paddr_t paddr;
+	unsigned char status;
+	bool readonly, loaded;
+#if OPT_SHAREDTEXT
+	struct cm_rmap *node;
+#endif
+
+	readonly = region->ar_type == SEGMENT_TEXT;
+	status = (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY;
+
+#if OPT_PAGEBUSY
+	/*
+	 * a page already being loaded or swapped out is left to its
+	 * owner. No load is counted as avoided: the page may not be
+	 * resident when the owner is done.
+	 */
+	spinlock_acquire(&cm_spinlock);
+	if (pt_row->pt_busy) {
+		spinlock_release(&cm_spinlock);
+		return false;
+	}
+	pt_row->pt_busy = 1;
+	spinlock_release(&cm_spinlock);
+#endif
+
+	loaded = false;
+	switch (pt_row->pt_status) {
+	    case NOT_LOADED:
+#if OPT_MMAP
+		if (region->ar_type == SEGMENT_MMAP) {
+			loaded = as_load_mapped(as, vaddr, pt_row) == 0;
+			break;
+		}
+#endif
+		if ((region->ar_type != SEGMENT_TEXT && region->ar_type != SEGMENT_DATA) ||
+		    !as_check_in_elf(as, vaddr)) {
+			break;
+		}
+#if OPT_SHAREDTEXT
+		/*	text pages already loaded by another process are shared	*/
+		if (readonly && (node = coremap_rmap_alloc()) != NULL) {
+			if (coremap_text_lookup(vnode, vaddr & PAGE_FRAME, pt_row, status, node) != 0) {
+				loaded = true;
+				break;
+			}
+			coremap_rmap_free(node);
+		}
+#endif
+		paddr = alloc_upage(pt_row);
+		pt_set_entry(pt_row, paddr, 0, status);
+		as_load_page(as, vnode, vaddr);
+#if OPT_SHAREDTEXT
+		if (readonly) {
+			coremap_text_insert(vnode, vaddr & PAGE_FRAME, pt_row);
+		}
+#endif
+		loaded = true;
+		break;
+#if OPT_SWAP
+	    case IN_SWAP:
+		paddr = alloc_upage(pt_row);
+		swap_in(paddr, pt_row->pt_swap_index);
+		pt_set_entry(pt_row, paddr, 0, status);
+		loaded = true;
+		break;
+#endif
+	    default:
+		break;
+	}
+
+	/*	marked before the unbusy, so that a waiting fault sees it	*/
+	spinlock_acquire(&cm_spinlock);
+	if (loaded && stride) {
+		pt_row->pt_pf = 1;
+	}
+#if OPT_PAGEBUSY
+	pt_unbusy(pt_row);
+#endif
+	spinlock_release(&cm_spinlock);
+
+	return loaded;
+}
+#endif
+
+#if OPT_MADVISE
+/**
+ * @brief apply the advice to the pages from start to end:
+ * - MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set the access
+ *   pattern of the regions touched by the range, as a whole, which
+ *   drives their readahead window;
+ * - MADV_WILLNEED loads the pages from the elf, the mapped file or
+ *   swap at once;
+ * - MADV_DONTNEED makes the resident pages the first eviction victims,
+ *   their content is kept;
+ * - MADV_FREE releases the pages at once, with no swap write: the next
+ *   access finds them zero-filled, or as in their file. Modified pages
+ *   of shared mappings are written back first.
+ * 
+ * @param as 
+ * @param vnode elf file of the process
+ * @param start page aligned
+ * @param end page aligned
+ * @param advice MADV_*
+ * @return int 0 on success, ENOMEM if a page of the range is outside
+ * every region or its page table could not be read back (the pages
+ * before it have been advised)
+ */
+int
+as_madvise(struct addrspace *as, struct vnode *vnode, vaddr_t start, vaddr_t end, int advice)
+{
+	struct as_region *region;
+	struct segment *seg;
+	struct pt_entry *pt_row;
+	vaddr_t page, addr, stop;
+	unsigned char status;
+
+	KASSERT(as != NULL);
+	KASSERT(start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+
+	for (page = start; page < end; page = stop) {
+		region = as_get_page_region(as, page);
+		if (region == NULL) {
+			return ENOMEM;
+		}
+		seg = region->ar_seg;
+		stop = ROUNDUP(seg->seg_last_vaddr, PAGE_SIZE);
+		if (stop > end) {
+			stop = end;
+		}
+
+		switch (advice) {
+		    case MADV_NORMAL:
+		    case MADV_RANDOM:
+		    case MADV_SEQUENTIAL:
+			seg->seg_advice = advice;
+#if OPT_READAHEAD
+			seg->seg_ra_window = advice == MADV_SEQUENTIAL ? SEG_RA_MAX : SEG_RA_INIT;
+			seg->seg_ra_issued = 0;
+			seg->seg_ra_hits = 0;
+#endif
+			continue;
+		    default:
+			break;
+		}
+
+		for (; page < stop; page += PAGE_SIZE) {
+			/*	the first page of the region may start in its middle	*/
+			addr = page < seg->seg_first_vaddr ? seg->seg_first_vaddr : page;
+			status = pt_peek_status(as, addr);
+
+			switch (advice) {
+			    case MADV_WILLNEED:
+				if (status == IN_MEMORY || status == IN_MEMORY_RDONLY) {
+					break;
+				}
+				pt_row = pt_get_entry(as, addr);
+				if (pt_row == NULL) {
+					return ENOMEM;
+				}
+				if (as_page_in(as, vnode, region, addr, pt_row, false)) {
+#if OPT_STATS
+					vmstats_hit(VMSTAT_MADV_PREFETCHED);
+#endif
+				}
+				pt_put_entry(as, addr);
+				break;
+			    case MADV_DONTNEED:
+				if (status != IN_MEMORY && status != IN_MEMORY_RDONLY) {
+					break;
+				}
+				pt_row = pt_get_entry(as, addr);
+				if (pt_row == NULL) {
+					return ENOMEM;
+				}
+				spinlock_acquire(&cm_spinlock);
+				if (pt_row->pt_status == IN_MEMORY || pt_row->pt_status == IN_MEMORY_RDONLY) {
+					coremap_set_cold(pt_row->pt_frame_index * PAGE_SIZE);
+				}
+				spinlock_release(&cm_spinlock);
+				pt_put_entry(as, addr);
+				break;
+			    case MADV_FREE:
+				if (status == NOT_LOADED) {
+					break;
+				}
+				pt_row = pt_get_entry(as, addr);
+				if (pt_row == NULL) {
+					return ENOMEM;
+				}
+#if OPT_MMAP
+				if (region->ar_type == SEGMENT_MMAP && seg->seg_shared && seg->seg_writable) {
+					coremap_file_sync(pt_row);
+				}
+#endif
+				if (pt_free_entry(pt_row)) {
+					tlb_remove_by_vaddr(page);
+#if OPT_STATS
+					vmstats_hit(VMSTAT_MADV_FREED);
+#endif
+				}
+				pt_put_entry(as, addr);
+				break;
+			    default:
+				panic("as_madvise: invalid advice %d\n", advice);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief report which of npages pages from start are resident.
+ * 
+ * @param as 
+ * @param start page aligned
+ * @param npages 
+ * @param vec filled with one byte for each page, 1 if resident
+ * @return int 0 on success, ENOMEM if a page is outside every region
+ */
+int
+as_mincore(struct addrspace *as, vaddr_t start, unsigned npages, unsigned char *vec)
+{
+	struct as_region *region;
+	vaddr_t page, addr;
+	unsigned char status;
+	unsigned i;
+
+	KASSERT(as != NULL);
+	KASSERT(start % PAGE_SIZE == 0);
+
+	for (i = 0; i < npages; i++) {
+		page = start + i * PAGE_SIZE;
+		region = as_get_page_region(as, page);
+		if (region == NULL) {
+			return ENOMEM;
+		}
+		addr = page < region->ar_seg->seg_first_vaddr ? region->ar_seg->seg_first_vaddr : page;
+		status = pt_peek_status(as, addr);
+		vec[i] = status == IN_MEMORY || status == IN_MEMORY_RDONLY;
+	}
+
+	return 0;
+}
+#endif
+
+#if OPT_STRIDE
+#if !OPT_PAGEBUSY || !OPT_ASRWLOCK
+#error "stride requires the pagebusy and asrwlock options"
+#endif
+
+/*
+ * A page predicted by a stream, brought in by the stride thread while
+ * the process goes on. The queue, and the streams and counters of
+ * every address space, are protected by as_stride_lock.
+ */
+struct as_prefetch {
+	struct addrspace *pf_as;
+	struct vnode    *pf_vnode;		/* elf file of the process */
+	vaddr_t         pf_vaddr;
+};
+
+static struct spinlock as_stride_lock = SPINLOCK_INITIALIZER;
+static struct wchan *as_stride_wchan;		/* woken when a page is queued */
+static struct wchan *as_stride_done_wchan;	/* woken when a page is done */
+static struct as_prefetch as_stride_queue[AS_STRIDE_QUEUE];
+static unsigned as_stride_head = 0;
+static unsigned as_stride_count = 0;
+static struct addrspace *as_stride_current = NULL;	/* being prefetched */
+
+/**
+ * @brief bring in a page predicted by a stream. The address space lock
+ * is taken as by a fault, and the page is loaded with its entry busy,
+ * so that a fault of the process on it waits for the load instead of
+ * doing it again.
+ * 
+ * @param as 
+ * @param vnode elf file of the process
+ * @param page page aligned
+ */
+static
+void
+as_stride_page_in(struct addrspace *as, struct vnode *vnode, vaddr_t page)
+{
+	struct as_region *region;
+	struct pt_entry *pt_row;
+	vaddr_t addr;
+
+	rwlock_acquire_read(as->as_lock);
+	region = as_get_page_region(as, page);
+#if OPT_MADVISE
+	if (region != NULL && region->ar_seg->seg_advice == MADV_RANDOM) {
+		region = NULL;
+	}
+#endif
+	if (region != NULL) {
+		addr = page < region->ar_seg->seg_first_vaddr ? region->ar_seg->seg_first_vaddr : page;
+		pt_row = pt_get_entry(as, addr);
+		if (pt_row != NULL) {
+			if (as_page_in(as, vnode, region, addr, pt_row, true)) {
+				spinlock_acquire(&as_stride_lock);
+				as->as_pf_issued++;
+				spinlock_release(&as_stride_lock);
+#if OPT_STATS
+				vmstats_hit(VMSTAT_STRIDE_PREFETCHED);
+#endif
+			}
+			pt_put_entry(as, addr);
+		}
+	}
+	rwlock_release_read(as->as_lock);
+}
+
+/**
+ * @brief body of the stride thread: prefetches the queued pages, in
+ * the order they were queued.
+ * 
+ * @param data1 
+ * @param data2 
+ */
+static
+void
+as_stride_thread(void *data1, unsigned long data2)
+{
+	struct as_prefetch pf;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&as_stride_lock);
+		while (as_stride_count == 0) {
+			wchan_sleep(as_stride_wchan, &as_stride_lock);
+		}
+		pf = as_stride_queue[as_stride_head];
+		as_stride_head = (as_stride_head + 1) % AS_STRIDE_QUEUE;
+		as_stride_count--;
+		as_stride_current = pf.pf_as;
+		spinlock_release(&as_stride_lock);
+
+		as_stride_page_in(pf.pf_as, pf.pf_vnode, pf.pf_vaddr);
+
+		spinlock_acquire(&as_stride_lock);
+		as_stride_current = NULL;
+		wchan_wakeall(as_stride_done_wchan, &as_stride_lock);
+		spinlock_release(&as_stride_lock);
+	}
+}
+
+/**
+ * @brief create the prefetch queue and start the stride thread.
+ */
+void
+as_stride_bootstrap(void)
+{
+	int result;
+
+	as_stride_wchan = wchan_create("stride");
+	as_stride_done_wchan = wchan_create("stride_done");
+	if (as_stride_wchan == NULL || as_stride_done_wchan == NULL) {
+		panic("as_stride_bootstrap: cannot create the queue\n");
+	}
+
+	result = thread_fork("stride", NULL, as_stride_thread, NULL, 0);
+	if (result) {
+		panic("as_stride_bootstrap: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+/**
+ * @brief drop the queued prefetches of the address space, and wait
+ * for the one in progress, if any. Called before the address space
+ * is destroyed, without its lock.
+ * 
+ * @param as 
+ */
+static
+void
+as_stride_cancel(struct addrspace *as)
+{
+	unsigned i, n, kept;
+
+	spinlock_acquire(&as_stride_lock);
+	/*	the prefetches of the other address spaces keep their order	*/
+	kept = 0;
+	for (i = 0; i < as_stride_count; i++) {
+		n = (as_stride_head + i) % AS_STRIDE_QUEUE;
+		if (as_stride_queue[n].pf_as != as) {
+			as_stride_queue[(as_stride_head + kept) % AS_STRIDE_QUEUE] = as_stride_queue[n];
+			kept++;
+		}
+	}
+	as_stride_count = kept;
+	while (as_stride_current == as) {
+		wchan_sleep(as_stride_done_wchan, &as_stride_lock);
+	}
+	spinlock_release(&as_stride_lock);
+}
+
+/**
+ * @brief give a page fault to the access streams of the address space.
+ * A fault one stride away from the last page of a stream confirms it,
+ * otherwise the nearest stream within AS_STRIDE_MAX pages learns the
+ * new stride, and a fault far from all of them starts a new stream in
+ * place of the oldest one. A confirmed stream has its next
+ * AS_STRIDE_DEPTH pages, in the direction of the stride, queued for
+ * the stride thread, which brings them in from the elf, the mapped
+ * file or swap. When the queue is full the pages are dropped.
+ * 
+ * @param as 
+ * @param vnode elf file of the process
+ * @param vaddr page aligned, faulted for the first time since it was
+ * loaded or prefetched
+ */
+void
+as_stride_fault(struct addrspace *as, struct vnode *vnode, vaddr_t vaddr)
+{
+	struct as_stream *stream, *nearest;
+	struct as_prefetch *pf;
+	vaddr_t page;
+	int delta, nearest_delta, dist;
+	unsigned i;
+	bool queued = false;
+
+	KASSERT(as != NULL);
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
+	spinlock_acquire(&as_stride_lock);
+	as->as_pf_faults++;
+
+	stream = NULL;
+	nearest = NULL;
+	nearest_delta = 0;
+	for (i = 0; i < AS_STRIDE_STREAMS; i++) {
+		if (as->as_streams[i].st_last == 0) {
+			continue;
+		}
+		delta = ((int)vaddr - (int)as->as_streams[i].st_last) / PAGE_SIZE;
+		if (delta != 0 && delta == as->as_streams[i].st_stride) {
+			stream = &as->as_streams[i];
+			break;
+		}
+		dist = delta < 0 ? -delta : delta;
+		if (dist != 0 && dist <= AS_STRIDE_MAX &&
+		    (nearest == NULL || dist < (nearest_delta < 0 ? -nearest_delta : nearest_delta))) {
+			nearest = &as->as_streams[i];
+			nearest_delta = delta;
+		}
+	}
+
+	if (stream != NULL) {
+		if (stream->st_confidence >= AS_STRIDE_CONFIRM) {
+			as->as_pf_correct++;
+		}
+		stream->st_confidence++;
+	}
+	else if (nearest != NULL) {
+		stream = nearest;
+		stream->st_stride = nearest_delta;
+		stream->st_confidence = 1;
+	}
+	else {
+		stream = &as->as_streams[as->as_stream_next];
+		as->as_stream_next = (as->as_stream_next + 1) % AS_STRIDE_STREAMS;
+		stream->st_last = vaddr;
+		stream->st_stride = 0;
+		stream->st_confidence = 0;
+		spinlock_release(&as_stride_lock);
+		return;
+	}
+	stream->st_last = vaddr;
+
+	if (stream->st_confidence < AS_STRIDE_CONFIRM) {
+		spinlock_release(&as_stride_lock);
+		return;
+	}
+	as->as_pf_predictions++;
+
+	page = vaddr;
+	for (i = 0; i < AS_STRIDE_DEPTH; i++) {
+		/*	the stream stops at the bounds of the user space	*/
+		if ((stream->st_stride > 0 &&
+		     page + stream->st_stride * PAGE_SIZE >= USERSPACETOP) ||
+		    (stream->st_stride < 0 &&
+		     page < (vaddr_t)(-stream->st_stride) * PAGE_SIZE)) {
+			break;
+		}
+		page += stream->st_stride * PAGE_SIZE;
+
+		if (as_stride_count == AS_STRIDE_QUEUE) {
+			as->as_pf_dropped++;
+			continue;
+		}
+		pf = &as_stride_queue[(as_stride_head + as_stride_count) % AS_STRIDE_QUEUE];
+		pf->pf_as = as;
+		pf->pf_vnode = vnode;
+		pf->pf_vaddr = page;
+		as_stride_count++;
+		queued = true;
+	}
+
+	if (queued) {
+		wchan_wakeone(as_stride_wchan, &as_stride_lock);
+	}
+	spinlock_release(&as_stride_lock);
+}
+
+/**
+ * @brief count the first access to a page prefetched on a stride.
+ * 
+ * @param as 
+ */
+void
+as_stride_hit(struct addrspace *as)
+{
+	spinlock_acquire(&as_stride_lock);
+	as->as_pf_hits++;
+	spinlock_release(&as_stride_lock);
+#if OPT_STATS
+	vmstats_hit(VMSTAT_STRIDE_HIT);
+#endif
+}
+
+/**
+ * @brief print how well the streams of the address space predicted
+ * its faults, and how many of the prefetched pages were used.
+ * 
+ * @param as 
+ */
+static
+void
+as_print_stride(struct addrspace *as)
+{
+	if (as->as_pf_predictions == 0) {
+		return;
+	}
+
+	kprintf("stride prefetch: %u faults, %u/%u predictions correct (%u%%), "
+		"%u/%u prefetched pages used (%u%%), %u dropped\n",
+		as->as_pf_faults,
+		as->as_pf_correct, as->as_pf_predictions,
+		as->as_pf_correct * 100 / as->as_pf_predictions,
+		as->as_pf_hits, as->as_pf_issued,
+		as->as_pf_issued == 0 ? 0 : as->as_pf_hits * 100 / as->as_pf_issued,
+		as->as_pf_dropped);
+}
+#endif
+
+#if OPT_EAGERLOAD
+/**
+ * @brief set the loading policy of the next programs: segments of at
+ * most threshold pages are loaded entirely at exec time, and larger
+ * text segments have their first textpages pages loaded.
+ * 
+ * @param threshold 
+ * @param textpages 
+ */
+void as_set_eager(unsigned threshold, unsigned textpages){
+	as_eager_threshold = threshold > SEG_EAGER_MAX ? SEG_EAGER_MAX : threshold;
+	as_eager_text = textpages > SEG_EAGER_MAX ? SEG_EAGER_MAX : textpages;
+}
+
+/**
+ * @brief read the iovecs of a run of pages contiguous in the elf.
+ * 
+ * @param vnode 
+ * @param offset offset of the run within the elf
+ * @param iov 
+ * @param niov 
+ */
+static
+void
+as_read_run(struct vnode *vnode, off_t offset, struct iovec *iov, unsigned niov){
+#if OPT_STATS
+	vmstats_hit(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_hit(VMSTAT_PAGE_FAULT_ELF);
+#endif
+	load_iovec(vnode, offset, iov, niov);
+}
+
+/**
+ * @brief load npages pages of the region, starting from the page
+ * at first, with a single read of each run of the pages backed by
+ * the elf: a page already loaded breaks the run. Text pages already
+ * in the page cache are shared instead of being read.
+ * 
+ * @param as 
+ * @param vnode 
+ * @param region 
+ * @param first page aligned
+ * @param npages 
+ * @param status status of the loaded entries
+ * @return unsigned number of pages loaded or shared
+ */
+static
+unsigned
+as_load_eager(struct addrspace *as, struct vnode *vnode, struct as_region *region,
+	      vaddr_t first, unsigned npages, unsigned char status){
+	struct segment *segment = region->ar_seg;
+	struct pt_entry *rows[SEG_EAGER_MAX];
+	vaddr_t vaddrs[SEG_EAGER_MAX];
+	paddr_t pages[SEG_EAGER_MAX];
+	struct iovec iov[SEG_EAGER_MAX];
+	vaddr_t page, start, end, elf_end, kpage;
+	off_t offset = 0, next = 0;
+	unsigned i, n, niov, shared;
+#if OPT_SHAREDTEXT
+	struct cm_rmap *node;
+#endif
+
+	KASSERT(npages <= SEG_EAGER_MAX);
+
+	elf_end = segment->seg_first_vaddr + segment->seg_elf_size;
+	n = 0;
+	niov = 0;
+	shared = 0;
+	for(i = 0; i < npages; i++)
+	{
+		page = first + i * PAGE_SIZE;
+		rows[n] = pt_get_entry(as, page);
+		if(rows[n] == NULL)
+		{
+			break;
+		}
+		if(rows[n]->pt_status != NOT_LOADED)
+		{
+			pt_put_entry(as, page);
+			continue;
+		}
+#if OPT_SHAREDTEXT
+		/*	text pages already loaded by another process are shared	*/
+		if(region->ar_type == SEGMENT_TEXT && (node = coremap_rmap_alloc()) != NULL)
+		{
+			if(coremap_text_lookup(vnode, page, rows[n], status, node) != 0)
+			{
+				pt_put_entry(as, page);
+				shared++;
+				continue;
+			}
+			coremap_rmap_free(node);
+		}
+#endif
+		kpage = alloc_kpages(1);
+		if(kpage == 0)
+		{
+			pt_put_entry(as, page);
+			break;
+		}
+		vaddrs[n] = page;
+		pages[n] = KVADDR_TO_PADDR(kpage);
+
+		/*	portion of the page backed by the elf, if any	*/
+		start = page > segment->seg_first_vaddr ? page : segment->seg_first_vaddr;
+		end = page + PAGE_SIZE < elf_end ? page + PAGE_SIZE : elf_end;
+		if(start < end)
+		{
+			/*	a page skipped above leaves a hole in the file	*/
+			if(niov > 0 && segment->seg_elf_offset + (start - segment->seg_first_vaddr) != next)
+			{
+				as_read_run(vnode, offset, iov, niov);
+				niov = 0;
+			}
+			if(niov == 0)
+			{
+				offset = segment->seg_elf_offset + (start - segment->seg_first_vaddr);
+			}
+			iov[niov].iov_kbase = (void *)(PADDR_TO_KVADDR(pages[n]) + (start - page));
+			iov[niov].iov_len = end - start;
+			niov++;
+			next = segment->seg_elf_offset + (end - segment->seg_first_vaddr);
+		}
+		n++;
+	}
+
+	if(niov > 0)
+	{
+		as_read_run(vnode, offset, iov, niov);
+	}
+
+	spinlock_acquire(&cm_spinlock);
+	for(i = 0; i < n; i++)
+	{
+		coremap_set_ptentry(pages[i], rows[i]);
+		pt_set_entry(rows[i], pages[i], 0, status);
+	}
+	spinlock_release(&cm_spinlock);
+
+	for(i = 0; i < n; i++)
+	{
+#if OPT_SHAREDTEXT
+		if(region->ar_type == SEGMENT_TEXT)
+		{
+			coremap_text_insert(vnode, vaddrs[i], rows[i]);
+		}
+#endif
+		pt_put_entry(as, vaddrs[i]);
+	}
+
+	return n + shared;
+}
+
+/**
+ * @brief load at exec time the pages chosen by the loading policy
+ * when the segments were defined. Must be called after as_define_pt.
+ * 
+ * @param as 
+ * @param vnode 
+ */
+void as_prefault(struct addrspace *as, struct vnode *vnode){
+	struct as_region *region;
+	struct segment *segment;
+	unsigned char text_status, status;
+	vaddr_t first;
+	unsigned i, loaded = 0;
+
+	KASSERT(as != NULL);
+	KASSERT(as->as_ptable != NULL);
+
+	text_status = OPT_NOSWAP_RDONLY ? IN_MEMORY_RDONLY : IN_MEMORY;
+
+	for(i = 0; i < as->as_nregions; i++)
+	{
+		region = &as->as_regions[i];
+		segment = region->ar_seg;
+		if(segment->seg_eager == 0)
+		{
+			continue;
+		}
+		/*	the stack is loaded from its top	*/
+		if(region->ar_type == SEGMENT_STACK)
+		{
+			first = segment->seg_last_vaddr - segment->seg_eager * PAGE_SIZE;
+		}
+		else
+		{
+			first = segment->seg_first_vaddr & PAGE_FRAME;
+		}
+		status = region->ar_type == SEGMENT_TEXT ? text_status : IN_MEMORY;
+		loaded += as_load_eager(as, vnode, region, first, segment->seg_eager, status);
+	}
+
+#if OPT_STATS
+	while(loaded-- > 0)
+	{
+		vmstats_hit(VMSTAT_EAGER_LOADED);
+	}
+#else
+	(void)loaded;
+#endif
+}
+
+/**
+ * @brief start measuring the exec to first instruction latency.
+ * 
+ * @param as 
+ * @param start time the exec began
+ */
+void as_exec_started(struct addrspace *as, const struct timespec *start){
+	KASSERT(as != NULL);
+
+	as->as_exec_start = *start;
+	as->as_exec_pending = true;
+}
+
+/**
+ * @brief called at the end of every fault: the first one after exec
+ * is the fetch of the first instruction, as the TLB is empty, thus
+ * once it is resolved the program starts running.
+ * 
+ * @param as 
+ */
+void as_exec_done(struct addrspace *as){
+	struct timespec now, delta;
+
+	if(!as->as_exec_pending)
+	{
+		return;
+	}
+	as->as_exec_pending = false;
+
+	gettime(&now);
+	timespec_sub(&now, &as->as_exec_start, &delta);
+
+	spinlock_acquire(&as_exec_lock);
+	as_exec_count++;
+	as_exec_last = delta;
+	as_exec_total.tv_sec += delta.tv_sec;
+	as_exec_total.tv_nsec += delta.tv_nsec;
+	if(as_exec_total.tv_nsec >= 1000000000)
+	{
+		as_exec_total.tv_sec++;
+		as_exec_total.tv_nsec -= 1000000000;
+	}
+	spinlock_release(&as_exec_lock);
+}
+
+/**
+ * @brief print the exec to first instruction latency.
+ */
+void as_print_exec_stats(void){
+	unsigned count;
+	struct timespec total, last;
+	uint64_t avg_us;
+
+	spinlock_acquire(&as_exec_lock);
+	count = as_exec_count;
+	total = as_exec_total;
+	last = as_exec_last;
+	spinlock_release(&as_exec_lock);
+
+	avg_us = 0;
+	if(count > 0)
+	{
+		avg_us = ((uint64_t)total.tv_sec * 1000000 + total.tv_nsec / 1000) / count;
+	}
+
+	kprintf("exec: %u programs, first instruction after %llu us on average (last %llu us), eager threshold %u pages, text %u pages\n",
+		count, (unsigned long long)avg_us,
+		(unsigned long long)last.tv_sec * 1000000 + last.tv_nsec / 1000,
+		as_eager_threshold, as_eager_text);
+}
+
+#if OPT_LAUNCHPROF
+/**
+ * @brief load the pages listed in a launch profile. Consecutive pages
+ * of the same segment are read in a single batch, pages outside the
+ * segments are ignored.
+ * 
+ * @param as 
+ * @param vnode 
+ * @param pages page aligned, sorted
+ * @param npages 
+ */
+void as_prefetch(struct addrspace *as, struct vnode *vnode, const vaddr_t *pages, unsigned npages){
+	struct as_region *region;
+	struct segment *segment;
+	unsigned char status;
+	unsigned i, run, loaded = 0;
+
+	KASSERT(as != NULL);
+	KASSERT(as->as_ptable != NULL);
+
+	i = 0;
+	while(i < npages)
+	{
+		region = as_get_region(as, pages[i]);
+		if(region == NULL)
+		{
+			i++;
+			continue;
+		}
+		segment = region->ar_seg;
+
+		/*	extend the run while the pages are consecutive	*/
+		run = 1;
+		while(i + run < npages && run < SEG_EAGER_MAX &&
+		      pages[i + run] == pages[i] + run * PAGE_SIZE &&
+		      pages[i + run] < segment->seg_last_vaddr)
+		{
+			run++;
+		}
+
+		status = (region->ar_type == SEGMENT_TEXT && OPT_NOSWAP_RDONLY) ? IN_MEMORY_RDONLY : IN_MEMORY;
+		loaded += as_load_eager(as, vnode, region, pages[i], run, status);
+		i += run;
+	}
+
+#if OPT_STATS
+	while(loaded-- > 0)
+	{
+		vmstats_hit(VMSTAT_PROFILE_PREFETCHED);
+	}
+#else
+	(void)loaded;
+#endif
+}
+#endif
+#endif
+
 #endif /* OPT_DEMANDVM */
@@ -7,21 +7,78 @@
 #include <pt.h>
 #include <vm_tlb.h>
 #include <synch.h>
+#include <wchan.h>
 #include "opt-swap.h"
 #include "opt-noswap_rdonly.h"
+#include "opt-uniformfill.h"
+#include "opt-ksm.h"
+#include "opt-ptswap.h"
+#include "opt-sharedtext.h"
+#include "opt-readahead.h"
+#include "opt-fork.h"
+#include "opt-mmap.h"
+#include "opt-madvise.h"
+#include "opt-stride.h"
+#include "opt-fastexit.h"
+#include "opt-pin.h"
+#include "opt-pagebusy.h"
+#include "opt-shrinker.h"
+#include "opt-stats.h"
+#if OPT_STATS
+#include <vmstats.h>
+#endif
+#if OPT_SHAREDTEXT
+#include <pcache.h>
+#endif
+#if OPT_MMAP
+#include <mmap.h>
+#endif
+#if OPT_SHRINKER
+#include <shrinker.h>
+#endif
 
 vaddr_t firstfree; /* first free virtual address; set by start.S */
 
 struct spinlock cm_spinlock = SPINLOCK_INITIALIZER;
 
 static int        coremap_find_freeframes(int npages);
+static void       coremap_release(int first);
+static void       coremap_rmap_put(struct cm_rmap *node);
 #if OPT_SWAP
+static bool       coremap_swappable(int index);
 static int        coremap_get_victim();
 static int        coremap_swapout(int npages);
+static bool       coremap_needs_write(int index);
+static int        coremap_get_cluster_victim(void);
 static int        victim_index = 0;
+
+#define CM_SWAP_CLUSTER   4   /* frames written to swap by a single eviction */
+#define CM_SWAP_WINDOW    32  /* frames looked at to fill the cluster */
+#endif
+#if OPT_MADVISE
+static void       coremap_clear_cold(int index);
+static unsigned   cm_ncold = 0;     /* frames with cm_cold set */
+#endif
+#if OPT_SWAP && OPT_MADVISE
+static int        cold_index = 0;
+#endif
+#if OPT_SWAP && OPT_UNIFORMFILL
+static bool       coremap_page_uniform(int index, uint32_t *word);
+#endif
+#if OPT_SWAP && OPT_SHAREDTEXT
+static void       coremap_text_evict(int index);
+#endif
+#if OPT_SWAP && OPT_FORK
+static void       coremap_evict_sharers(int index);
+#endif
+#if OPT_SWAP && OPT_MMAP
+static void       coremap_file_evict(int index);
 #endif
 static int        nRamFrames = 0; /* number of ram frames */
 static struct     cm_entry *coremap;
+static struct     cm_rmap *cm_rmap_pool = NULL; /* unused rmap nodes */
+static struct     wchan *cm_pin_wchan = NULL;   /* threads waiting for a frame to be unpinned */
+static void       coremap_pin_put(int index);
 
 /**
  * @brief Initialization of the coremap, this function is called 
@@ -80,8 +137,13 @@ void coremap_bootstrap(){
   {
     coremap[i].cm_size_alloc = 0;
     coremap[i].cm_free = 0;
-    coremap[i].cm_lock = 0;
+    coremap[i].cm_pin = 0;
+    coremap[i].cm_ksm = 0;
+    coremap[i].cm_pcache = 0;
+    coremap[i].cm_cold = 0;
+    coremap[i].cm_refcount = 0;
     coremap[i].cm_ptentry = NULL;
+    coremap[i].cm_rmap = NULL;
   }
 
   /* 
@@ -138,7 +200,30 @@ coremap_find_freeframes(int npages)
 
 #if OPT_SWAP
 /**
- * @brief Find a swappable victim.
+ * @brief check whether the frame can be chosen as a victim.
+ * 
+ * Swap out only user pages. Shared frames are not considered, as
+ * their swap slot would have to be shared as well, unless they are
+ * text pages which can be dropped and reloaded from the elf, or
+ * fork is enabled, which shares swap slots among the sharers.
+ * 
+ * @param index 
+ * @return true if swappable
+ */
+static bool
+coremap_swappable(int index)
+{
+  return coremap[index].cm_ptentry != NULL && coremap[index].cm_pin == 0 &&
+#if OPT_PAGEBUSY
+         /*  a frame being filled belongs to a busy entry  */
+         !coremap[index].cm_ptentry->pt_busy &&
+#endif
+         (coremap[index].cm_refcount == 1 || coremap[index].cm_pcache || OPT_FORK);
+}
+
+/**
+ * @brief Find a swappable victim. The frames advised as not needed
+ * are taken first, if any.
  * 
  * @return index of the swappable page, -1 if not found.
  */
@@ -147,12 +232,104 @@ coremap_get_victim()
 {
   int i;
 
+#if OPT_MADVISE
+  for(i=0; cm_ncold > 0 && i<nRamFrames; i++)
+  {
+    cold_index = (cold_index + 1) % nRamFrames;
+
+    if(coremap[cold_index].cm_cold && coremap_swappable(cold_index))
+    {
+      KASSERT(coremap[cold_index].cm_free == 1);
+      KASSERT(coremap[cold_index].cm_size_alloc == 1);
+#if OPT_STATS
+      vmstats_hit(VMSTAT_MADV_COLD_EVICTED);
+#endif
+
+      return cold_index;
+    }
+  }
+#endif
+
   for(i=0; i<nRamFrames; i++)
   {
     victim_index = (victim_index + 1) % nRamFrames;
 
-    /* Swap out only user pages */
-    if(coremap[victim_index].cm_ptentry != NULL && !coremap[victim_index].cm_lock)
+    if(coremap_swappable(victim_index))
+    {
+      KASSERT(coremap[victim_index].cm_free == 1);
+      KASSERT(coremap[victim_index].cm_size_alloc == 1);
+
+      return victim_index;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * @brief check whether evicting the frame means writing it to swap,
+ * as opposed to dropping it or writing it back to its file. Shared
+ * frames are left to the single evictions.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ * @return true if the frame goes to swap
+ */
+static bool
+coremap_needs_write(int index)
+{
+#if OPT_UNIFORMFILL
+  uint32_t fill;
+#endif
+
+  if (coremap[index].cm_refcount != 1)
+  {
+    return false;
+  }
+#if OPT_SHAREDTEXT
+  if (coremap[index].cm_pcache)
+  {
+    return false;
+  }
+#endif
+#if OPT_MMAP
+  if (mmap_frame_mapped(index))
+  {
+    return false;
+  }
+#endif
+#if OPT_NOSWAP_RDONLY
+  if (coremap[index].cm_ptentry->pt_status == IN_MEMORY_RDONLY)
+  {
+    return false;
+  }
+#endif
+#if OPT_UNIFORMFILL
+  if (coremap_page_uniform(index, &fill))
+  {
+    return false;
+  }
+#endif
+  return true;
+}
+
+/**
+ * @brief find one more victim to be written in the same cluster as
+ * the current one, among the next CM_SWAP_WINDOW frames of the clock.
+ * Must be called holding cm_spinlock.
+ * 
+ * @return index of the frame, -1 if not found.
+ */
+static int
+coremap_get_cluster_victim(void)
+{
+  int i;
+
+  for (i = 0; i < CM_SWAP_WINDOW && i < nRamFrames; i++)
+  {
+    victim_index = (victim_index + 1) % nRamFrames;
+
+    if (coremap_swappable(victim_index) && coremap_needs_write(victim_index))
     {
       KASSERT(coremap[victim_index].cm_free == 1);
       KASSERT(coremap[victim_index].cm_size_alloc == 1);
@@ -164,6 +341,44 @@ coremap_get_victim()
   return -1;
 }
 
+#if OPT_SWAP && OPT_UNIFORMFILL
+/**
+ * @brief check whether the frame contains one word repeated over
+ * the whole page (typically zero for untouched stack and bss).
+ * The last and the middle words are compared first, so that most
+ * non-uniform pages are rejected without scanning them.
+ * 
+ * @param index frame index
+ * @param word filled with the repeated word if the page is uniform
+ * @return true if the page is uniform
+ */
+static bool
+coremap_page_uniform(int index, uint32_t *word)
+{
+  const uint32_t *p;
+  unsigned i;
+  const unsigned nwords = PAGE_SIZE / sizeof(uint32_t);
+
+  p = (const uint32_t *)PADDR_TO_KVADDR(index * PAGE_SIZE);
+
+  if (p[nwords - 1] != p[0] || p[nwords / 2] != p[0])
+  {
+    return false;
+  }
+
+  for (i = 1; i < nwords; i++)
+  {
+    if (p[i] != p[0])
+    {
+      return false;
+    }
+  }
+
+  *word = p[0];
+  return true;
+}
+#endif
+
 /**
  * @brief swap out pages from memory.
  * 
@@ -174,7 +389,17 @@ static int
 coremap_swapout(int npages)
 {
   int victim_index;
-  int swap_index;
+  int victims[CM_SWAP_CLUSTER];
+  paddr_t pages[CM_SWAP_CLUSTER];
+  unsigned int slots[CM_SWAP_CLUSTER];
+  unsigned int swap_index;
+  int nvictims, i, index;
+#if OPT_UNIFORMFILL
+  uint32_t fill;
+#endif
+#if OPT_PAGEBUSY
+  bool busy[CM_SWAP_CLUSTER];
+#endif
 
   if(npages > 1)
   {
@@ -187,32 +412,190 @@ coremap_swapout(int npages)
     panic("Cannot find swappable victim");
   }
 
+#if OPT_READAHEAD && OPT_STATS
+  /*  read ahead and never used  */
+  if(coremap[victim_index].cm_ptentry->pt_ra){
+    vmstats_hit(VMSTAT_RA_WASTE);
+  }
+#endif
+
+#if OPT_STRIDE && OPT_STATS
+  /*  prefetched on a stride and never used  */
+  if(coremap[victim_index].cm_ptentry->pt_pf){
+    vmstats_hit(VMSTAT_STRIDE_WASTE);
+  }
+#endif
+
+#if OPT_SHAREDTEXT
+  if(coremap[victim_index].cm_pcache){
+    coremap_text_evict(victim_index);
+    return victim_index;
+  }
+#endif
+
+#if OPT_MMAP
+  /*  pages of mapped files go back to their file, not to swap  */
+  if(mmap_frame_mapped(victim_index)){
+    coremap_file_evict(victim_index);
+    return victim_index;
+  }
+#endif
+
 #if OPT_NOSWAP_RDONLY
   if(coremap[victim_index].cm_ptentry->pt_status == IN_MEMORY_RDONLY){
     pt_set_entry(coremap[victim_index].cm_ptentry,0,0,NOT_LOADED);
+#if OPT_FORK
+    coremap_evict_sharers(victim_index);
+#endif
+    tlb_remove_by_paddr(victim_index * PAGE_SIZE);
+    return victim_index;
+  }
+#endif
+
+#if OPT_UNIFORMFILL
+  /*  a uniform page is kept in the page table entry, no I/O is needed */
+  if(coremap_page_uniform(victim_index, &fill)){
+    pt_set_fill(coremap[victim_index].cm_ptentry, fill);
+#if OPT_FORK
+    coremap_evict_sharers(victim_index);
+#endif
     tlb_remove_by_paddr(victim_index * PAGE_SIZE);
+#if OPT_STATS
+    vmstats_hit(VMSTAT_SWAP_WRITE_UNIFORM);
+#endif
     return victim_index;
   }
 #endif
 
   /**  
    * protect the coremap entry while is swapping out,
-   * as the cm_lock = 1 prevent the frame to be selected
-   * as a victim for another concurrent swap out.
+   * as a pinned frame cannot be selected as a victim
+   * for another concurrent swap out.
+   */
+  coremap[victim_index].cm_pin++;
+  victims[0] = victim_index;
+  nvictims = 1;
+
+  /**
+   * the next frames of the clock which have to be written as well
+   * go out with the victim, in a single write. They are freed, so
+   * that the next allocations find them without an eviction.
    */
-  coremap[victim_index].cm_lock = 1;
+  while (nvictims < CM_SWAP_CLUSTER)
+  {
+    index = coremap_get_cluster_victim();
+    if (index == -1)
+    {
+      break;
+    }
+#if OPT_READAHEAD && OPT_STATS
+    if(coremap[index].cm_ptentry->pt_ra){
+      vmstats_hit(VMSTAT_RA_WASTE);
+    }
+#endif
+#if OPT_STRIDE && OPT_STATS
+    if(coremap[index].cm_ptentry->pt_pf){
+      vmstats_hit(VMSTAT_STRIDE_WASTE);
+    }
+#endif
+    coremap[index].cm_pin++;
+    victims[nvictims++] = index;
+  }
+
+  for (i = 0; i < nvictims; i++)
+  {
+    pages[i] = victims[i] * PAGE_SIZE;
+#if OPT_PAGEBUSY
+    /**
+     * faults on the page wait for the write, then swap it back in.
+     * A shared frame can change owner meanwhile, its sharers keep
+     * reading it until coremap_evict_sharers.
+     */
+    busy[i] = coremap[victims[i]].cm_refcount == 1;
+    if(busy[i]){
+      coremap[victims[i]].cm_ptentry->pt_busy = 1;
+      tlb_remove_by_paddr(pages[i]);
+    }
+#endif
+  }
+
   spinlock_release(&cm_spinlock);
-  swap_index = swap_out(victim_index * PAGE_SIZE);
+  if (swap_out_cluster(pages, nvictims, &swap_index) != 0)
+  {
+    /* no run of free slots that long: one write each */
+    for (i = 0; i < nvictims; i++)
+    {
+      slots[i] = swap_out(pages[i]);
+    }
+  }
+  else
+  {
+    for (i = 0; i < nvictims; i++)
+    {
+      slots[i] = swap_index + i;
+    }
+  }
   spinlock_acquire(&cm_spinlock);
-  coremap[victim_index].cm_lock = 0;
-  
 
-  /* update the page table */
-  pt_set_entry(coremap[victim_index].cm_ptentry,0,swap_index,IN_SWAP);
-  tlb_remove_by_paddr(victim_index * PAGE_SIZE);
+  for (i = 0; i < nvictims; i++)
+  {
+    index = victims[i];
+    coremap_pin_put(index);
+
+    /* update the page table */
+    pt_set_entry(coremap[index].cm_ptentry,0,slots[i],IN_SWAP);
+#if OPT_PAGEBUSY
+    if(busy[i]){
+      pt_unbusy(coremap[index].cm_ptentry);
+    }
+#endif
+#if OPT_FORK
+    /* sharers added or gone during the write are taken into account here */
+    coremap_evict_sharers(index);
+#endif
+    tlb_remove_by_paddr(index * PAGE_SIZE);
+
+    if (i > 0)
+    {
+      coremap_release(index);
+    }
+  }
 
   return victim_index;
 }
+
+#if OPT_FORK
+/**
+ * @brief give the other entries mapping an evicted frame the new
+ * state of cm_ptentry: a swap slot gets one more reference for each
+ * of them. The frame is then owned by cm_ptentry alone.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void
+coremap_evict_sharers(int index)
+{
+  struct cm_rmap *node;
+  struct pt_entry *owner;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+  owner = coremap[index].cm_ptentry;
+  while ((node = coremap[index].cm_rmap) != NULL)
+  {
+    coremap[index].cm_rmap = node->rm_next;
+    *node->rm_ptentry = *owner;
+    if (owner->pt_status == IN_SWAP)
+    {
+      swap_dup(owner->pt_swap_index);
+    }
+    coremap_rmap_put(node);
+  }
+  coremap[index].cm_refcount = 1;
+  coremap[index].cm_ksm = 0;
+}
+#endif
 #endif
 
 /**
@@ -230,6 +613,34 @@ coremap_getppages(int npages, struct pt_entry *ptentry)
 
   spinlock_acquire(&cm_spinlock);
   beginning = coremap_find_freeframes(npages);
+#if OPT_SHRINKER
+  /**
+   * a kernel allocation first takes back the memory kept by the
+   * kernel caches. The shrinkers free pages, so they are called
+   * without the spinlock.
+   */
+  if (beginning == -1 && ptentry == NULL)
+  {
+    spinlock_release(&cm_spinlock);
+    shrinker_run(npages);
+    spinlock_acquire(&cm_spinlock);
+    beginning = coremap_find_freeframes(npages);
+  }
+#endif
+#if OPT_PTSWAP
+  /**
+   * page table leaves whose pages are all out of memory are
+   * reclaimed before evicting user pages.
+   */
+  if (beginning == -1 && npages == 1)
+  {
+    beginning = pt_reclaim() / PAGE_SIZE;
+    if (beginning == 0)
+    {
+      beginning = -1;
+    }
+  }
+#endif
   if (beginning == -1)
   {
 #if OPT_SWAP
@@ -252,37 +663,949 @@ coremap_getppages(int npages, struct pt_entry *ptentry)
   for (i = 0; i < npages; i++)
   {
     coremap[beginning + i].cm_free = 1;
+    coremap[beginning + i].cm_ksm = 0;
+    coremap[beginning + i].cm_pcache = 0;
+#if OPT_MADVISE
+    coremap_clear_cold(beginning + i);
+#endif
+    coremap[beginning + i].cm_refcount = 1;
     coremap[beginning + i].cm_ptentry = ptentry;
+    coremap[beginning + i].cm_rmap = NULL;
   }
   spinlock_release(&cm_spinlock);
   return beginning * PAGE_SIZE;
 }
 
 /**
- * @brief free the allocated pages starting from addr. Sets the used bit to 0.
+ * @brief mark the frames of the allocation starting at first as free.
+ * Must be called holding cm_spinlock.
  * 
- * @param addr 
+ * @param first 
  */
-void coremap_freeppages(paddr_t addr)
+static void
+coremap_release(int first)
 {
   long i;
-  long first;
   long allocSize;
 
-  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(nRamFrames > first);
 
-  first = addr / PAGE_SIZE;
   allocSize = coremap[first].cm_size_alloc;
-  coremap[first].cm_size_alloc = 0;
-
-  KASSERT(nRamFrames > first);
   KASSERT(allocSize > 0);
+  coremap[first].cm_size_alloc = 0;
 
-  spinlock_acquire(&cm_spinlock);
   for (i = 0; i < allocSize; i++)
   {
     KASSERT(coremap[first + i].cm_free == 1);
+    KASSERT(coremap[first + i].cm_rmap == NULL);
+#if OPT_SHAREDTEXT
+    if (coremap[first + i].cm_pcache)
+    {
+      pcache_remove(first + i);
+      coremap[first + i].cm_pcache = 0;
+    }
+#endif
+#if OPT_MMAP
+    mmap_frame_clear(first + i);
+#endif
+#if OPT_MADVISE
+    coremap_clear_cold(first + i);
+#endif
     coremap[first + i].cm_free = 0;
+    coremap[first + i].cm_ksm = 0;
+    coremap[first + i].cm_refcount = 0;
+    coremap[first + i].cm_ptentry = NULL;
   }
+}
+
+/**
+ * @brief free the allocated pages starting from addr. Sets the used bit to 0.
+ * 
+ * @param addr 
+ */
+void coremap_freeppages(paddr_t addr)
+{
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  spinlock_acquire(&cm_spinlock);
+  coremap_release(addr / PAGE_SIZE);
   spinlock_release(&cm_spinlock);
 }
+
+/**
+ * @brief number of page table entries mapping the frame.
+ * 
+ * @param addr 
+ * @return unsigned 
+ */
+unsigned coremap_refcount(paddr_t addr)
+{
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(addr / PAGE_SIZE < (paddr_t)nRamFrames);
+
+  return coremap[addr / PAGE_SIZE].cm_refcount;
+}
+
+/**
+ * @brief remove ptentry from the entries mapping a shared frame. If
+ * a single entry is left, it is no longer copy-on-write.
+ * Must be called holding cm_spinlock, on a frame with more than one
+ * reference. The returned rmap node is no longer used and has to be
+ * freed by the caller once the spinlock has been released.
+ * 
+ * @param addr 
+ * @param ptentry 
+ * @return struct cm_rmap* node to be freed
+ */
+struct cm_rmap *
+coremap_unshare(paddr_t addr, struct pt_entry *ptentry)
+{
+  struct cm_entry *cme;
+  struct cm_rmap *node, **prev;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  cme = &coremap[addr / PAGE_SIZE];
+  KASSERT(cme->cm_refcount > 1);
+  KASSERT(cme->cm_rmap != NULL);
+
+  if (cme->cm_ptentry == ptentry)
+  {
+    /* promote the first other sharer */
+    node = cme->cm_rmap;
+    cme->cm_ptentry = node->rm_ptentry;
+    cme->cm_rmap = node->rm_next;
+  }
+  else
+  {
+    for (prev = &cme->cm_rmap; *prev != NULL; prev = &(*prev)->rm_next)
+    {
+      if ((*prev)->rm_ptentry == ptentry)
+      {
+        break;
+      }
+    }
+    KASSERT(*prev != NULL);
+    node = *prev;
+    *prev = node->rm_next;
+  }
+
+  cme->cm_refcount--;
+  /*
+   * the last sharer owns the frame again. Its TLB entry may still be
+   * read-only: its next write takes a VM_FAULT_READONLY with pt_cow
+   * clear, and vm_fault replaces the entry with a writable one.
+   */
+  if (cme->cm_refcount == 1)
+  {
+    cme->cm_ptentry->pt_cow = 0;
+  }
+#if OPT_SHAREDTEXT
+  if (cme->cm_pcache)
+  {
+    pcache_unshared(1);
+  }
+#endif
+  return node;
+}
+
+/**
+ * @brief hand a frame allocated as a kernel page over to ptentry.
+ * Used to fill a user frame before it can be chosen as a victim.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ * @param ptentry 
+ */
+void coremap_set_ptentry(paddr_t addr, struct pt_entry *ptentry)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_free == 1);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_size_alloc == 1);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_refcount == 1);
+
+  coremap[addr / PAGE_SIZE].cm_ptentry = ptentry;
+}
+
+/**
+ * @brief drop the reference of ptentry to the user frame at addr,
+ * freeing the frame if it was the last one.
+ * 
+ * @param addr 
+ * @param ptentry 
+ */
+void coremap_put_upage(paddr_t addr, struct pt_entry *ptentry)
+{
+  struct cm_rmap *node = NULL;
+
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  spinlock_acquire(&cm_spinlock);
+  if (coremap[addr / PAGE_SIZE].cm_refcount > 1)
+  {
+    node = coremap_unshare(addr, ptentry);
+  }
+  else
+  {
+    KASSERT(coremap[addr / PAGE_SIZE].cm_ptentry == ptentry);
+    coremap_release(addr / PAGE_SIZE);
+  }
+  spinlock_release(&cm_spinlock);
+
+  if (node != NULL)
+  {
+    kfree(node);
+  }
+}
+
+#if OPT_FASTEXIT
+/**
+ * @brief same as coremap_put_upage, for a caller releasing many
+ * frames under a single acquisition of cm_spinlock. The rmap node of
+ * a shared frame goes back to the pool, as kfree cannot be called
+ * here. Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ * @param ptentry 
+ */
+void coremap_drop_upage(paddr_t addr, struct pt_entry *ptentry)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  if (coremap[addr / PAGE_SIZE].cm_refcount > 1)
+  {
+    coremap_rmap_put(coremap_unshare(addr, ptentry));
+  }
+  else
+  {
+    KASSERT(coremap[addr / PAGE_SIZE].cm_ptentry == ptentry);
+    coremap_release(addr / PAGE_SIZE);
+  }
+}
+#endif
+
+#if OPT_PIN
+/**
+ * @brief add a pin to a user frame: until it is unpinned, the frame
+ * is neither chosen as a victim nor merged, so the kernel can access
+ * it through its kernel address. Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ */
+void coremap_pin(paddr_t addr)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_ptentry != NULL);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_pin < 0xff);
+
+  coremap[addr / PAGE_SIZE].cm_pin++;
+}
+
+/**
+ * @brief drop a pin added by coremap_pin.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ */
+void coremap_unpin(paddr_t addr)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(coremap[addr / PAGE_SIZE].cm_pin > 0);
+
+  coremap_pin_put(addr / PAGE_SIZE);
+}
+#endif
+
+/**
+ * @brief create the wait channel of the pinned frames. It is done
+ * apart from coremap_bootstrap, which runs before kmalloc is usable.
+ */
+void coremap_pin_bootstrap(void)
+{
+  cm_pin_wchan = wchan_create("cm_pin");
+  if (cm_pin_wchan == NULL)
+  {
+    panic("coremap: cannot create the pin wait channel\n");
+  }
+}
+
+/**
+ * @brief drop a pin of a frame and, if it was the last one, wake up
+ * the threads waiting in coremap_wait_unpinned.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void coremap_pin_put(int index)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(coremap[index].cm_pin > 0);
+
+  coremap[index].cm_pin--;
+  if (coremap[index].cm_pin == 0 && cm_pin_wchan != NULL)
+  {
+    wchan_wakeall(cm_pin_wchan, &cm_spinlock);
+  }
+}
+
+/**
+ * @brief wait until a user frame is not pinned anymore, that is until
+ * it is not being swapped out, written back to its file or accessed by
+ * the kernel. The caller must look at its page table entry again if
+ * the thread had to wait, as the page may have been moved meanwhile.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ * @return true if the thread had to wait
+ */
+bool coremap_wait_unpinned(paddr_t addr)
+{
+  bool waited = false;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(cm_pin_wchan != NULL);
+
+  while (coremap[addr / PAGE_SIZE].cm_pin > 0)
+  {
+    wchan_sleep(cm_pin_wchan, &cm_spinlock);
+    waited = true;
+  }
+
+  return waited;
+}
+
+/**
+ * @brief number of frames of the coremap.
+ * 
+ * @return int 
+ */
+int coremap_nframes(void)
+{
+  return nRamFrames;
+}
+
+/**
+ * @brief get an unused rmap node, from the pool if possible.
+ * 
+ * @return struct cm_rmap*, NULL if out of memory
+ */
+struct cm_rmap *coremap_rmap_alloc(void)
+{
+  struct cm_rmap *node;
+
+  spinlock_acquire(&cm_spinlock);
+  node = cm_rmap_pool;
+  if (node != NULL)
+  {
+    cm_rmap_pool = node->rm_next;
+  }
+  spinlock_release(&cm_spinlock);
+
+  if (node == NULL)
+  {
+    node = kmalloc(sizeof(struct cm_rmap));
+  }
+  return node;
+}
+
+/**
+ * @brief put an rmap node in the pool. Nodes released while holding
+ * cm_spinlock go through here, as kfree may need the coremap.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param node 
+ */
+static void
+coremap_rmap_put(struct cm_rmap *node)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+  node->rm_next = cm_rmap_pool;
+  cm_rmap_pool = node;
+}
+
+/**
+ * @brief give back a node obtained by coremap_rmap_alloc and not used.
+ * 
+ * @param node 
+ */
+void coremap_rmap_free(struct cm_rmap *node)
+{
+  KASSERT(node != NULL);
+
+  spinlock_acquire(&cm_spinlock);
+  coremap_rmap_put(node);
+  spinlock_release(&cm_spinlock);
+}
+
+#if OPT_SHRINKER
+/**
+ * @brief shrinker of the pool of rmap nodes: all of them are given
+ * back to kmalloc. The pages they free are counted by the kmalloc
+ * shrinker, or by nobody if kfree releases them at once.
+ * 
+ * @param npages 
+ * @return unsigned 0
+ */
+unsigned coremap_shrink(unsigned npages)
+{
+  struct cm_rmap *pool, *node;
+
+  (void)npages;
+
+  spinlock_acquire(&cm_spinlock);
+  pool = cm_rmap_pool;
+  cm_rmap_pool = NULL;
+  spinlock_release(&cm_spinlock);
+
+  while (pool != NULL)
+  {
+    node = pool;
+    pool = node->rm_next;
+    kfree(node);
+  }
+
+  return 0;
+}
+#endif
+
+/**
+ * @brief check whether the frame is shared by a same-page merge.
+ * 
+ * @param addr 
+ * @return true if merged
+ */
+bool coremap_is_ksm(paddr_t addr)
+{
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(addr / PAGE_SIZE < (paddr_t)nRamFrames);
+
+  return coremap[addr / PAGE_SIZE].cm_ksm;
+}
+
+#if OPT_FORK
+/**
+ * @brief add ptentry, the entry of a forked address space, to the
+ * entries mapping the frame at addr. Every entry mapping the frame
+ * becomes copy-on-write; the writable TLB entries of the parent have
+ * to be dropped by the caller.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ * @param ptentry 
+ * @param node rmap node for ptentry, consumed
+ */
+void coremap_share(paddr_t addr, struct pt_entry *ptentry, struct cm_rmap *node)
+{
+  struct cm_entry *cme;
+  struct cm_rmap *rm;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+  KASSERT(node != NULL);
+
+  cme = &coremap[addr / PAGE_SIZE];
+  KASSERT(cme->cm_free == 1);
+  KASSERT(cme->cm_ptentry != NULL);
+  KASSERT(cme->cm_refcount < 0xffff);
+
+  node->rm_ptentry = ptentry;
+  node->rm_next = cme->cm_rmap;
+  cme->cm_rmap = node;
+  cme->cm_refcount++;
+
+  cme->cm_ptentry->pt_cow = 1;
+  for (rm = cme->cm_rmap; rm != NULL; rm = rm->rm_next)
+  {
+    rm->rm_ptentry->pt_cow = 1;
+  }
+
+#if OPT_SHAREDTEXT
+  if (cme->cm_pcache)
+  {
+    pcache_shared();
+  }
+#endif
+#if OPT_STATS
+  vmstats_hit(VMSTAT_COW_SHARED);
+#endif
+}
+#endif
+
+#if OPT_SHAREDTEXT
+/**
+ * @brief map the cached frame of the text page at vaddr of the
+ * executable v, if any, in ptentry.
+ * 
+ * @param v 
+ * @param vaddr 
+ * @param ptentry 
+ * @param status status to set in the entry
+ * @param node rmap node for ptentry, consumed on success
+ * @return paddr_t of the shared frame, 0 on a miss
+ */
+paddr_t coremap_text_lookup(struct vnode *v, vaddr_t vaddr, struct pt_entry *ptentry,
+                            unsigned char status, struct cm_rmap *node)
+{
+  int index;
+
+  KASSERT(node != NULL);
+
+  spinlock_acquire(&cm_spinlock);
+  index = pcache_lookup(v, vaddr);
+  if (index < 0 || coremap[index].cm_pin > 0 || coremap[index].cm_refcount == 0xffff)
+  {
+    spinlock_release(&cm_spinlock);
+    return 0;
+  }
+
+  KASSERT(coremap[index].cm_pcache);
+  node->rm_ptentry = ptentry;
+  node->rm_next = coremap[index].cm_rmap;
+  coremap[index].cm_rmap = node;
+  coremap[index].cm_refcount++;
+  pt_set_entry(ptentry, index * PAGE_SIZE, 0, status);
+  pcache_shared();
+#if OPT_STATS
+  vmstats_hit(VMSTAT_PCACHE_HIT);
+#endif
+  spinlock_release(&cm_spinlock);
+
+  return index * PAGE_SIZE;
+}
+
+/**
+ * @brief index the frame mapped by ptentry, just loaded from the
+ * executable v, as the text page at vaddr. Nothing is done if the
+ * page has been evicted meanwhile, or if another process already
+ * added the same page.
+ * 
+ * @param v 
+ * @param vaddr 
+ * @param ptentry 
+ */
+void coremap_text_insert(struct vnode *v, vaddr_t vaddr, struct pt_entry *ptentry)
+{
+  int index;
+
+  spinlock_acquire(&cm_spinlock);
+  index = ptentry->pt_frame_index;
+  if ((ptentry->pt_status == IN_MEMORY || ptentry->pt_status == IN_MEMORY_RDONLY) &&
+      coremap[index].cm_ptentry == ptentry && coremap[index].cm_refcount == 1 &&
+      !coremap[index].cm_pcache && !coremap[index].cm_ksm)
+  {
+    if (pcache_insert(v, vaddr, index))
+    {
+      coremap[index].cm_pcache = 1;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+}
+
+#if OPT_SWAP
+/**
+ * @brief evict a cached text frame, unmapping it from every sharer:
+ * the entries go back to NOT_LOADED, as the page can be reloaded
+ * from the elf. Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void
+coremap_text_evict(int index)
+{
+  struct cm_rmap *node;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(coremap[index].cm_pcache);
+
+  pcache_unshared(coremap[index].cm_refcount - 1);
+  pt_set_entry(coremap[index].cm_ptentry, 0, 0, NOT_LOADED);
+  while ((node = coremap[index].cm_rmap) != NULL)
+  {
+    coremap[index].cm_rmap = node->rm_next;
+    pt_set_entry(node->rm_ptentry, 0, 0, NOT_LOADED);
+    coremap_rmap_put(node);
+  }
+  coremap[index].cm_refcount = 1;
+
+  pcache_remove(index);
+  coremap[index].cm_pcache = 0;
+  tlb_remove_by_paddr(index * PAGE_SIZE);
+}
+#endif
+#endif
+
+#if OPT_MADVISE
+/**
+ * @brief mark the frame as not needed by its process: it is chosen as
+ * a victim before any other one. The mark is dropped when the frame
+ * is released or given to another page.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param addr 
+ */
+void coremap_set_cold(paddr_t addr)
+{
+  int index;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  index = addr / PAGE_SIZE;
+  KASSERT(coremap[index].cm_ptentry != NULL);
+
+  if (!coremap[index].cm_cold)
+  {
+    coremap[index].cm_cold = 1;
+    cm_ncold++;
+  }
+}
+
+/**
+ * @brief drop the mark of coremap_set_cold, if any.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void
+coremap_clear_cold(int index)
+{
+  if (coremap[index].cm_cold)
+  {
+    coremap[index].cm_cold = 0;
+    KASSERT(cm_ncold > 0);
+    cm_ncold--;
+  }
+}
+#endif
+
+#if OPT_KSM
+/**
+ * @brief check whether a frame could be merged with an identical one:
+ * it must be a single user page, resident, not being swapped out.
+ * This is only a hint taken without the lock, the check is repeated
+ * by coremap_ksm_merge.
+ * 
+ * @param index 
+ * @return true if the frame is a merge candidate
+ */
+bool coremap_ksm_candidate(int index)
+{
+  struct cm_entry *cme;
+
+  KASSERT(index < nRamFrames);
+
+  cme = &coremap[index];
+#if OPT_MMAP
+  /*  a mapped page is tied to its file offset  */
+  if (mmap_frame_mapped(index))
+  {
+    return false;
+  }
+#endif
+  return cme->cm_free == 1 && cme->cm_ptentry != NULL && cme->cm_pin == 0 &&
+         !cme->cm_pcache && cme->cm_ptentry->pt_status == IN_MEMORY &&
+         cme->cm_ptentry->pt_frame_index == (unsigned)index;
+}
+
+/**
+ * @brief compare the content of two frames.
+ * 
+ * @param a 
+ * @param b 
+ * @return true if equal
+ */
+static bool
+coremap_same_content(int a, int b)
+{
+  const uint32_t *pa, *pb;
+  unsigned i;
+
+  pa = (const uint32_t *)PADDR_TO_KVADDR(a * PAGE_SIZE);
+  pb = (const uint32_t *)PADDR_TO_KVADDR(b * PAGE_SIZE);
+  for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+  {
+    if (pa[i] != pb[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief merge the frame source into the identical frame target.
+ * The page table entry of source is redirected to target, every
+ * entry mapping target becomes copy-on-write and source is freed.
+ * Writable TLB entries of both frames are dropped, so the next
+ * write faults and breaks the sharing.
+ * 
+ * @param target 
+ * @param source 
+ * @param node rmap node for the entry of source, consumed on success
+ * @return true if merged, false if the frames changed in the meantime
+ */
+bool coremap_ksm_merge(int target, int source, struct cm_rmap *node)
+{
+  struct pt_entry *src_pte;
+  struct cm_rmap *rm;
+
+  KASSERT(target != source);
+  KASSERT(node != NULL);
+
+  spinlock_acquire(&cm_spinlock);
+
+  if (!coremap_ksm_candidate(target) || !coremap_ksm_candidate(source) ||
+      coremap[source].cm_refcount != 1 ||
+      coremap[target].cm_refcount == 0xffff ||
+      !coremap_same_content(target, source))
+  {
+    spinlock_release(&cm_spinlock);
+    return false;
+  }
+
+  src_pte = coremap[source].cm_ptentry;
+  KASSERT(src_pte->pt_cow == 0);
+
+  /* every entry mapping target becomes copy-on-write */
+  coremap[target].cm_ptentry->pt_cow = 1;
+  for (rm = coremap[target].cm_rmap; rm != NULL; rm = rm->rm_next)
+  {
+    rm->rm_ptentry->pt_cow = 1;
+  }
+
+  src_pte->pt_frame_index = target;
+  src_pte->pt_cow = 1;
+
+  node->rm_ptentry = src_pte;
+  node->rm_next = coremap[target].cm_rmap;
+  coremap[target].cm_rmap = node;
+  coremap[target].cm_refcount++;
+  coremap[target].cm_ksm = 1;
+
+  coremap_release(source);
+
+  tlb_remove_by_paddr(target * PAGE_SIZE);
+  tlb_remove_by_paddr(source * PAGE_SIZE);
+
+#if OPT_STATS
+  vmstats_hit(VMSTAT_KSM_MERGE);
+#endif
+
+  spinlock_release(&cm_spinlock);
+  return true;
+}
+
+/**
+ * @brief number of frames currently saved by same-page merging.
+ * 
+ * @return unsigned 
+ */
+unsigned coremap_ksm_saved(void)
+{
+  unsigned saved = 0;
+  int i;
+
+  spinlock_acquire(&cm_spinlock);
+  for (i = 0; i < nRamFrames; i++)
+  {
+    if (coremap[i].cm_ksm && coremap[i].cm_refcount > 1)
+    {
+      saved += coremap[i].cm_refcount - 1;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+
+  return saved;
+}
+#endif
+
+#if OPT_MMAP
+/**
+ * @brief check whether the mapped frame has been written through any
+ * of the entries mapping it: after a fork, the frame of a shared
+ * mapping is mapped by the entries of both processes.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ * @return true if dirty
+ */
+static bool
+coremap_file_dirty(int index)
+{
+  struct cm_rmap *rm;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+  if (coremap[index].cm_ptentry->pt_dirty)
+  {
+    return true;
+  }
+  for (rm = coremap[index].cm_rmap; rm != NULL; rm = rm->rm_next)
+  {
+    if (rm->rm_ptentry->pt_dirty)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief mark every entry mapping the frame as clean, so that their
+ * next write faults and marks them dirty again.
+ * Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void
+coremap_file_clean(int index)
+{
+  struct cm_rmap *rm;
+
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+  coremap[index].cm_ptentry->pt_dirty = 0;
+  for (rm = coremap[index].cm_rmap; rm != NULL; rm = rm->rm_next)
+  {
+    rm->rm_ptentry->pt_dirty = 0;
+  }
+  tlb_remove_by_paddr(index * PAGE_SIZE);
+}
+
+#if OPT_FORK
+/**
+ * @brief let the entries mapping the frame of ptentry write it in
+ * place. Used by fork for the pages of a shared mapping, which
+ * pt_copy shared copy-on-write: the writes of each process must be
+ * seen by the other one.
+ * 
+ * @param ptentry 
+ */
+void coremap_file_share(struct pt_entry *ptentry)
+{
+  struct cm_rmap *rm;
+  int index;
+
+  spinlock_acquire(&cm_spinlock);
+  index = ptentry->pt_frame_index;
+  if (ptentry->pt_status == IN_MEMORY && mmap_frame_mapped(index))
+  {
+    coremap[index].cm_ptentry->pt_cow = 0;
+    for (rm = coremap[index].cm_rmap; rm != NULL; rm = rm->rm_next)
+    {
+      rm->rm_ptentry->pt_cow = 0;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+}
+#endif
+
+/**
+ * @brief account a write to the resident page of ptentry, which
+ * belongs to a file mapping: a page of a shared mapping becomes
+ * dirty, a page of a private one loses its file backing and will be
+ * swapped as an anonymous page.
+ * 
+ * @param ptentry 
+ * @param shared 
+ */
+void coremap_file_written(struct pt_entry *ptentry, bool shared)
+{
+  spinlock_acquire(&cm_spinlock);
+  if (ptentry->pt_status == IN_MEMORY)
+  {
+    ptentry->pt_dirty = 1;
+    if (!shared)
+    {
+      mmap_frame_clear(ptentry->pt_frame_index);
+    }
+  }
+  spinlock_release(&cm_spinlock);
+}
+
+/**
+ * @brief write back the page of ptentry if it has been modified
+ * through a shared mapping, by this process or by another one sharing
+ * the frame. The page stays resident and clean: its TLB entries are
+ * dropped, so that the next write marks it dirty again.
+ * 
+ * @param ptentry 
+ */
+void coremap_file_sync(struct pt_entry *ptentry)
+{
+  int index;
+
+  spinlock_acquire(&cm_spinlock);
+  index = ptentry->pt_frame_index;
+  if (ptentry->pt_status != IN_MEMORY || coremap[index].cm_pin > 0 ||
+      !mmap_frame_mapped(index) || !coremap_file_dirty(index))
+  {
+    spinlock_release(&cm_spinlock);
+    return;
+  }
+
+  coremap_file_clean(index);
+  coremap[index].cm_pin++;
+  spinlock_release(&cm_spinlock);
+
+  mmap_writeback(index);
+
+  spinlock_acquire(&cm_spinlock);
+  coremap_pin_put(index);
+#if OPT_STATS
+  vmstats_hit(VMSTAT_MMAP_WRITEBACK);
+#endif
+  spinlock_release(&cm_spinlock);
+}
+
+#if OPT_SWAP
+/**
+ * @brief evict a frame backed by a mapped file: it is written back
+ * first if it is dirty, otherwise it is simply dropped. The entries
+ * mapping it go back to NOT_LOADED, as the page can be read again
+ * from the file. Must be called holding cm_spinlock.
+ * 
+ * @param index 
+ */
+static void
+coremap_file_evict(int index)
+{
+  KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+  if (coremap_file_dirty(index))
+  {
+    /*  protected as a swap out, see coremap_swapout  */
+    coremap_file_clean(index);
+    coremap[index].cm_pin++;
+    spinlock_release(&cm_spinlock);
+    mmap_writeback(index);
+    spinlock_acquire(&cm_spinlock);
+    coremap_pin_put(index);
+#if OPT_STATS
+    vmstats_hit(VMSTAT_MMAP_WRITEBACK);
+#endif
+  }
+#if OPT_STATS
+  else
+  {
+    vmstats_hit(VMSTAT_MMAP_DROPPED);
+  }
+#endif
+
+  mmap_frame_clear(index);
+  pt_set_entry(coremap[index].cm_ptentry, 0, 0, NOT_LOADED);
+#if OPT_FORK
+  coremap_evict_sharers(index);
+#endif
+  tlb_remove_by_paddr(index * PAGE_SIZE);
+}
+#endif
+#endif
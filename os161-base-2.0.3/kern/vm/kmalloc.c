@@ -31,6 +31,17 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-vmalloc.h"
+#include "opt-cpucache.h"
+#if OPT_VMALLOC
+#include <vmalloc.h>
+#endif
+#if OPT_CPUCACHE
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#endif
 
 /*
  * Kernel malloc.
@@ -121,6 +132,12 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+#if OPT_CPUCACHE && (defined(SLOW) || defined(SLOWER) || defined(GUARDS) || defined(LABELS))
+/* The debugging modes check every block at kfree: no per-cpu caches. */
+#undef OPT_CPUCACHE
+#define OPT_CPUCACHE 0
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -160,10 +177,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. With cpucache, most subpage
+ * allocations and frees are served by per-cpu caches of free blocks
+ * and only take it to move blocks in batches; see below.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -345,6 +361,73 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+#if OPT_CPUCACHE
+/*
+ * Per-cpu caches of free blocks.
+ *
+ * Each cpu keeps, for each block size, a short list of free blocks
+ * taken off the heap pages, linked through their first word as on the
+ * pages. It is only touched by its cpu with interrupts off, so that
+ * subpage_kmalloc and kfree get and put blocks there without
+ * kmalloc_spinlock. The spinlock is taken once every CPUCACHE_BATCH
+ * blocks: an empty list is refilled with a batch from the pages, a
+ * list grown beyond CPUCACHE_MAX gives a batch back to them.
+ *
+ * The blocks belong to no cpu: a block freed on another cpu than the
+ * one that allocated it just joins the cache of the freeing cpu, at
+ * the same cost as a local free, and goes back to its page with the
+ * next flush of that cpu.
+ *
+ * Blocks sitting in a cache count as allocated for their page, which
+ * is thus not released until they are flushed.
+ */
+
+#define CPUCACHE_BATCH 8	/* blocks moved by a refill or a flush */
+#define CPUCACHE_MAX 16		/* blocks of a size kept by a cpu */
+
+struct cpucache {
+	struct freelist *cc_blocks[NSIZES];
+	unsigned cc_nblocks[NSIZES];
+
+	/* statistics */
+	unsigned cc_hits;	/* allocations served from the cache */
+	unsigned cc_misses;	/* allocations which found it empty */
+	unsigned cc_frees;	/* frees into the cache */
+	unsigned cc_flushes;	/* batches given back to the pages */
+	unsigned cc_locks;	/* acquisitions of kmalloc_spinlock */
+};
+
+static struct cpucache cpucaches[MAXCPUS];
+
+/*
+ * kfree finds the size of a block without the spinlock by the page it
+ * lies in: the block type (plus one) of every heap page, 0 for the
+ * pages which are not heap pages. The table covers the 16M limit of
+ * System/161, as kheaproots.
+ */
+#define KHEAP_MAXPAGES (16 * 1024 * 1024 / PAGE_SIZE)
+
+static uint8_t kheap_pagetypes[KHEAP_MAXPAGES];
+
+#define PAGETYPE_INDEX(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
+/*
+ * Count an acquisition of kmalloc_spinlock for the current cpu.
+ * Called holding the spinlock, hence with interrupts off.
+ */
+static
+void
+cpucache_countlock(void)
+{
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	if (CURCPU_EXISTS()) {
+		cpucaches[curcpu->c_number].cc_locks++;
+	}
+}
+#else
+#define cpucache_countlock()
+#endif /* OPT_CPUCACHE */
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -801,6 +884,10 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+#if OPT_CPUCACHE
+	struct cpucache *cc;
+	unsigned i, j, cached, allocs;
+#endif
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -811,6 +898,26 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+#if OPT_CPUCACHE
+	/* the counters of the other cpus are read on the fly */
+	kprintf("Per-cpu caches (blocks in them show as allocated):\n");
+	for (i=0; i<MAXCPUS; i++) {
+		cc = &cpucaches[i];
+		allocs = cc->cc_hits + cc->cc_misses;
+		if (allocs == 0 && cc->cc_frees == 0) {
+			continue;
+		}
+		cached = 0;
+		for (j=0; j<NSIZES; j++) {
+			cached += cc->cc_nblocks[j];
+		}
+		kprintf("cpu %u: %u allocs, %u%% hits, %u frees, "
+			"%u flushes, %u lock acquisitions, %u cached\n",
+			i, allocs, allocs ? cc->cc_hits * 100 / allocs : 0,
+			cc->cc_frees, cc->cc_flushes, cc->cc_locks, cached);
+	}
+#endif
+
 	spinlock_release(&kmalloc_spinlock);
 }
 
@@ -866,6 +973,260 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+#if OPT_CPUCACHE
+/*
+ * Move up to CPUCACHE_BATCH free blocks of type BLKTYPE from the heap
+ * pages to the cache CC. No page is added: if there is no free block
+ * left, the cache stays empty and the caller goes to subpage_kmalloc.
+ */
+static
+void
+cpucache_refill(struct cpucache *cc, unsigned blktype)
+{
+	struct pageref *pr;
+	struct freelist *fl;
+	vaddr_t prpage;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	for (pr = sizebases[blktype];
+	     pr != NULL && cc->cc_nblocks[blktype] < CPUCACHE_BATCH;
+	     pr = pr->next_samesize) {
+		prpage = PR_PAGEADDR(pr);
+		while (pr->nfree > 0 &&
+		       cc->cc_nblocks[blktype] < CPUCACHE_BATCH) {
+			KASSERT(pr->freelist_offset < PAGE_SIZE);
+			fl = (struct freelist *)(prpage + pr->freelist_offset);
+			pr->nfree--;
+			if (fl->next != NULL) {
+				pr->freelist_offset = (vaddr_t)fl->next - prpage;
+			}
+			else {
+				KASSERT(pr->nfree == 0);
+				pr->freelist_offset = INVALID_OFFSET;
+			}
+			fl->next = cc->cc_blocks[blktype];
+			cc->cc_blocks[blktype] = fl;
+			cc->cc_nblocks[blktype]++;
+		}
+	}
+}
+
+/*
+ * Give N blocks (at most CPUCACHE_BATCH) of type BLKTYPE of the cache
+ * CC back to their pages. The pages left with no block allocated are
+ * taken off the lists and stored in FREEPAGES, to be released by the
+ * caller once the spinlock is dropped; returns how many.
+ */
+static
+unsigned
+cpucache_flush(struct cpucache *cc, unsigned blktype, unsigned n,
+	       vaddr_t *freepages)
+{
+	struct pageref *pr;
+	struct freelist *fl;
+	vaddr_t prpage;
+	unsigned i, nfreepages;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(n <= CPUCACHE_BATCH);
+	KASSERT(cc->cc_nblocks[blktype] >= n);
+
+	nfreepages = 0;
+	for (i=0; i<n; i++) {
+		fl = cc->cc_blocks[blktype];
+		cc->cc_blocks[blktype] = fl->next;
+		cc->cc_nblocks[blktype]--;
+
+		prpage = (vaddr_t)fl & PAGE_FRAME;
+		for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+			if (PR_PAGEADDR(pr) == prpage) {
+				break;
+			}
+		}
+		KASSERT(pr != NULL);
+
+		if (pr->freelist_offset == INVALID_OFFSET) {
+			fl->next = NULL;
+		}
+		else {
+			fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+		}
+		pr->freelist_offset = (vaddr_t)fl - prpage;
+		pr->nfree++;
+
+		KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+		if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+			/* Whole page is free. */
+			remove_lists(pr, blktype);
+			freepageref(pr);
+			kheap_pagetypes[PAGETYPE_INDEX(prpage)] = 0;
+			freepages[nfreepages++] = prpage;
+		}
+	}
+	cc->cc_flushes++;
+
+	return nfreepages;
+}
+
+/*
+ * Take a free block of type BLKTYPE from the cache of the current cpu,
+ * refilling it if empty. Returns NULL if there is no free block on the
+ * heap pages either.
+ */
+static
+void *
+cpucache_get(unsigned blktype)
+{
+	struct cpucache *cc;
+	struct freelist *fl;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	cc = &cpucaches[curcpu->c_number];
+	if (cc->cc_blocks[blktype] == NULL) {
+		cc->cc_misses++;
+		spinlock_acquire(&kmalloc_spinlock);
+		cpucache_countlock();
+		cpucache_refill(cc, blktype);
+		spinlock_release(&kmalloc_spinlock);
+		if (cc->cc_blocks[blktype] == NULL) {
+			splx(spl);
+			return NULL;
+		}
+	}
+	else {
+		cc->cc_hits++;
+	}
+
+	fl = cc->cc_blocks[blktype];
+	cc->cc_blocks[blktype] = fl->next;
+	cc->cc_nblocks[blktype]--;
+	splx(spl);
+
+	return fl;
+}
+
+/*
+ * Put a block being freed in the cache of the current cpu, flushing a
+ * batch if it grows too long. Returns false if PTR is not on a heap
+ * page (or there is no cpu yet), for kfree to go on as without caches.
+ */
+static
+bool
+cpucache_put(void *ptr)
+{
+	struct cpucache *cc;
+	struct freelist *fl;
+	vaddr_t va, freepages[CPUCACHE_BATCH];
+	unsigned blktype, nfreepages, i;
+	int spl;
+
+	va = (vaddr_t)ptr;
+	if (!CURCPU_EXISTS() || va < MIPS_KSEG0 || va >= MIPS_KSEG1 ||
+	    PAGETYPE_INDEX(va) >= KHEAP_MAXPAGES ||
+	    kheap_pagetypes[PAGETYPE_INDEX(va)] == 0) {
+		return false;
+	}
+
+	/* the page holds an allocated block, it cannot go away meanwhile */
+	blktype = kheap_pagetypes[PAGETYPE_INDEX(va)] - 1;
+	KASSERT(blktype < NSIZES);
+	if ((va & ~PAGE_FRAME) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	nfreepages = 0;
+	spl = splhigh();
+	cc = &cpucaches[curcpu->c_number];
+	fl = ptr;
+	fl->next = cc->cc_blocks[blktype];
+	cc->cc_blocks[blktype] = fl;
+	cc->cc_nblocks[blktype]++;
+	cc->cc_frees++;
+	if (cc->cc_nblocks[blktype] > CPUCACHE_MAX) {
+		spinlock_acquire(&kmalloc_spinlock);
+		cpucache_countlock();
+		nfreepages = cpucache_flush(cc, blktype, CPUCACHE_BATCH,
+					    freepages);
+		spinlock_release(&kmalloc_spinlock);
+	}
+	splx(spl);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+
+	return true;
+}
+#endif /* OPT_CPUCACHE */
+
+/*
+ * Give back to the coremap the heap pages kept only by the blocks of
+ * the cache of the current cpu, flushing it whole. The caches of the
+ * other cpus are touched by their owners only, and are left alone.
+ * NPAGES is what the caller is short of; the cache is flushed anyway.
+ */
+unsigned
+kheap_shrink(unsigned npages)
+{
+#if OPT_CPUCACHE
+	struct cpucache *cc;
+	vaddr_t freepages[CPUCACHE_BATCH];
+	unsigned blktype, n, nfreepages, i, total;
+	int spl;
+
+	(void)npages;
+
+	if (!CURCPU_EXISTS()) {
+		return 0;
+	}
+
+	total = 0;
+	for (blktype=0; blktype<NSIZES; blktype++) {
+		do {
+			nfreepages = 0;
+			spl = splhigh();
+			cc = &cpucaches[curcpu->c_number];
+			n = cc->cc_nblocks[blktype];
+			if (n > CPUCACHE_BATCH) {
+				n = CPUCACHE_BATCH;
+			}
+			if (n > 0) {
+				spinlock_acquire(&kmalloc_spinlock);
+				cpucache_countlock();
+				nfreepages = cpucache_flush(cc, blktype, n,
+							    freepages);
+				spinlock_release(&kmalloc_spinlock);
+			}
+			splx(spl);
+
+			/* Call free_kpages without kmalloc_spinlock. */
+			for (i=0; i<nfreepages; i++) {
+				free_kpages(freepages[i]);
+			}
+			total += nfreepages;
+		} while (n > 0);
+	}
+
+	return total;
+#else
+	(void)npages;
+	return 0;
+#endif
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -907,7 +1268,15 @@ subpage_kmalloc(size_t sz
 	sz = sizes[blktype];
 #endif
 
+#if OPT_CPUCACHE
+	retptr = cpucache_get(blktype);
+	if (retptr != NULL) {
+		return retptr;
+	}
+#endif
+
 	spinlock_acquire(&kmalloc_spinlock);
+	cpucache_countlock();
 
 	checksubpages();
 
@@ -976,6 +1345,7 @@ subpage_kmalloc(size_t sz
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
+	cpucache_countlock();
 
 	pr = allocpageref();
 	if (pr==NULL) {
@@ -988,6 +1358,10 @@ subpage_kmalloc(size_t sz
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
+#if OPT_CPUCACHE
+	KASSERT(PAGETYPE_INDEX(prpage) < KHEAP_MAXPAGES);
+	kheap_pagetypes[PAGETYPE_INDEX(prpage)] = blktype + 1;
+#endif
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1062,6 +1436,7 @@ subpage_kfree(void *ptr)
 #endif
 
 	spinlock_acquire(&kmalloc_spinlock);
+	cpucache_countlock();
 
 	checksubpages();
 
@@ -1142,6 +1517,9 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+#if OPT_CPUCACHE
+		kheap_pagetypes[PAGETYPE_INDEX(prpage)] = 0;
+#endif
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1189,6 +1567,15 @@ kmalloc(size_t sz)
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+#if OPT_VMALLOC
+		/* More than a page is mapped in kseg2, from scattered frames. */
+		if (npages > 1) {
+			address = (vaddr_t)vmalloc(npages);
+			if (address != 0) {
+				return (void *)address;
+			}
+		}
+#endif
 		address = alloc_kpages(npages);
 		if (address==0) {
 			return NULL;
@@ -1216,7 +1603,18 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_VMALLOC
+	else if ((vaddr_t)ptr >= VMALLOC_BASE) {
+		vfree(ptr);
+	}
+#endif
+#if OPT_CPUCACHE
+	else if (cpucache_put(ptr)) {
+		return;
+	}
+#endif
+	else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,193 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <ksm.h>
+
+static uint32_t     *ksm_checksum;  /*  hash of each frame in the last pass  */
+static int          *ksm_next;      /*  chaining of the hash table           */
+static int          ksm_buckets[KSM_NBUCKETS];
+static unsigned     ksm_passes = 0;
+
+/**
+ * @brief hash of the content of a frame. It is read without any
+ * lock, the result is only a hint: merges compare the whole frames.
+ * 
+ * @param index 
+ * @return uint32_t 
+ */
+static uint32_t
+ksm_hash(int index)
+{
+    const uint32_t *p;
+    uint32_t h = 0;
+    unsigned i;
+
+    p = (const uint32_t *)PADDR_TO_KVADDR(index * PAGE_SIZE);
+    for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+    {
+        h = ((h << 5) | (h >> 27)) ^ p[i];
+    }
+
+    return h;
+}
+
+/**
+ * @brief look for a frame with the same hash as index among the ones
+ * already inserted, and merge them. Frames which are already shared
+ * are preferred as targets, so that a group of identical pages
+ * converges on a single frame.
+ * 
+ * @param index 
+ * @param node rmap node to be used by the merge, set to NULL if consumed
+ * @return true if index has to be inserted in the table
+ */
+static bool
+ksm_try_merge(int index, struct cm_rmap **node)
+{
+    int *j;
+    int target, source;
+    uint32_t h = ksm_checksum[index];
+
+    for (j = &ksm_buckets[h % KSM_NBUCKETS]; *j != -1; j = &ksm_next[*j])
+    {
+        if (ksm_checksum[*j] != h)
+        {
+            continue;
+        }
+
+        if (coremap_refcount(index * PAGE_SIZE) > 1)
+        {
+            target = index;
+            source = *j;
+        }
+        else
+        {
+            target = *j;
+            source = index;
+        }
+
+        if (coremap_ksm_merge(target, source, *node))
+        {
+            *node = NULL;
+            if (target == index)
+            {
+                /* index takes the place of the merged frame */
+                ksm_next[index] = ksm_next[*j];
+                *j = index;
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief one pass over the coremap.
+ */
+static void
+ksm_scan(void)
+{
+    int i, nframes;
+    uint32_t h;
+    struct cm_rmap *node = NULL;
+
+    nframes = coremap_nframes();
+    for (i = 0; i < KSM_NBUCKETS; i++)
+    {
+        ksm_buckets[i] = -1;
+    }
+
+    for (i = 0; i < nframes; i++)
+    {
+        if (!coremap_ksm_candidate(i))
+        {
+            ksm_checksum[i] = 0;
+            continue;
+        }
+
+        h = ksm_hash(i);
+        if (h != ksm_checksum[i])
+        {
+            /* still changing, wait for the next pass */
+            ksm_checksum[i] = h;
+            continue;
+        }
+
+        if (node == NULL)
+        {
+            node = kmalloc(sizeof(struct cm_rmap));
+            if (node == NULL)
+            {
+                break;
+            }
+        }
+
+        if (ksm_try_merge(i, &node))
+        {
+            ksm_next[i] = ksm_buckets[h % KSM_NBUCKETS];
+            ksm_buckets[h % KSM_NBUCKETS] = i;
+        }
+    }
+
+    if (node != NULL)
+    {
+        kfree(node);
+    }
+
+    ksm_passes++;
+}
+
+/**
+ * @brief body of the scanner thread.
+ * 
+ * @param data1 
+ * @param data2 
+ */
+static void
+ksm_thread(void *data1, unsigned long data2)
+{
+    (void)data1;
+    (void)data2;
+
+    while (1)
+    {
+        clocksleep(KSM_SLEEP_SECS);
+        ksm_scan();
+    }
+}
+
+/**
+ * @brief allocates the scanner state and starts the scanner thread.
+ */
+void ksm_bootstrap(void)
+{
+    int nframes;
+    int result;
+
+    nframes = coremap_nframes();
+    ksm_checksum = kmalloc(nframes * sizeof(uint32_t));
+    ksm_next = kmalloc(nframes * sizeof(int));
+    if (ksm_checksum == NULL || ksm_next == NULL)
+    {
+        panic("ksm: cannot allocate the scanner state\n");
+    }
+    bzero(ksm_checksum, nframes * sizeof(uint32_t));
+
+    result = thread_fork("ksm", NULL, ksm_thread, NULL, 0);
+    if (result)
+    {
+        panic("ksm: thread_fork failed: %s\n", strerror(result));
+    }
+}
+
+/**
+ * @brief print the number of frames saved by merging.
+ */
+void ksm_print_stats(void)
+{
+    kprintf("ksm: %u frames saved after %u passes\n", coremap_ksm_saved(), ksm_passes);
+}
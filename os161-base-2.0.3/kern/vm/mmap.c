@@ -0,0 +1,106 @@
+#include <types.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <mmap.h>
+#include "opt-heap.h"
+#include "opt-filetable.h"
+
+#if !OPT_HEAP || !OPT_FILETABLE
+#error "mmap requires the heap and filetable options"
+#endif
+
+/*
+ * The backing of every frame is kept in arrays indexed by frame, as
+ * the page cache does, thus no allocation is needed at fault time.
+ */
+static struct vnode **mm_vnode;     /*  file of the frame, NULL if anonymous    */
+static off_t        *mm_offset;     /*  offset of the page within the file      */
+static size_t       *mm_size;       /*  bytes of the page backed by the file    */
+
+/**
+ * @brief allocates the per frame arrays.
+ */
+void mmap_bootstrap(void)
+{
+    int nframes;
+
+    nframes = coremap_nframes();
+    mm_vnode = kmalloc(nframes * sizeof(struct vnode *));
+    mm_offset = kmalloc(nframes * sizeof(off_t));
+    mm_size = kmalloc(nframes * sizeof(size_t));
+    if (mm_vnode == NULL || mm_offset == NULL || mm_size == NULL)
+    {
+        panic("mmap: cannot allocate the frame backing\n");
+    }
+
+    bzero(mm_vnode, nframes * sizeof(struct vnode *));
+}
+
+/**
+ * @brief record that the frame holds size bytes of v at offset.
+ * 
+ * @param index 
+ * @param v 
+ * @param offset page aligned
+ * @param size at most PAGE_SIZE
+ */
+void mmap_frame_set(int index, struct vnode *v, off_t offset, size_t size)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+    KASSERT(offset % PAGE_SIZE == 0);
+    KASSERT(size > 0 && size <= PAGE_SIZE);
+
+    mm_vnode[index] = v;
+    mm_offset[index] = offset;
+    mm_size[index] = size;
+}
+
+/**
+ * @brief make the frame anonymous.
+ * 
+ * @param index 
+ */
+void mmap_frame_clear(int index)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    mm_vnode[index] = NULL;
+}
+
+/**
+ * @brief check whether the frame is backed by a mapped file.
+ * 
+ * @param index 
+ * @return true if the frame can be dropped or written back
+ */
+bool mmap_frame_mapped(int index)
+{
+    return mm_vnode[index] != NULL;
+}
+
+/**
+ * @brief write the frame back to its file. Errors are reported and
+ * otherwise ignored, as nobody is left to handle them.
+ * 
+ * @param index 
+ */
+void mmap_writeback(int index)
+{
+    struct iovec iov;
+    struct uio ku;
+    int result;
+
+    KASSERT(mm_vnode[index] != NULL);
+
+    uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(index * PAGE_SIZE), mm_size[index],
+              mm_offset[index], UIO_WRITE);
+    result = VOP_WRITE(mm_vnode[index], &ku);
+    if (result || ku.uio_resid != 0)
+    {
+        kprintf("mmap: write back of frame %d failed (%d)\n", index, result);
+    }
+}
@@ -0,0 +1,649 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <objcache.h>
+
+/*
+ * Header of a slab, at the start of its page. The free objects of the
+ * slab are linked through a word placed after each of them, so that
+ * the link never overwrites their constructed state.
+ */
+struct objslab {
+    struct objcache *os_cache;
+    struct objslab  *os_next;       /*  in oc_partial or oc_full  */
+    struct objslab  *os_prev;
+    void            *os_free;       /*  first free object  */
+    unsigned        os_inuse;
+};
+
+#define OBJSLAB_HEADER      ROUNDUP(sizeof(struct objslab), 8)
+#define OBJCACHE_EMPTY      1       /*  empty slabs kept by a cache  */
+
+#define OBJ_LINK(oc, obj)   (*(void **)((char *)(obj) + (oc)->oc_link))
+
+struct objcache {
+    char            *oc_name;
+    size_t          oc_size;        /*  asked by the creator  */
+    size_t          oc_link;        /*  offset of the free link in an object  */
+    size_t          oc_stride;      /*  distance between the objects of a slab  */
+    unsigned        oc_perslab;     /*  0 for the large objects  */
+    int             (*oc_ctor)(void *obj);
+    void            (*oc_dtor)(void *obj);
+    struct spinlock oc_lock;
+    struct objslab  *oc_partial;    /*  slabs with free objects  */
+    struct objslab  *oc_full;
+    unsigned        oc_nempty;      /*  slabs of oc_partial with no object in use  */
+    void            *oc_depot[OBJCACHE_DEPOT];  /*  free large objects  */
+    unsigned        oc_ndepot;
+    struct objcache *oc_next;       /*  in objcache_list  */
+#if OPT_SHRINKER
+    unsigned        oc_shrunk;      /*  last run of objcache_shrink done on it  */
+    bool            oc_shrinking;   /*  shrunk without objcache_listlock  */
+    bool            oc_dead;        /*  destroyed meanwhile, freed by the shrinker  */
+#endif
+    /*  stats  */
+    unsigned        oc_allocs;
+    unsigned        oc_frees;
+    unsigned        oc_ctors;
+    unsigned        oc_dtors;
+    unsigned        oc_slabs;       /*  held now, a large object counts as one  */
+    unsigned        oc_inuse;
+    unsigned        oc_peak;
+};
+
+static struct objcache  *objcache_list = NULL;
+static struct spinlock  objcache_listlock = SPINLOCK_INITIALIZER;
+#if OPT_SHRINKER
+static unsigned         objcache_shrinks = 0;   /*  runs of objcache_shrink  */
+#endif
+
+static void
+objslab_insert(struct objslab **list, struct objslab *slab)
+{
+    slab->os_prev = NULL;
+    slab->os_next = *list;
+    if (*list != NULL)
+    {
+        (*list)->os_prev = slab;
+    }
+    *list = slab;
+}
+
+static void
+objslab_remove(struct objslab **list, struct objslab *slab)
+{
+    if (slab->os_prev != NULL)
+    {
+        slab->os_prev->os_next = slab->os_next;
+    }
+    else
+    {
+        KASSERT(*list == slab);
+        *list = slab->os_next;
+    }
+    if (slab->os_next != NULL)
+    {
+        slab->os_next->os_prev = slab->os_prev;
+    }
+    slab->os_next = slab->os_prev = NULL;
+}
+
+/**
+ * @brief create a cache of objects of the given size. The constructor
+ * returns 0 or an error, in which case the allocation fails; both
+ * functions may be NULL.
+ *
+ * @param name
+ * @param size
+ * @param ctor
+ * @param dtor
+ * @return struct objcache* NULL if out of memory
+ */
+struct objcache *
+objcache_create(const char *name, size_t size,
+                int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+    struct objcache *oc;
+
+    KASSERT(size > 0);
+
+    oc = kmalloc(sizeof(struct objcache));
+    if (oc == NULL)
+    {
+        return NULL;
+    }
+    oc->oc_name = kstrdup(name);
+    if (oc->oc_name == NULL)
+    {
+        kfree(oc);
+        return NULL;
+    }
+
+    oc->oc_size = size;
+    oc->oc_link = ROUNDUP(size, sizeof(void *));
+    oc->oc_stride = ROUNDUP(oc->oc_link + sizeof(void *), 8);
+    oc->oc_perslab = (PAGE_SIZE - OBJSLAB_HEADER) / oc->oc_stride;
+    if (oc->oc_perslab < 2)
+    {
+        /*  a slab of a single object would only add its header  */
+        oc->oc_perslab = 0;
+    }
+    oc->oc_ctor = ctor;
+    oc->oc_dtor = dtor;
+    spinlock_init(&oc->oc_lock);
+    oc->oc_partial = NULL;
+    oc->oc_full = NULL;
+    oc->oc_nempty = 0;
+    oc->oc_ndepot = 0;
+    oc->oc_allocs = 0;
+    oc->oc_frees = 0;
+    oc->oc_ctors = 0;
+    oc->oc_dtors = 0;
+    oc->oc_slabs = 0;
+    oc->oc_inuse = 0;
+    oc->oc_peak = 0;
+#if OPT_SHRINKER
+    oc->oc_shrunk = 0;
+    oc->oc_shrinking = false;
+    oc->oc_dead = false;
+#endif
+
+    spinlock_acquire(&objcache_listlock);
+    oc->oc_next = objcache_list;
+    objcache_list = oc;
+    spinlock_release(&objcache_listlock);
+
+    return oc;
+}
+
+/**
+ * @brief carve a new slab and construct all its objects. Called
+ * without the cache lock, as it takes a page.
+ *
+ * @param oc
+ * @return struct objslab* NULL if out of memory or a constructor failed
+ */
+static struct objslab *
+objslab_create(struct objcache *oc)
+{
+    struct objslab *slab;
+    char *obj;
+    void *next;
+    unsigned i;
+
+    slab = (struct objslab *)alloc_kpages(1);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    slab->os_cache = oc;
+    slab->os_next = slab->os_prev = NULL;
+    slab->os_free = NULL;
+    slab->os_inuse = 0;
+
+    /*  backwards, so that the objects are handed out in address order  */
+    for (i = oc->oc_perslab; i-- > 0; )
+    {
+        obj = (char *)slab + OBJSLAB_HEADER + i * oc->oc_stride;
+        if (oc->oc_ctor != NULL && oc->oc_ctor(obj) != 0)
+        {
+            for (obj = slab->os_free; obj != NULL; obj = next)
+            {
+                next = OBJ_LINK(oc, obj);
+                if (oc->oc_dtor != NULL)
+                {
+                    oc->oc_dtor(obj);
+                }
+            }
+            free_kpages((vaddr_t)slab);
+            return NULL;
+        }
+        OBJ_LINK(oc, obj) = slab->os_free;
+        slab->os_free = obj;
+    }
+
+    return slab;
+}
+
+/**
+ * @brief destroy the objects of an empty slab and give its page back.
+ * Called without the cache lock.
+ *
+ * @param oc
+ * @param slab
+ */
+static void
+objslab_destroy(struct objcache *oc, struct objslab *slab)
+{
+    void *obj, *next;
+
+    KASSERT(slab->os_inuse == 0);
+
+    if (oc->oc_dtor != NULL)
+    {
+        for (obj = slab->os_free; obj != NULL; obj = next)
+        {
+            next = OBJ_LINK(oc, obj);
+            oc->oc_dtor(obj);
+        }
+    }
+    free_kpages((vaddr_t)slab);
+}
+
+/**
+ * @brief take a large object from the depot, or from kmalloc and
+ * construct it.
+ *
+ * @param oc
+ * @return void*
+ */
+static void *
+objcache_alloc_large(struct objcache *oc)
+{
+    void *obj;
+
+    spinlock_acquire(&oc->oc_lock);
+    if (oc->oc_ndepot > 0)
+    {
+        obj = oc->oc_depot[--oc->oc_ndepot];
+    }
+    else
+    {
+        spinlock_release(&oc->oc_lock);
+
+        obj = kmalloc(oc->oc_size);
+        if (obj == NULL)
+        {
+            return NULL;
+        }
+        if (oc->oc_ctor != NULL && oc->oc_ctor(obj) != 0)
+        {
+            kfree(obj);
+            return NULL;
+        }
+
+        spinlock_acquire(&oc->oc_lock);
+        oc->oc_slabs++;
+        oc->oc_ctors++;
+    }
+    oc->oc_allocs++;
+    oc->oc_inuse++;
+    if (oc->oc_inuse > oc->oc_peak)
+    {
+        oc->oc_peak = oc->oc_inuse;
+    }
+    spinlock_release(&oc->oc_lock);
+
+    return obj;
+}
+
+/**
+ * @brief put a large object in the depot, or destroy it if the depot
+ * is full.
+ *
+ * @param oc
+ * @param obj
+ */
+static void
+objcache_free_large(struct objcache *oc, void *obj)
+{
+    spinlock_acquire(&oc->oc_lock);
+    KASSERT(oc->oc_inuse > 0);
+    oc->oc_frees++;
+    oc->oc_inuse--;
+    if (oc->oc_ndepot < OBJCACHE_DEPOT)
+    {
+        oc->oc_depot[oc->oc_ndepot++] = obj;
+        spinlock_release(&oc->oc_lock);
+        return;
+    }
+    oc->oc_slabs--;
+    oc->oc_dtors++;
+    spinlock_release(&oc->oc_lock);
+
+    if (oc->oc_dtor != NULL)
+    {
+        oc->oc_dtor(obj);
+    }
+    kfree(obj);
+}
+
+/**
+ * @brief allocate a constructed object from the cache. May sleep.
+ *
+ * @param oc
+ * @return void* NULL if out of memory
+ */
+void *
+objcache_alloc(struct objcache *oc)
+{
+    struct objslab *slab;
+    void *obj;
+
+    KASSERT(oc != NULL);
+
+    if (oc->oc_perslab == 0)
+    {
+        return objcache_alloc_large(oc);
+    }
+
+    spinlock_acquire(&oc->oc_lock);
+    if (oc->oc_partial == NULL)
+    {
+        spinlock_release(&oc->oc_lock);
+        slab = objslab_create(oc);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+        spinlock_acquire(&oc->oc_lock);
+        objslab_insert(&oc->oc_partial, slab);
+        oc->oc_nempty++;
+        oc->oc_slabs++;
+        oc->oc_ctors += oc->oc_perslab;
+    }
+
+    slab = oc->oc_partial;
+    obj = slab->os_free;
+    KASSERT(obj != NULL);
+    slab->os_free = OBJ_LINK(oc, obj);
+    if (slab->os_inuse == 0)
+    {
+        oc->oc_nempty--;
+    }
+    slab->os_inuse++;
+    if (slab->os_free == NULL)
+    {
+        objslab_remove(&oc->oc_partial, slab);
+        objslab_insert(&oc->oc_full, slab);
+    }
+
+    oc->oc_allocs++;
+    oc->oc_inuse++;
+    if (oc->oc_inuse > oc->oc_peak)
+    {
+        oc->oc_peak = oc->oc_inuse;
+    }
+    spinlock_release(&oc->oc_lock);
+
+    return obj;
+}
+
+/**
+ * @brief give an object back to its cache, in its constructed state.
+ * Once all the objects of a slab are free, the slab is kept if it is
+ * the only empty one of the cache, destroyed otherwise.
+ *
+ * @param oc
+ * @param obj
+ */
+void
+objcache_free(struct objcache *oc, void *obj)
+{
+    struct objslab *slab;
+
+    KASSERT(oc != NULL);
+    KASSERT(obj != NULL);
+
+    if (oc->oc_perslab == 0)
+    {
+        objcache_free_large(oc, obj);
+        return;
+    }
+
+    slab = (struct objslab *)((vaddr_t)obj & PAGE_FRAME);
+    KASSERT(slab->os_cache == oc);
+
+    spinlock_acquire(&oc->oc_lock);
+    KASSERT(slab->os_inuse > 0);
+    if (slab->os_free == NULL)
+    {
+        objslab_remove(&oc->oc_full, slab);
+        objslab_insert(&oc->oc_partial, slab);
+    }
+    OBJ_LINK(oc, obj) = slab->os_free;
+    slab->os_free = obj;
+    slab->os_inuse--;
+    oc->oc_frees++;
+    oc->oc_inuse--;
+
+    if (slab->os_inuse == 0)
+    {
+        if (oc->oc_nempty >= OBJCACHE_EMPTY)
+        {
+            objslab_remove(&oc->oc_partial, slab);
+            oc->oc_slabs--;
+            oc->oc_dtors += oc->oc_perslab;
+            spinlock_release(&oc->oc_lock);
+            objslab_destroy(oc, slab);
+            return;
+        }
+        oc->oc_nempty++;
+    }
+    spinlock_release(&oc->oc_lock);
+}
+
+/**
+ * @brief give back the slabs and the depot of a cache removed from
+ * objcache_list, then the cache itself.
+ *
+ * @param oc
+ */
+static void
+objcache_release(struct objcache *oc)
+{
+    struct objslab *slab;
+
+    while ((slab = oc->oc_partial) != NULL)
+    {
+        objslab_remove(&oc->oc_partial, slab);
+        objslab_destroy(oc, slab);
+    }
+    while (oc->oc_ndepot > 0)
+    {
+        oc->oc_ndepot--;
+        if (oc->oc_dtor != NULL)
+        {
+            oc->oc_dtor(oc->oc_depot[oc->oc_ndepot]);
+        }
+        kfree(oc->oc_depot[oc->oc_ndepot]);
+    }
+
+    spinlock_cleanup(&oc->oc_lock);
+    kfree(oc->oc_name);
+    kfree(oc);
+}
+
+/**
+ * @brief destroy a cache, whose objects must all have been freed.
+ * If the shrinker is working on it, the shrinker frees it when done.
+ *
+ * @param oc
+ */
+void
+objcache_destroy(struct objcache *oc)
+{
+    struct objcache **p;
+
+    KASSERT(oc != NULL);
+    KASSERT(oc->oc_inuse == 0);
+    KASSERT(oc->oc_full == NULL);
+
+    spinlock_acquire(&objcache_listlock);
+    for (p = &objcache_list; *p != oc; p = &(*p)->oc_next)
+    {
+        KASSERT(*p != NULL);
+    }
+    *p = oc->oc_next;
+#if OPT_SHRINKER
+    if (oc->oc_shrinking)
+    {
+        oc->oc_dead = true;
+        spinlock_release(&objcache_listlock);
+        return;
+    }
+#endif
+    spinlock_release(&objcache_listlock);
+
+    objcache_release(oc);
+}
+
+/**
+ * @brief bytes kmalloc would take for an object of the given size:
+ * the smallest subpage class holding it, or whole pages.
+ *
+ * @param size
+ * @return size_t
+ */
+static size_t
+objcache_kmalloc_size(size_t size)
+{
+    size_t class;
+
+    if (size >= PAGE_SIZE / 2)
+    {
+        return ROUNDUP(size, PAGE_SIZE);
+    }
+    for (class = 16; class < size; class *= 2);
+    return class;
+}
+
+#if OPT_SHRINKER
+/**
+ * @brief shrinker of the caches: destroy their empty slabs and the
+ * large objects of their depots. The objects in use are not touched,
+ * so every cache is emptied whatever npages asks for. The caches are
+ * taken one at a time, and their objects destroyed without
+ * objcache_listlock: the list is looked at again from its head after
+ * each of them, for a cache not done yet in this run.
+ *
+ * @param npages
+ * @return unsigned pages given back to the coremap. A large object
+ * counts only if kmalloc gave it whole pages
+ */
+unsigned
+objcache_shrink(unsigned npages)
+{
+    struct objcache *oc;
+    struct objslab *slab, *next, *empty;
+    void *depot[OBJCACHE_DEPOT];
+    unsigned ndepot, i, freed, run;
+
+    (void)npages;
+
+    freed = 0;
+    spinlock_acquire(&objcache_listlock);
+    run = ++objcache_shrinks;
+    for (;;)
+    {
+        for (oc = objcache_list; oc != NULL; oc = oc->oc_next)
+        {
+            if (oc->oc_shrunk != run && !oc->oc_shrinking)
+            {
+                break;
+            }
+        }
+        if (oc == NULL)
+        {
+            break;
+        }
+        oc->oc_shrunk = run;
+        oc->oc_shrinking = true;
+
+        empty = NULL;
+        spinlock_acquire(&oc->oc_lock);
+        for (slab = oc->oc_partial; slab != NULL; slab = next)
+        {
+            next = slab->os_next;
+            if (slab->os_inuse == 0)
+            {
+                objslab_remove(&oc->oc_partial, slab);
+                slab->os_next = empty;
+                empty = slab;
+                oc->oc_nempty--;
+                oc->oc_slabs--;
+                oc->oc_dtors += oc->oc_perslab;
+            }
+        }
+        ndepot = oc->oc_ndepot;
+        for (i = 0; i < ndepot; i++)
+        {
+            depot[i] = oc->oc_depot[i];
+        }
+        oc->oc_ndepot = 0;
+        oc->oc_slabs -= ndepot;
+        oc->oc_dtors += ndepot;
+        spinlock_release(&oc->oc_lock);
+        spinlock_release(&objcache_listlock);
+
+        /*  oc_shrinking keeps objcache_destroy from freeing the cache  */
+        for (slab = empty; slab != NULL; slab = next)
+        {
+            next = slab->os_next;
+            objslab_destroy(oc, slab);
+            freed++;
+        }
+        for (i = 0; i < ndepot; i++)
+        {
+            if (oc->oc_dtor != NULL)
+            {
+                oc->oc_dtor(depot[i]);
+            }
+            kfree(depot[i]);
+            /*  a subpage block gives no page back  */
+            freed += objcache_kmalloc_size(oc->oc_size) / PAGE_SIZE;
+        }
+
+        spinlock_acquire(&objcache_listlock);
+        oc->oc_shrinking = false;
+        if (oc->oc_dead)
+        {
+            spinlock_release(&objcache_listlock);
+            objcache_release(oc);
+            spinlock_acquire(&objcache_listlock);
+        }
+    }
+    spinlock_release(&objcache_listlock);
+
+    return freed;
+}
+#endif
+
+/**
+ * @brief print the usage of every cache, with the space an object
+ * takes in its slab against what kmalloc would give it.
+ */
+void
+objcache_printstats(void)
+{
+    struct objcache *oc;
+    size_t each;
+
+    spinlock_acquire(&objcache_listlock);
+
+    kprintf("Object caches:\n");
+    for (oc = objcache_list; oc != NULL; oc = oc->oc_next)
+    {
+        spinlock_acquire(&oc->oc_lock);
+        if (oc->oc_perslab > 0)
+        {
+            each = PAGE_SIZE / oc->oc_perslab;
+        }
+        else
+        {
+            each = objcache_kmalloc_size(oc->oc_size);
+        }
+        kprintf("%-10s %5u bytes, %5u per object (kmalloc %5u), "
+                "%u in use (peak %u), %u slabs\n",
+                oc->oc_name, (unsigned)oc->oc_size, (unsigned)each,
+                (unsigned)objcache_kmalloc_size(oc->oc_size),
+                oc->oc_inuse, oc->oc_peak, oc->oc_slabs);
+        kprintf("%-10s %u allocs, %u frees, %u constructed, %u destroyed\n",
+                "", oc->oc_allocs, oc->oc_frees, oc->oc_ctors, oc->oc_dtors);
+        spinlock_release(&oc->oc_lock);
+    }
+
+    spinlock_release(&objcache_listlock);
+}
@@ -0,0 +1,178 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pcache.h>
+
+/*
+ * The key of every frame is kept in arrays indexed by frame, chained
+ * in buckets through pc_next, thus the cache needs no allocation once
+ * bootstrapped.
+ */
+static struct vnode **pc_vnode;     /*  executable of the cached frame      */
+static vaddr_t      *pc_vaddr;      /*  virtual address of the cached frame */
+static int          *pc_next;       /*  next frame of the same bucket       */
+static int          pc_buckets[PCACHE_NBUCKETS];
+
+static unsigned     pc_saved = 0;   /*  frames currently saved by sharing   */
+static unsigned     pc_peak = 0;    /*  maximum of pc_saved                 */
+
+/**
+ * @brief bucket of the given key.
+ * 
+ * @param v 
+ * @param vaddr 
+ * @return unsigned 
+ */
+static unsigned
+pcache_hash(struct vnode *v, vaddr_t vaddr)
+{
+    return (((uintptr_t)v >> 4) ^ (vaddr / PAGE_SIZE)) % PCACHE_NBUCKETS;
+}
+
+/**
+ * @brief allocates the per frame arrays.
+ */
+void pcache_bootstrap(void)
+{
+    int i, nframes;
+
+    nframes = coremap_nframes();
+    pc_vnode = kmalloc(nframes * sizeof(struct vnode *));
+    pc_vaddr = kmalloc(nframes * sizeof(vaddr_t));
+    pc_next = kmalloc(nframes * sizeof(int));
+    if (pc_vnode == NULL || pc_vaddr == NULL || pc_next == NULL)
+    {
+        panic("pcache: cannot allocate the page cache\n");
+    }
+
+    for (i = 0; i < PCACHE_NBUCKETS; i++)
+    {
+        pc_buckets[i] = -1;
+    }
+}
+
+/**
+ * @brief look up the frame holding the text page at vaddr of v.
+ * 
+ * @param v 
+ * @param vaddr page aligned
+ * @return int frame index, -1 if not cached
+ */
+int pcache_lookup(struct vnode *v, vaddr_t vaddr)
+{
+    int i;
+
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+    KASSERT(vaddr % PAGE_SIZE == 0);
+
+    for (i = pc_buckets[pcache_hash(v, vaddr)]; i != -1; i = pc_next[i])
+    {
+        if (pc_vnode[i] == v && pc_vaddr[i] == vaddr)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief add the frame index as the text page at vaddr of v.
+ * 
+ * @param v 
+ * @param vaddr page aligned
+ * @param index 
+ * @return true if added, false if the page is already cached
+ */
+bool pcache_insert(struct vnode *v, vaddr_t vaddr, int index)
+{
+    unsigned b;
+    int i;
+
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+    KASSERT(vaddr % PAGE_SIZE == 0);
+
+    b = pcache_hash(v, vaddr);
+    for (i = pc_buckets[b]; i != -1; i = pc_next[i])
+    {
+        if (pc_vnode[i] == v && pc_vaddr[i] == vaddr)
+        {
+            return false;
+        }
+    }
+
+    pc_vnode[index] = v;
+    pc_vaddr[index] = vaddr;
+    pc_next[index] = pc_buckets[b];
+    pc_buckets[b] = index;
+
+    return true;
+}
+
+/**
+ * @brief remove the frame from the cache.
+ * 
+ * @param index 
+ */
+void pcache_remove(int index)
+{
+    int *i;
+
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    for (i = &pc_buckets[pcache_hash(pc_vnode[index], pc_vaddr[index])]; *i != -1; i = &pc_next[*i])
+    {
+        if (*i == index)
+        {
+            *i = pc_next[index];
+            pc_vnode[index] = NULL;
+            return;
+        }
+    }
+
+    panic("pcache: frame %d not in the cache\n", index);
+}
+
+/**
+ * @brief account a new sharer of a cached frame.
+ */
+void pcache_shared(void)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    pc_saved++;
+    if (pc_saved > pc_peak)
+    {
+        pc_peak = pc_saved;
+    }
+}
+
+/**
+ * @brief account nframes sharers gone from cached frames.
+ * 
+ * @param nframes 
+ */
+void pcache_unshared(unsigned nframes)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+    KASSERT(pc_saved >= nframes);
+
+    pc_saved -= nframes;
+}
+
+/**
+ * @brief print the frames saved by sharing the text pages.
+ */
+void pcache_print_stats(void)
+{
+    unsigned saved, peak;
+
+    spinlock_acquire(&cm_spinlock);
+    saved = pc_saved;
+    peak = pc_peak;
+    spinlock_release(&cm_spinlock);
+
+    kprintf("pcache: %u text frames saved (peak %u)\n", saved, peak);
+}
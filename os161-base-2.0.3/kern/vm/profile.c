@@ -0,0 +1,334 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <profile.h>
+
+#if !OPT_EAGERLOAD
+#error "launchprof requires the eagerload option"
+#endif
+
+/*  startup statistics, [0] without a profile, [1] with a profile   */
+static struct spinlock profile_lock = SPINLOCK_INITIALIZER;
+static unsigned profile_runs[2];
+static unsigned profile_faults[2];
+static uint64_t profile_latency_us[2];
+
+/**
+ * @brief name of the file holding the profile of progname: slashes
+ * and colons are replaced, so that every profile is a file of the
+ * root of emu0.
+ * 
+ * @param progname 
+ * @return char* to be freed by the caller, NULL if out of memory
+ */
+static char *
+profile_path(const char *progname)
+{
+    char *path;
+    size_t prefix, len, i;
+
+    prefix = strlen(PROFILE_PREFIX);
+    len = strlen(progname);
+    path = kmalloc(prefix + len + 1);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    strcpy(path, PROFILE_PREFIX);
+    for (i = 0; i < len; i++) {
+        path[prefix + i] = (progname[i] == '/' || progname[i] == ':') ? '_' : progname[i];
+    }
+    path[prefix + len] = '\0';
+
+    return path;
+}
+
+/**
+ * @brief read the profile file into lp->lp_data.
+ * 
+ * @param lp 
+ * @param elfsize size of the binary
+ * @return true if a valid profile has been found
+ */
+static bool
+profile_load(struct launch_profile *lp, uint32_t elfsize)
+{
+    struct vnode *v;
+    struct iovec iov;
+    struct uio ku;
+    char *path;
+    int result;
+
+    /* vfs_open may modify the path */
+    path = kstrdup(lp->lp_path);
+    if (path == NULL) {
+        return false;
+    }
+    result = vfs_open(path, O_RDONLY, 0, &v);
+    kfree(path);
+    if (result) {
+        return false;
+    }
+
+    uio_kinit(&iov, &ku, &lp->lp_data, sizeof(struct profile_data), 0, UIO_READ);
+    result = VOP_READ(v, &ku);
+    vfs_close(v);
+
+    return result == 0 && ku.uio_resid == 0 &&
+           lp->lp_data.pd_magic == PROFILE_MAGIC &&
+           lp->lp_data.pd_elfsize == elfsize &&
+           lp->lp_data.pd_npages <= PROFILE_MAX_PAGES;
+}
+
+/**
+ * @brief write lp->lp_data to the profile file.
+ * 
+ * @param lp 
+ */
+static void
+profile_save(struct launch_profile *lp)
+{
+    struct vnode *v;
+    struct iovec iov;
+    struct uio ku;
+    char *path;
+    int result;
+
+    path = kstrdup(lp->lp_path);
+    if (path == NULL) {
+        return;
+    }
+    result = vfs_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664, &v);
+    kfree(path);
+    if (result) {
+        kprintf("profile: cannot create %s: %s\n", lp->lp_path, strerror(result));
+        return;
+    }
+
+    uio_kinit(&iov, &ku, &lp->lp_data, sizeof(struct profile_data), 0, UIO_WRITE);
+    result = VOP_WRITE(v, &ku);
+    if (result) {
+        kprintf("profile: cannot write %s: %s\n", lp->lp_path, strerror(result));
+    }
+    vfs_close(v);
+}
+
+/**
+ * @brief create the launch profile of progname. Must be called before
+ * vfs_open, which may destroy progname.
+ * 
+ * @param progname 
+ * @param start time the exec began
+ * @return struct launch_profile*, NULL if out of memory
+ */
+struct launch_profile *
+profile_create(const char *progname, const struct timespec *start)
+{
+    struct launch_profile *lp;
+
+    lp = kmalloc(sizeof(struct launch_profile));
+    if (lp == NULL) {
+        return NULL;
+    }
+
+    lp->lp_path = profile_path(progname);
+    if (lp->lp_path == NULL) {
+        kfree(lp);
+        return NULL;
+    }
+
+    lp->lp_replayed = false;
+    lp->lp_recording = false;
+    lp->lp_startup = false;
+    lp->lp_first = true;
+    lp->lp_faults = 0;
+    lp->lp_start = *start;
+    lp->lp_data.pd_npages = 0;
+
+    return lp;
+}
+
+/**
+ * @brief look for the profile of the binary v. If there is none, or
+ * the binary changed, the startup of this run is recorded.
+ * 
+ * @param lp 
+ * @param v 
+ */
+void profile_begin(struct launch_profile *lp, struct vnode *v)
+{
+    struct stat st;
+
+    KASSERT(lp != NULL);
+
+    if (VOP_STAT(v, &st)) {
+        return;
+    }
+
+    lp->lp_replayed = profile_load(lp, st.st_size);
+    if (!lp->lp_replayed) {
+        lp->lp_data.pd_magic = PROFILE_MAGIC;
+        lp->lp_data.pd_elfsize = st.st_size;
+        lp->lp_data.pd_npages = 0;
+    }
+    lp->lp_recording = !lp->lp_replayed;
+    lp->lp_startup = true;
+}
+
+/**
+ * @brief prefetch the pages of the profile, if any.
+ * 
+ * @param lp 
+ * @param as 
+ * @param v 
+ */
+void profile_prefetch(struct launch_profile *lp, struct addrspace *as, struct vnode *v)
+{
+    vaddr_t *pages;
+    vaddr_t page;
+    unsigned i, j;
+
+    KASSERT(lp != NULL);
+
+    if (!lp->lp_replayed || lp->lp_data.pd_npages == 0) {
+        return;
+    }
+
+    /* pages are recorded in fault order: sort them to batch the reads */
+    pages = lp->lp_data.pd_pages;
+    for (i = 1; i < lp->lp_data.pd_npages; i++) {
+        page = pages[i];
+        for (j = i; j > 0 && pages[j - 1] > page; j--) {
+            pages[j] = pages[j - 1];
+        }
+        pages[j] = page;
+    }
+
+    as_prefetch(as, v, pages, lp->lp_data.pd_npages);
+}
+
+/**
+ * @brief account the end of the startup window.
+ * 
+ * @param lp 
+ */
+static void
+profile_startup_done(struct launch_profile *lp)
+{
+    lp->lp_startup = false;
+
+    spinlock_acquire(&profile_lock);
+    profile_faults[lp->lp_replayed] += lp->lp_faults;
+    spinlock_release(&profile_lock);
+
+    if (lp->lp_recording) {
+        lp->lp_recording = false;
+        if (lp->lp_data.pd_npages > 0) {
+            profile_save(lp);
+        }
+    }
+}
+
+/**
+ * @brief called at the end of every fault of the process: counts the
+ * startup faults and records the pages while recording.
+ * 
+ * @param lp 
+ * @param vaddr page aligned
+ */
+void profile_fault(struct launch_profile *lp, vaddr_t vaddr)
+{
+    struct timespec now, delta;
+    uint64_t elapsed_us;
+    unsigned i;
+
+    if (lp == NULL || !lp->lp_startup) {
+        return;
+    }
+
+    gettime(&now);
+    timespec_sub(&now, &lp->lp_start, &delta);
+    elapsed_us = (uint64_t)delta.tv_sec * 1000000 + delta.tv_nsec / 1000;
+
+    if (lp->lp_first) {
+        /* the first fault is the fetch of the first instruction */
+        lp->lp_first = false;
+        spinlock_acquire(&profile_lock);
+        profile_runs[lp->lp_replayed]++;
+        profile_latency_us[lp->lp_replayed] += elapsed_us;
+        spinlock_release(&profile_lock);
+    }
+
+    if (elapsed_us > PROFILE_WINDOW_MS * 1000) {
+        profile_startup_done(lp);
+        return;
+    }
+
+    lp->lp_faults++;
+
+    if (lp->lp_recording) {
+        for (i = 0; i < lp->lp_data.pd_npages; i++) {
+            if (lp->lp_data.pd_pages[i] == vaddr) {
+                return;
+            }
+        }
+        lp->lp_data.pd_pages[lp->lp_data.pd_npages++] = vaddr;
+        if (lp->lp_data.pd_npages == PROFILE_MAX_PAGES) {
+            profile_startup_done(lp);
+        }
+    }
+}
+
+/**
+ * @brief called when the address space is destroyed, or when the exec
+ * fails: a program ending within the startup window saves what has
+ * been recorded so far.
+ * 
+ * @param lp 
+ */
+void profile_end(struct launch_profile *lp)
+{
+    KASSERT(lp != NULL);
+
+    if (lp->lp_startup && !lp->lp_first) {
+        profile_startup_done(lp);
+    }
+
+    kfree(lp->lp_path);
+    kfree(lp);
+}
+
+/**
+ * @brief print the startup statistics with and without a profile.
+ */
+void profile_print_stats(void)
+{
+    unsigned runs[2], faults[2];
+    uint64_t latency[2];
+    int i;
+
+    spinlock_acquire(&profile_lock);
+    for (i = 0; i < 2; i++) {
+        runs[i] = profile_runs[i];
+        faults[i] = profile_faults[i];
+        latency[i] = profile_latency_us[i];
+    }
+    spinlock_release(&profile_lock);
+
+    for (i = 0; i < 2; i++) {
+        kprintf("profile: %u runs %s a profile", runs[i], i ? "with" : "without");
+        if (runs[i] > 0) {
+            kprintf(", %u startup faults and %llu us to the first instruction on average",
+                    faults[i] / runs[i], (unsigned long long)(latency[i] / runs[i]));
+        }
+        kprintf("\n");
+    }
+}
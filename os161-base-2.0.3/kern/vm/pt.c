@@ -8,6 +8,22 @@
 #include <vm.h>
 #include "opt-swap.h"
 #include "opt-noswap_rdonly.h"
+#include "opt-uniformfill.h"
+#include "opt-ptswap.h"
+#include "opt-readahead.h"
+#include "opt-fork.h"
+#include "opt-madvise.h"
+#include "opt-stats.h"
+#include <coremap.h>
+#include <thread.h>
+#include <wchan.h>
+#if OPT_STATS
+#include <vmstats.h>
+#endif
+
+#if OPT_PTSWAP && !OPT_SWAP
+#error "ptswap requires the swap option"
+#endif
 
 /**
  * The page table is an array of entries where each of them 
@@ -23,14 +39,25 @@
  * It means that the virtual address in the page table 
  * IS NOT computed as index * PAGE_SIZE.
  * 
- * We can think the page table as divided in three different section, 
- * each of them dedicated to one segment, and starting from the virtual
- * address we want to translate, we have to exploit the information
- * in the address space structure to discover the segment from which the
- * address belongs to, and then substract the base_vaddr and the number
- * of page dedicated to the previous segments in the page table to retrieve 
- * the index.
+ * We can think the page table as divided in sections, each of them
+ * dedicated to one region of the address space, and starting from the
+ * virtual address we want to translate, we look up the region from
+ * which the address belongs to (as_get_region), and then substract its
+ * base_vaddr and add the index of its first entry in the page table
+ * to retrieve the index.
  * 
+ * The entries are not kept in a single array: the index is split in
+ * a leaf number and an offset within the leaf, and each leaf is a page
+ * of entries allocated the first time one of its pages faults. This
+ * way large sparse address spaces only pay for the leaves they touch,
+ * and a leaf whose pages have all been swapped out can be swapped out
+ * in turn (pt_reclaim).
+ * 
+ * The entries of the stack are stored from its top page downwards, so
+ * that a stack growing down only appends entries at the end of the
+ * table (pt_grow). The heap sits between the elf regions and the
+ * stack, with room for as_heap_maxpages entries whatever its current
+ * size, and so does the window of the file mappings.
  * 
  */
 
@@ -40,133 +67,857 @@
 /**
  * @brief Compute the page table index of the virtual address.
  * 
- * Check the segment from which the vaddr belongs to. 
+ * Find the region from which the vaddr belongs to. 
  * 
  * It has to take into account the logic behind the page table, as 
  * only the page of the address space that belong to a segment are 
- * considered in the page table. 
+ * considered in the page table: each region records the index of
+ * its first entry, and the page offset within the region is added.
  *  
  * @param as address space
  * @param vaddr virtual address
  * @return int page table index
  */
 static int pt_get_index(struct addrspace *as, vaddr_t vaddr){
+    struct as_region *region;
+    struct segment *seg;
     unsigned int pt_index;
     
     KASSERT(as != NULL);
 
-    switch(as_get_segment_type(as,vaddr)){
-        case SEGMENT_TEXT:
-            pt_index = ( vaddr - (as->as_text->seg_first_vaddr & PAGE_FRAME) ) / PAGE_SIZE;
-            KASSERT(pt_index < as->as_text->seg_npages);
-            return pt_index;
-        case SEGMENT_DATA:
-            pt_index = as->as_text->seg_npages + ( vaddr - (as->as_data->seg_first_vaddr & PAGE_FRAME) ) / PAGE_SIZE;
-            KASSERT(pt_index <  as->as_text->seg_npages + as->as_data->seg_npages);
-            return pt_index;
-        case SEGMENT_STACK:
-            pt_index = as->as_data->seg_npages + as->as_text->seg_npages + (vaddr - (as->as_stack->seg_first_vaddr & PAGE_FRAME) ) / PAGE_SIZE ;
-            KASSERT(pt_index <  as->as_data->seg_npages + as->as_text->seg_npages + as->as_stack->seg_npages);
-            return pt_index;
-        default :
-            panic("invalid segment type! (pt_get_index)");
+    region = as_get_region(as, vaddr);
+    if (region == NULL) {
+        panic("invalid segment type! (pt_get_index)");
     }
-    
-    return 0;
+    seg = region->ar_seg;
+
+    if (region->ar_type == SEGMENT_STACK) {
+        pt_index = ( (seg->seg_last_vaddr - PAGE_SIZE) - (vaddr & PAGE_FRAME) ) / PAGE_SIZE;
+    }
+    else {
+        pt_index = ( vaddr - (seg->seg_first_vaddr & PAGE_FRAME) ) / PAGE_SIZE;
+    }
+    KASSERT(pt_index < seg->seg_npages);
+
+    return region->ar_ptbase + pt_index;
+}
+
+#if OPT_PTSWAP
+/*  resident leaves of all the page tables, scanned by pt_reclaim   */
+static struct pt_leaf *pt_resident_head = NULL;
+static struct pt_leaf *pt_resident_tail = NULL;
+
+/**
+ * @brief append the leaf to the resident list. Must be called
+ * holding cm_spinlock.
+ * 
+ * @param leaf 
+ */
+static void pt_resident_add(struct pt_leaf *leaf)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    leaf->pl_next = NULL;
+    leaf->pl_prev = pt_resident_tail;
+    if (pt_resident_tail != NULL)
+    {
+        pt_resident_tail->pl_next = leaf;
+    }
+    else
+    {
+        pt_resident_head = leaf;
+    }
+    pt_resident_tail = leaf;
 }
 
+/**
+ * @brief remove the leaf from the resident list. Must be called
+ * holding cm_spinlock.
+ * 
+ * @param leaf 
+ */
+static void pt_resident_remove(struct pt_leaf *leaf)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    if (leaf->pl_prev != NULL)
+    {
+        leaf->pl_prev->pl_next = leaf->pl_next;
+    }
+    else
+    {
+        pt_resident_head = leaf->pl_next;
+    }
+    if (leaf->pl_next != NULL)
+    {
+        leaf->pl_next->pl_prev = leaf->pl_prev;
+    }
+    else
+    {
+        pt_resident_tail = leaf->pl_prev;
+    }
+    leaf->pl_prev = leaf->pl_next = NULL;
+}
+#endif
+
 /**
  * @brief allocates the page table and initializes it.
+ * Only the directory is allocated, the leaves are allocated
+ * on the first access.
  * 
- * @param pagetable_size 
- * @return struct pt_entry* 
+ * @param pagetable_size number of entries
+ * @param max_size number of entries the table can grow to
+ * @return struct pt_directory* 
  */
-struct pt_entry *pt_create(unsigned long pagetable_size)
+struct pt_directory *pt_create(unsigned long pagetable_size, unsigned long max_size)
 {
     unsigned long i = 0;
+    struct pt_directory *pt;
 
-    struct pt_entry *pt = kmalloc(sizeof(struct pt_entry) * pagetable_size);
+    KASSERT(max_size >= pagetable_size);
 
+    pt = kmalloc(sizeof(struct pt_directory));
     if (pt == NULL)
     {
         return NULL;
     }
 
+    pt->pd_nentries = pagetable_size;
+    pt->pd_maxentries = max_size;
+    pt->pd_nleaves = DIVROUNDUP(max_size, PT_LEAF_ENTRIES);
+    pt->pd_leaves = kmalloc(sizeof(struct pt_leaf) * pt->pd_nleaves);
+    if (pt->pd_leaves == NULL)
+    {
+        kfree(pt);
+        return NULL;
+    }
 
-    for (i = 0; i < pagetable_size; i++)
+    for (i = 0; i < pt->pd_nleaves; i++)
     {
-        pt[i].pt_frame_index = 0;
-        pt[i].pt_swap_index = 0;
-        pt[i].pt_status = NOT_LOADED;
+        pt->pd_leaves[i].pl_entries = NULL;
+        pt->pd_leaves[i].pl_status = PT_LEAF_ABSENT;
+        pt->pd_leaves[i].pl_pin = 0;
+        pt->pd_leaves[i].pl_swap_index = 0;
+        pt->pd_leaves[i].pl_prev = NULL;
+        pt->pd_leaves[i].pl_next = NULL;
     }
 
     return pt;
 }
 
 /**
- * @brief retrieve the pointer to the page table entry for the given virtual address
+ * @brief extend the page table to pagetable_size entries. The new
+ * entries are NOT_LOADED; their leaves are allocated on the first
+ * access, as the others.
+ * 
+ * @param pt 
+ * @param pagetable_size 
+ */
+void pt_grow(struct pt_directory *pt, unsigned long pagetable_size)
+{
+    KASSERT(pt != NULL);
+    KASSERT(pagetable_size >= pt->pd_nentries);
+    KASSERT(pagetable_size <= pt->pd_maxentries);
+
+    pt->pd_nentries = pagetable_size;
+}
+
+/*  threads waiting for a leaf being loaded or written to swap  */
+static struct wchan *pt_leaf_wchan;
+
+/**
+ * @brief create the wait channel of the leaves.
+ */
+void pt_bootstrap(void)
+{
+    pt_leaf_wchan = wchan_create("pt_leaf");
+    if (pt_leaf_wchan == NULL)
+    {
+        panic("pt: cannot create the leaf wait channel\n");
+    }
+}
+
+/**
+ * @brief pin the leaf and make it resident, allocating it or reading
+ * it back from swap if needed. A pinned leaf is never moved to swap.
+ * A leaf being moved by another thread is waited for on
+ * pt_leaf_wchan.
+ * 
+ * @param leaf 
+ * @return int 0 on success, ENOMEM if no page is left for the leaf
+ */
+static int pt_leaf_get(struct pt_leaf *leaf)
+{
+    struct pt_entry *entries;
+    unsigned int status;
+    unsigned int i;
+
+    spinlock_acquire(&cm_spinlock);
+    leaf->pl_pin++;
+
+    while (leaf->pl_status != PT_LEAF_RESIDENT)
+    {
+        status = leaf->pl_status;
+        if (status == PT_LEAF_LOADING || status == PT_LEAF_SWAPPING)
+        {
+            /*  someone else is moving it, wait for it to settle    */
+            wchan_sleep(pt_leaf_wchan, &cm_spinlock);
+            continue;
+        }
+
+        leaf->pl_status = PT_LEAF_LOADING;
+        spinlock_release(&cm_spinlock);
+
+        entries = (struct pt_entry *)alloc_kpages(1);
+        if (entries == NULL)
+        {
+            spinlock_acquire(&cm_spinlock);
+            leaf->pl_status = status;
+            leaf->pl_pin--;
+            wchan_wakeall(pt_leaf_wchan, &cm_spinlock);
+            spinlock_release(&cm_spinlock);
+            return ENOMEM;
+        }
+
+        if (status == PT_LEAF_ABSENT)
+        {
+            for (i = 0; i < PT_LEAF_ENTRIES; i++)
+            {
+                entries[i].pt_frame_index = 0;
+                entries[i].pt_swap_index = 0;
+                entries[i].pt_status = NOT_LOADED;
+                entries[i].pt_cow = 0;
+                entries[i].pt_ra = 0;
+                entries[i].pt_pf = 0;
+                entries[i].pt_busy = 0;
+            }
+        }
+        else
+        {
+#if OPT_PTSWAP
+            KASSERT(status == PT_LEAF_SWAPPED);
+            swap_in(KVADDR_TO_PADDR((vaddr_t)entries), leaf->pl_swap_index);
+#if OPT_STATS
+            vmstats_hit(VMSTAT_PT_SWAP_IN);
+#endif
+#else
+            panic("pt: invalid leaf status %u\n", status);
+#endif
+        }
+
+        spinlock_acquire(&cm_spinlock);
+        leaf->pl_entries = entries;
+        leaf->pl_status = PT_LEAF_RESIDENT;
+#if OPT_PTSWAP
+        pt_resident_add(leaf);
+#endif
+        wchan_wakeall(pt_leaf_wchan, &cm_spinlock);
+    }
+
+    spinlock_release(&cm_spinlock);
+
+    return 0;
+}
+
+/**
+ * @brief unpin the leaf.
+ * 
+ * @param leaf 
+ */
+static void pt_leaf_put(struct pt_leaf *leaf)
+{
+    spinlock_acquire(&cm_spinlock);
+    KASSERT(leaf->pl_pin > 0);
+    leaf->pl_pin--;
+    spinlock_release(&cm_spinlock);
+}
+
+/**
+ * @brief retrieve the pointer to the page table entry for the given virtual address.
+ * The leaf holding the entry is pinned in memory until pt_put_entry is called.
  * 
  * @param as 
  * @param vaddr 
- * @return struct pt_entry* 
+ * @return struct pt_entry* NULL if the leaf could not be allocated,
+ * pt_put_entry must not be called then
  */
 struct pt_entry *pt_get_entry(struct addrspace *as, const vaddr_t vaddr)
 {
+    struct pt_leaf *leaf;
+
     KASSERT(as != NULL);
     
     int pt_index = pt_get_index(as, vaddr);
     
-    return &as->as_ptable[pt_index];
+    KASSERT((unsigned long)pt_index < as->as_ptable->pd_nentries);
+    leaf = &as->as_ptable->pd_leaves[pt_index / PT_LEAF_ENTRIES];
+    if (pt_leaf_get(leaf))
+    {
+        return NULL;
+    }
+
+    return &leaf->pl_entries[pt_index % PT_LEAF_ENTRIES];
+}
+
+/**
+ * @brief release the entry retrieved by pt_get_entry.
+ * 
+ * @param as 
+ * @param vaddr 
+ */
+void pt_put_entry(struct addrspace *as, const vaddr_t vaddr)
+{
+    KASSERT(as != NULL);
+
+    int pt_index = pt_get_index(as, vaddr);
+
+    pt_leaf_put(&as->as_ptable->pd_leaves[pt_index / PT_LEAF_ENTRIES]);
+}
+
+#if OPT_MADVISE
+/**
+ * @brief read the status of the entry for the given virtual address,
+ * without pinning its leaf nor bringing it back to memory. An absent
+ * leaf only holds NOT_LOADED entries, and the pages of a leaf out of
+ * memory (or moving) are reported as IN_SWAP, as none of them is
+ * resident.
+ * 
+ * @param as 
+ * @param vaddr 
+ * @return unsigned char status of the entry
+ */
+unsigned char pt_peek_status(struct addrspace *as, const vaddr_t vaddr)
+{
+    struct pt_leaf *leaf;
+    unsigned char status;
+
+    KASSERT(as != NULL);
+
+    int pt_index = pt_get_index(as, vaddr);
+
+    KASSERT((unsigned long)pt_index < as->as_ptable->pd_nentries);
+    leaf = &as->as_ptable->pd_leaves[pt_index / PT_LEAF_ENTRIES];
+
+    spinlock_acquire(&cm_spinlock);
+    switch (leaf->pl_status)
+    {
+        case PT_LEAF_ABSENT:
+            status = NOT_LOADED;
+            break;
+        case PT_LEAF_RESIDENT:
+            status = leaf->pl_entries[pt_index % PT_LEAF_ENTRIES].pt_status;
+            break;
+        default:
+            status = IN_SWAP;
+            break;
+    }
+    spinlock_release(&cm_spinlock);
+
+    return status;
 }
+#endif
 
 /**
  * @brief deallocates the page table. Beaware of calling pt_empty before this
  * to not waste memory.
  * 
- * @param entry 
+ * @param pt 
+ */
+void pt_destroy(struct pt_directory *pt) 
+{
+    unsigned long i;
+
+    KASSERT(pt != NULL);
+
+    for (i = 0; i < pt->pd_nleaves; i++)
+    {
+        KASSERT(pt->pd_leaves[i].pl_status == PT_LEAF_ABSENT);
+    }
+
+    kfree(pt->pd_leaves);
+    kfree(pt);
+}
+
+/**
+ * @brief wait until the page of an entry can be released: it is not
+ * busy and its frame is not pinned, for instance by a swap out started
+ * before the page was given up. The entry is looked at again after each
+ * wait, as the page may have been moved to the swap file meanwhile.
+ * Must be called holding cm_spinlock, on an entry whose leaf is pinned.
+ * 
+ * @param pt_row 
  */
-void pt_destroy(struct pt_entry* entry) 
+static void pt_wait_idle(struct pt_entry *pt_row)
 {
-    KASSERT(entry != NULL);
-    kfree(entry);
+    bool waited;
+
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    do {
+        waited = false;
+#if OPT_PAGEBUSY
+        waited = pt_wait_busy(pt_row);
+#endif
+        if (pt_row->pt_status == IN_MEMORY
+#if OPT_NOSWAP_RDONLY
+            || pt_row->pt_status == IN_MEMORY_RDONLY
+#endif
+           ) {
+            waited = coremap_wait_unpinned(pt_row->pt_frame_index * PAGE_SIZE) || waited;
+        }
+    } while (waited);
+}
+
+/**
+ * @brief release the frame or the swap slot of the entry, which
+ * goes back to NOT_LOADED. A page being loaded, swapped out or
+ * written back is waited for first. The tlb entry of the page, if
+ * any, has to be dropped by the caller.
+ * 
+ * @param pt_row 
+ * @return true if a frame or a swap slot has been released
+ */
+bool pt_free_entry(struct pt_entry *pt_row){
+    paddr_t paddr;
+
+    KASSERT(pt_row != NULL);
+
+    spinlock_acquire(&cm_spinlock);
+    pt_wait_idle(pt_row);
+    if (pt_row->pt_status == NOT_LOADED) {
+        spinlock_release(&cm_spinlock);
+        return false;
+    }
+#if OPT_PAGEBUSY
+    /*  no swap out picks the page while it is released  */
+    pt_row->pt_busy = 1;
+#endif
+    spinlock_release(&cm_spinlock);
+
+    switch (pt_row->pt_status)
+    {
+#if OPT_NOSWAP_RDONLY
+        case IN_MEMORY_RDONLY:
+#endif
+        case IN_MEMORY:
+#if OPT_READAHEAD && OPT_STATS
+            if (pt_row->pt_ra) {
+                vmstats_hit(VMSTAT_RA_WASTE);
+            }
+#endif
+            paddr = ( pt_row->pt_frame_index ) * PAGE_SIZE;
+            free_upage(paddr, pt_row);
+            break;
+        case IN_SWAP:
+#if OPT_SWAP       
+            swap_free(pt_row->pt_swap_index);
+#else           
+            panic("SWAP Pages should not exists!");
+#endif
+            break;
+#if OPT_UNIFORMFILL
+        case IN_FILL:
+            /* nothing to release, the content lives in the entry */
+            break;
+#endif
+#if OPT_ZEROPAGE
+        case IN_ZERO:
+            /* nothing to release, the zero frame is shared by all */
+            break;
+#endif
+        default:
+            break;
+    }
+
+    spinlock_acquire(&cm_spinlock);
+    pt_set_entry(pt_row, 0, 0, NOT_LOADED);
+#if OPT_PAGEBUSY
+    pt_unbusy(pt_row);
+#endif
+    spinlock_release(&cm_spinlock);
+
+    return true;
 }
 
+#if OPT_FASTEXIT
+/**
+ * @brief deallocates both the pages in memory and the pages
+ * in the swap file, then the leaves of the page table.
+ * The leaves are all brought to memory first, then the frames are
+ * released under a single acquisition of cm_spinlock, and the swap
+ * slots under a single acquisition of the swap lock. Pages still
+ * being swapped out or written back are waited for.
+ * 
+ * @param pt 
+ */
+void pt_empty(struct pt_directory *pt){
+    struct pt_leaf *leaf;
+    struct pt_entry *entries;
+    unsigned long l, i, n;
+
+    KASSERT(pt != NULL);
+
+    /*  swapped leaves are read back now, no I/O is done past this point  */
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        if (pt->pd_leaves[l].pl_status != PT_LEAF_ABSENT &&
+            pt_leaf_get(&pt->pd_leaves[l])) {
+            panic("pt_empty: no memory to read back a leaf\n");
+        }
+    }
+
+    spinlock_acquire(&cm_spinlock);
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        leaf = &pt->pd_leaves[l];
+        if (leaf->pl_status == PT_LEAF_ABSENT) {
+            continue;
+        }
+        KASSERT(leaf->pl_status == PT_LEAF_RESIDENT && leaf->pl_pin == 1);
+
+        entries = leaf->pl_entries;
+        n = pt->pd_nentries - l * PT_LEAF_ENTRIES;
+        if (n > PT_LEAF_ENTRIES) {
+            n = PT_LEAF_ENTRIES;
+        }
+
+        for (i = 0; i < n; i++) {
+            pt_wait_idle(&entries[i]);
+            switch (entries[i].pt_status)
+            {
+#if OPT_NOSWAP_RDONLY
+                case IN_MEMORY_RDONLY:
+#endif
+                case IN_MEMORY:
+#if OPT_READAHEAD && OPT_STATS
+                    if (entries[i].pt_ra) {
+                        vmstats_hit(VMSTAT_RA_WASTE);
+                    }
+#endif
+                    coremap_drop_upage(entries[i].pt_frame_index * PAGE_SIZE, &entries[i]);
+                    entries[i].pt_status = NOT_LOADED;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+#if OPT_SWAP
+    swap_free_begin();
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        leaf = &pt->pd_leaves[l];
+        if (leaf->pl_status == PT_LEAF_ABSENT) {
+            continue;
+        }
+
+        entries = leaf->pl_entries;
+        n = pt->pd_nentries - l * PT_LEAF_ENTRIES;
+        if (n > PT_LEAF_ENTRIES) {
+            n = PT_LEAF_ENTRIES;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (entries[i].pt_status == IN_SWAP) {
+                swap_free_locked(entries[i].pt_swap_index);
+            }
+        }
+    }
+    swap_free_end();
+#endif
+
+    /*  the leaves are unlinked here, and their pages freed below  */
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        leaf = &pt->pd_leaves[l];
+        if (leaf->pl_status == PT_LEAF_ABSENT) {
+            continue;
+        }
+        leaf->pl_pin = 0;
+        leaf->pl_status = PT_LEAF_ABSENT;
+#if OPT_PTSWAP
+        pt_resident_remove(leaf);
+#endif
+    }
+    spinlock_release(&cm_spinlock);
+
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        leaf = &pt->pd_leaves[l];
+        if (leaf->pl_entries != NULL) {
+            free_kpages((vaddr_t)leaf->pl_entries);
+            leaf->pl_entries = NULL;
+        }
+    }
+}
+#else
 /**
  * @brief deallocates both the pages in memory and the pages 
- * in the swap file.
+ * in the swap file, then the leaves of the page table.
  * 
  * @param pt 
- * @param size 
  */
-void pt_empty(struct pt_entry* pt, int size){
-    paddr_t paddr;
+void pt_empty(struct pt_directory *pt){
+    struct pt_leaf *leaf;
+    struct pt_entry *entries;
+    unsigned long l, i, n;
+
     KASSERT(pt != NULL);
-    KASSERT(pt != 0);
 
-    for(int i = 0; i < size; i++){
-        switch (pt[i].pt_status)
-        {
+    for (l = 0; l < pt->pd_nleaves; l++) {
+        leaf = &pt->pd_leaves[l];
+        if (leaf->pl_status == PT_LEAF_ABSENT) {
+            continue;
+        }
+
+        /*  a swapped leaf is read back to release the swap slots it refers to  */
+        if (pt_leaf_get(leaf)) {
+            panic("pt_empty: no memory to read back a leaf\n");
+        }
+        entries = leaf->pl_entries;
+        n = pt->pd_nentries - l * PT_LEAF_ENTRIES;
+        if (n > PT_LEAF_ENTRIES) {
+            n = PT_LEAF_ENTRIES;
+        }
+
+        for (i = 0; i < n; i++) {
+            pt_free_entry(&entries[i]);
+        }
+
+        spinlock_acquire(&cm_spinlock);
+        KASSERT(leaf->pl_pin == 1);
+        leaf->pl_pin = 0;
+        leaf->pl_entries = NULL;
+        leaf->pl_status = PT_LEAF_ABSENT;
+#if OPT_PTSWAP
+        pt_resident_remove(leaf);
+#endif
+        spinlock_release(&cm_spinlock);
+
+        free_kpages((vaddr_t)entries);
+    }
+
+}
+#endif
+
+#if OPT_FORK
+/**
+ * @brief fill the page table of a forked address space, with the same
+ * layout as the one of its parent. Resident pages are shared
+ * copy-on-write, swapped pages share the swap slot and uniform pages
+ * are copied with the entry; pages not loaded yet will be loaded from
+ * the elf by each process. On failure, dst holds the entries copied
+ * so far and has to be released with pt_empty.
+ * 
+ * @param src 
+ * @param dst 
+ * @return int 0 on success, ENOMEM
+ */
+int pt_copy(struct pt_directory *src, struct pt_directory *dst)
+{
+    struct pt_leaf *src_leaf, *dst_leaf;
+    struct pt_entry *from, *to;
+    struct cm_rmap *node;
+    unsigned long l, i, n;
+
+    KASSERT(src != NULL);
+    KASSERT(dst != NULL);
+    KASSERT(src->pd_nentries == dst->pd_nentries);
+    KASSERT(src->pd_nleaves == dst->pd_nleaves);
+
+    for (l = 0; l < src->pd_nleaves; l++) {
+        src_leaf = &src->pd_leaves[l];
+        dst_leaf = &dst->pd_leaves[l];
+        if (src_leaf->pl_status == PT_LEAF_ABSENT) {
+            continue;
+        }
+
+        if (pt_leaf_get(src_leaf)) {
+            return ENOMEM;
+        }
+        if (pt_leaf_get(dst_leaf)) {
+            pt_leaf_put(src_leaf);
+            return ENOMEM;
+        }
+        n = src->pd_nentries - l * PT_LEAF_ENTRIES;
+        if (n > PT_LEAF_ENTRIES) {
+            n = PT_LEAF_ENTRIES;
+        }
+
+        for (i = 0; i < n; i++) {
+            from = &src_leaf->pl_entries[i];
+            to = &dst_leaf->pl_entries[i];
+
+            /*  a resident page can only be evicted meanwhile, not the opposite  */
+            node = NULL;
+            if (from->pt_status == IN_MEMORY || from->pt_status == IN_MEMORY_RDONLY) {
+                node = coremap_rmap_alloc();
+                if (node == NULL) {
+                    pt_leaf_put(dst_leaf);
+                    pt_leaf_put(src_leaf);
+                    return ENOMEM;
+                }
+            }
+
+            spinlock_acquire(&cm_spinlock);
+            switch (from->pt_status)
+            {
 #if OPT_NOSWAP_RDONLY
-            case IN_MEMORY_RDONLY:
+                case IN_MEMORY_RDONLY:
 #endif
-            case IN_MEMORY:
-                paddr = ( pt[i].pt_frame_index ) * PAGE_SIZE;
-                free_upage(paddr);
+                case IN_MEMORY:
+                    KASSERT(node != NULL);
+                    *to = *from;
+                    to->pt_ra = 0;
+                    to->pt_pf = 0;
+                    coremap_share(from->pt_frame_index * PAGE_SIZE, to, node);
+                    node = NULL;
+                    break;
+                case IN_SWAP:
+#if OPT_SWAP
+                    swap_dup(from->pt_swap_index);
+                    *to = *from;
+#else
+                    panic("SWAP Pages should not exists!");
+#endif
+                    break;
+#if OPT_UNIFORMFILL
+                case IN_FILL:
+                    *to = *from;
+                    break;
+#endif
+#if OPT_ZEROPAGE
+                case IN_ZERO:
+                    *to = *from;
+                    break;
+#endif
+                default:
+                    break;
+            }
+#if OPT_PAGEBUSY
+            /*  the load or swap out in progress is the parent's one  */
+            to->pt_busy = 0;
+#endif
+            spinlock_release(&cm_spinlock);
+
+            if (node != NULL) {
+                coremap_rmap_free(node);
+            }
+        }
+
+        pt_leaf_put(dst_leaf);
+        pt_leaf_put(src_leaf);
+    }
+
+    return 0;
+}
+#endif
+
+#if OPT_PTSWAP
+/**
+ * @brief check whether none of the pages of the leaf is in memory,
+ * and whether any of them is in swap or in a fill entry.
+ * 
+ * @param leaf 
+ * @param needs_io set if the entries have to be saved
+ * @return true if the leaf can be reclaimed
+ */
+static bool pt_leaf_cold(struct pt_leaf *leaf, bool *needs_io)
+{
+    unsigned int i;
+
+    *needs_io = false;
+    for (i = 0; i < PT_LEAF_ENTRIES; i++)
+    {
+        switch (leaf->pl_entries[i].pt_status)
+        {
+            case NOT_LOADED:
                 break;
             case IN_SWAP:
-#if OPT_SWAP       
-                swap_free(pt[i].pt_swap_index);
-#else           
-                panic("SWAP Pages should not exists!");
+#if OPT_UNIFORMFILL
+            case IN_FILL:
+#endif
+#if OPT_ZEROPAGE
+            case IN_ZERO:
 #endif
+                *needs_io = true;
                 break;
             default:
-                break;
+                return false;
         }
     }
 
+    return true;
 }
 
+/**
+ * @brief free the frame of a leaf whose pages are all out of memory,
+ * writing it to swap unless every entry is still NOT_LOADED.
+ * At most PT_RECLAIM_SCAN leaves are examined, hot leaves are moved
+ * to the end of the list.
+ * Must be called holding cm_spinlock, which is released during the
+ * write. The frame is not freed but handed back to the caller.
+ * 
+ * @return paddr_t frame of the reclaimed leaf, 0 if none was found
+ */
+paddr_t pt_reclaim(void)
+{
+    struct pt_leaf *leaf;
+    struct pt_entry *entries;
+    unsigned int swap_index;
+    bool needs_io = false;
+    int n;
+
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    for (n = 0; n < PT_RECLAIM_SCAN; n++)
+    {
+        leaf = pt_resident_head;
+        if (leaf == NULL)
+        {
+            return 0;
+        }
+
+        pt_resident_remove(leaf);
+        if (leaf->pl_pin == 0 && pt_leaf_cold(leaf, &needs_io))
+        {
+            break;
+        }
+        pt_resident_add(leaf);
+    }
+
+    if (n == PT_RECLAIM_SCAN)
+    {
+        return 0;
+    }
+
+    entries = leaf->pl_entries;
+    if (!needs_io)
+    {
+        /*  nothing worth saving, it will be recreated empty   */
+        leaf->pl_entries = NULL;
+        leaf->pl_status = PT_LEAF_ABSENT;
+    }
+    else
+    {
+        leaf->pl_status = PT_LEAF_SWAPPING;
+        spinlock_release(&cm_spinlock);
+        swap_index = swap_out(KVADDR_TO_PADDR((vaddr_t)entries));
+        spinlock_acquire(&cm_spinlock);
+
+        leaf->pl_entries = NULL;
+        leaf->pl_swap_index = swap_index;
+        leaf->pl_status = PT_LEAF_SWAPPED;
+        wchan_wakeall(pt_leaf_wchan, &cm_spinlock);
+#if OPT_STATS
+        vmstats_hit(VMSTAT_PT_SWAP_OUT);
+#endif
+    }
+
+#if OPT_STATS
+    vmstats_hit(VMSTAT_PT_RECLAIM);
+#endif
+
+    return KVADDR_TO_PADDR((vaddr_t)entries);
+}
+#endif
+
 /**
  * @brief set the given page table entry
  * 
@@ -177,14 +928,120 @@ void pt_empty(struct pt_entry* pt, int size){
  */
 void pt_set_entry(struct pt_entry *pt_row, paddr_t paddr, unsigned int swap_index, unsigned char status){
 #if OPT_NOSWAP_RDONLY
-    KASSERT(status == IN_MEMORY || status == IN_MEMORY_RDONLY || status == IN_SWAP || status == NOT_LOADED);
+    KASSERT(status == IN_MEMORY || status == IN_MEMORY_RDONLY || status == IN_SWAP || status == NOT_LOADED ||
+            (OPT_ZEROPAGE && status == IN_ZERO));
 #else
-    KASSERT(status == IN_MEMORY || status == IN_SWAP || status == NOT_LOADED);
+    KASSERT(status == IN_MEMORY || status == IN_SWAP || status == NOT_LOADED ||
+            (OPT_ZEROPAGE && status == IN_ZERO));
 #endif
-    KASSERT(swap_index < 0xfff);     /*  it should be on 12 bit */
+    KASSERT(swap_index < (1 << SWAP_INDEX_SIZE));     /*  it should be on SWAP_INDEX_SIZE bits */
 
     pt_row->pt_frame_index = paddr/PAGE_SIZE;
     pt_row->pt_swap_index = swap_index;
     pt_row->pt_status = status;
+    pt_row->pt_cow = 0;
+    pt_row->pt_ra = 0;
+    pt_row->pt_dirty = 0;
+    pt_row->pt_pf = 0;
+
+}
+
+#if OPT_PAGEBUSY
+/*  threads waiting for a busy entry, whichever it is  */
+static struct wchan *pt_busy_wchan;
+
+/**
+ * @brief create the wait channel of the busy entries.
+ */
+void pt_busy_bootstrap(void)
+{
+    pt_busy_wchan = wchan_create("pt_busy");
+    if (pt_busy_wchan == NULL)
+    {
+        panic("pt: cannot create the busy wait channel\n");
+    }
+}
+
+/**
+ * @brief wait until the entry is not busy anymore. An entry is busy
+ * while a single thread loads its page or swaps it out, with
+ * cm_spinlock released: the other threads faulting on the page sleep
+ * here instead of doing the same I/O again, and look at the entry once
+ * more when they wake up. Must be called holding cm_spinlock, on an
+ * entry whose leaf is pinned.
+ * 
+ * @param pt_row 
+ * @return true if the thread had to wait
+ */
+bool pt_wait_busy(struct pt_entry *pt_row)
+{
+    bool waited = false;
 
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+
+    while (pt_row->pt_busy)
+    {
+        wchan_sleep(pt_busy_wchan, &cm_spinlock);
+        waited = true;
+    }
+
+    return waited;
 }
+
+/**
+ * @brief end the load or the swap out of a busy entry and wake up the
+ * threads waiting for it. Must be called holding cm_spinlock.
+ * 
+ * @param pt_row 
+ */
+void pt_unbusy(struct pt_entry *pt_row)
+{
+    KASSERT(spinlock_do_i_hold(&cm_spinlock));
+    KASSERT(pt_row->pt_busy);
+
+    pt_row->pt_busy = 0;
+    wchan_wakeall(pt_busy_wchan, &cm_spinlock);
+}
+#endif
+
+#if OPT_UNIFORMFILL
+/**
+ * A page whose content is a single repeated word does not need a
+ * swap slot: the word itself is stored in the entry, split between
+ * the frame index (upper bits) and the swap index (lower bits),
+ * which are both unused while the page is in the IN_FILL state.
+ */
+#if SWAP_INDEX_SIZE + 20 < 32
+#error "pt_entry too small to hold a fill word"
+#endif
+
+/**
+ * @brief mark the entry as a uniform page filled with word.
+ * 
+ * @param pt_row 
+ * @param word 
+ */
+void pt_set_fill(struct pt_entry *pt_row, uint32_t word){
+    KASSERT(pt_row != NULL);
+
+    pt_row->pt_frame_index = word >> SWAP_INDEX_SIZE;
+    pt_row->pt_swap_index = word & ((1 << SWAP_INDEX_SIZE) - 1);
+    pt_row->pt_status = IN_FILL;
+    pt_row->pt_cow = 0;
+    pt_row->pt_ra = 0;
+    pt_row->pt_pf = 0;
+}
+
+/**
+ * @brief retrieve the fill word of a uniform page.
+ * 
+ * @param pt_row 
+ * @return uint32_t 
+ */
+uint32_t pt_get_fill(struct pt_entry *pt_row){
+    KASSERT(pt_row != NULL);
+    KASSERT(pt_row->pt_status == IN_FILL);
+
+    return ((uint32_t)pt_row->pt_frame_index << SWAP_INDEX_SIZE) | pt_row->pt_swap_index;
+}
+#endif
@@ -0,0 +1,238 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <reaper.h>
+
+/*  address space waiting for the reaper  */
+struct reaper_job {
+    struct addrspace    *rj_as;
+    struct vnode        *rj_vnode;      /*  ELF of the process, may be NULL  */
+    struct reaper_job   *rj_next;
+};
+
+static struct spinlock  reaper_lock = SPINLOCK_INITIALIZER;  /*  the queue and the counters  */
+static struct wchan     *reaper_wchan;  /*  woken when a job is queued  */
+static struct reaper_job *reaper_head = NULL;
+static struct reaper_job *reaper_tail = NULL;
+static bool             reaper_enabled = true;
+static unsigned         reaper_pending = 0;
+static unsigned         reaper_done = 0;
+static struct timespec  reaper_total = { 0, 0 };   /*  time spent in as_destroy  */
+
+/*  _exit to waiter latency  */
+static struct spinlock  reaper_exit_lock = SPINLOCK_INITIALIZER;
+static unsigned         reaper_exit_count = 0;
+static struct timespec  reaper_exit_total = { 0, 0 };
+static struct timespec  reaper_exit_last = { 0, 0 };
+
+/**
+ * @brief add delta to total.
+ * 
+ * @param total 
+ * @param delta 
+ */
+static void
+reaper_add_time(struct timespec *total, const struct timespec *delta)
+{
+    total->tv_sec += delta->tv_sec;
+    total->tv_nsec += delta->tv_nsec;
+    if (total->tv_nsec >= 1000000000)
+    {
+        total->tv_sec++;
+        total->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * @brief body of the reaper thread: destroys the queued address
+ * spaces, in the order they were queued.
+ * 
+ * @param data1 
+ * @param data2 
+ */
+static void
+reaper_thread(void *data1, unsigned long data2)
+{
+    struct reaper_job *job;
+    struct timespec start, end, delta;
+
+    (void)data1;
+    (void)data2;
+
+    while (1)
+    {
+        spinlock_acquire(&reaper_lock);
+        while (reaper_head == NULL)
+        {
+            wchan_sleep(reaper_wchan, &reaper_lock);
+        }
+        job = reaper_head;
+        reaper_head = job->rj_next;
+        if (reaper_head == NULL)
+        {
+            reaper_tail = NULL;
+        }
+        spinlock_release(&reaper_lock);
+
+        gettime(&start);
+        as_destroy(job->rj_as);
+        if (job->rj_vnode != NULL)
+        {
+            VOP_DECREF(job->rj_vnode);
+        }
+        gettime(&end);
+        timespec_sub(&end, &start, &delta);
+        kfree(job);
+
+        spinlock_acquire(&reaper_lock);
+        reaper_pending--;
+        reaper_done++;
+        reaper_add_time(&reaper_total, &delta);
+        spinlock_release(&reaper_lock);
+    }
+}
+
+/**
+ * @brief creates the queue and starts the reaper thread.
+ */
+void reaper_bootstrap(void)
+{
+    int result;
+
+    reaper_wchan = wchan_create("reaper");
+    if (reaper_wchan == NULL)
+    {
+        panic("reaper: cannot create the queue\n");
+    }
+
+    result = thread_fork("reaper", NULL, reaper_thread, NULL, 0);
+    if (result)
+    {
+        panic("reaper: thread_fork failed: %s\n", strerror(result));
+    }
+}
+
+/**
+ * @brief hand an address space over to the reaper. The address space
+ * must not be used by any process anymore.
+ * 
+ * @param as 
+ * @param v ELF vnode of the process, kept open until as is destroyed
+ * @return true if the reaper will destroy as, false if the caller has
+ * to (reaper off or out of memory)
+ */
+bool reaper_defer(struct addrspace *as, struct vnode *v)
+{
+    struct reaper_job *job;
+
+    KASSERT(as != NULL);
+
+    if (!reaper_enabled)
+    {
+        return false;
+    }
+
+    job = kmalloc(sizeof(struct reaper_job));
+    if (job == NULL)
+    {
+        return false;
+    }
+    job->rj_as = as;
+    job->rj_vnode = v;
+    job->rj_next = NULL;
+    if (v != NULL)
+    {
+        VOP_INCREF(v);
+    }
+
+    spinlock_acquire(&reaper_lock);
+    if (reaper_tail == NULL)
+    {
+        reaper_head = job;
+    }
+    else
+    {
+        reaper_tail->rj_next = job;
+    }
+    reaper_tail = job;
+    reaper_pending++;
+    wchan_wakeone(reaper_wchan, &reaper_lock);
+    spinlock_release(&reaper_lock);
+
+    return true;
+}
+
+/**
+ * @brief turn the reaper on or off for the next exits. The address
+ * spaces already queued are destroyed anyway.
+ * 
+ * @param enabled 
+ */
+void reaper_set(bool enabled)
+{
+    reaper_enabled = enabled;
+}
+
+/**
+ * @brief record the latency of an exit, once its waiter is done with
+ * the process.
+ * 
+ * @param start time of the call to _exit
+ */
+void reaper_exit_done(const struct timespec *start)
+{
+    struct timespec now, delta;
+
+    gettime(&now);
+    timespec_sub(&now, start, &delta);
+
+    spinlock_acquire(&reaper_exit_lock);
+    reaper_exit_count++;
+    reaper_exit_last = delta;
+    reaper_add_time(&reaper_exit_total, &delta);
+    spinlock_release(&reaper_exit_lock);
+}
+
+/**
+ * @brief print the exit latency and the work of the reaper.
+ */
+void reaper_print_stats(void)
+{
+    unsigned count, done, pending;
+    struct timespec total, last, reaped;
+    uint64_t avg_us, reap_us;
+
+    spinlock_acquire(&reaper_exit_lock);
+    count = reaper_exit_count;
+    total = reaper_exit_total;
+    last = reaper_exit_last;
+    spinlock_release(&reaper_exit_lock);
+
+    spinlock_acquire(&reaper_lock);
+    done = reaper_done;
+    pending = reaper_pending;
+    reaped = reaper_total;
+    spinlock_release(&reaper_lock);
+
+    avg_us = 0;
+    if (count > 0)
+    {
+        avg_us = ((uint64_t)total.tv_sec * 1000000 + total.tv_nsec / 1000) / count;
+    }
+    reap_us = 0;
+    if (done > 0)
+    {
+        reap_us = ((uint64_t)reaped.tv_sec * 1000000 + reaped.tv_nsec / 1000) / done;
+    }
+
+    kprintf("exit: %u processes, waiter released after %llu us on average (last %llu us)\n",
+            count, (unsigned long long)avg_us,
+            (unsigned long long)last.tv_sec * 1000000 + last.tv_nsec / 1000);
+    kprintf("reaper: %s, %u address spaces destroyed in %llu us on average, %u pending\n",
+            reaper_enabled ? "on" : "off", done, (unsigned long long)reap_us, pending);
+}
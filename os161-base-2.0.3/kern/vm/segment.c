@@ -1,22 +1,76 @@
 #include <segment.h>
 #include <lib.h>
 #include <vm.h>
+#if OPT_MMAP
+#include <vnode.h>
+#endif
+#if OPT_MADVISE
+#include <kern/mman.h>
+#endif
+#if OPT_OBJCACHE
+#include <objcache.h>
+
+/*  one is created with every region and with every fork  */
+static struct objcache *segment_cache = NULL;
 
 /**
- * @brief allocates and initializes the segment data structure
+ * @brief create the cache of the segments. Every field is set by
+ * segment_create or segment_copy, so the objects need no constructor.
+ */
+void segment_bootstrap(void){
+    segment_cache = objcache_create("segment", sizeof(struct segment), NULL, NULL);
+    if (segment_cache == NULL) {
+        panic("segment_bootstrap: cannot create the segment cache\n");
+    }
+}
+#endif
+
+/**
+ * @brief takes the memory of a segment, from its cache if there is one
  * 
  * @return struct segment* 
  */
+static struct segment *segment_alloc(void){
+#if OPT_OBJCACHE
+    return objcache_alloc(segment_cache);
+#else
+    return kmalloc(sizeof(struct segment));
+#endif
+}
+
+/**
+ * @brief allocates and initializes the segment data structure
+ * 
+ * @return struct segment* NULL if out of memory
+ */
 struct segment *segment_create(void){
-    struct segment *seg = kmalloc(sizeof(struct segment));
+    struct segment *seg = segment_alloc();
 
-    KASSERT(seg != NULL);
+    if (seg == NULL) {
+        return NULL;
+    }
 
     seg->seg_elf_offset = 0;
     seg->seg_first_vaddr = 0;
     seg->seg_last_vaddr = 0;
     seg->seg_npages = 0;
     seg->seg_elf_size = 0;
+#if OPT_EAGERLOAD
+    seg->seg_eager = 0;
+#endif
+#if OPT_READAHEAD
+    seg->seg_ra_window = SEG_RA_INIT;
+    seg->seg_ra_issued = 0;
+    seg->seg_ra_hits = 0;
+#endif
+#if OPT_MMAP
+    seg->seg_vnode = NULL;
+    seg->seg_writable = false;
+    seg->seg_shared = false;
+#endif
+#if OPT_MADVISE
+    seg->seg_advice = MADV_NORMAL;
+#endif
     
     return seg;
 }
@@ -60,6 +114,32 @@ void segment_define(struct segment *seg, off_t elf_offset, vaddr_t base_vaddr, v
     seg->seg_elf_size = elfsize;
 }
 
+/**
+ * @brief allocates a copy of the given segment
+ * 
+ * @param seg 
+ * @return struct segment* NULL if out of memory
+ */
+struct segment *segment_copy(const struct segment *seg){
+    struct segment *copy;
+
+    KASSERT(seg != NULL);
+
+    copy = segment_alloc();
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    *copy = *seg;
+#if OPT_MMAP
+    if (copy->seg_vnode != NULL) {
+        VOP_INCREF(copy->seg_vnode);
+    }
+#endif
+
+    return copy;
+}
+
 /**
  * @brief deallocates the given segment
  * 
@@ -69,5 +149,14 @@ void segment_destroy(struct segment *seg){
     
     KASSERT(seg != NULL);
 
+#if OPT_MMAP
+    if (seg->seg_vnode != NULL) {
+        VOP_DECREF(seg->seg_vnode);
+    }
+#endif
+#if OPT_OBJCACHE
+    objcache_free(segment_cache, seg);
+#else
     kfree(seg);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <shrinker.h>
+#include "opt-stats.h"
+#if OPT_STATS
+#include <vmstats.h>
+#endif
+
+/*
+ * The registered shrinkers, sorted by level and, within a level, in
+ * registration order. They are registered at bootstrap and never
+ * removed.
+ */
+struct shrinker {
+    const char  *sh_name;
+    int         sh_level;           /*  SHRINK_*  */
+    unsigned    (*sh_shrink)(unsigned npages);
+    unsigned    sh_calls;
+    unsigned    sh_pages;           /*  given back to the coremap  */
+};
+
+static struct shrinker  shrinkers[SHRINKER_MAX];
+static unsigned         nshrinkers = 0;
+static struct spinlock  shrinker_lock = SPINLOCK_INITIALIZER;
+static bool             shrinker_running = false;  /*  one run at a time  */
+static unsigned         shrinker_runs = 0;
+static unsigned         shrinker_short = 0;     /*  runs which freed less than asked  */
+
+/**
+ * @brief add a shrinker, called by shrinker_run after those of the
+ * lower levels and those of the same level registered before it.
+ *
+ * @param name
+ * @param level
+ * @param shrink gives back memory and returns the pages freed
+ */
+void shrinker_register(const char *name, int level,
+                       unsigned (*shrink)(unsigned npages))
+{
+    unsigned i;
+
+    KASSERT(shrink != NULL);
+    KASSERT(level == SHRINK_OBJECTS || level == SHRINK_HEAP);
+
+    spinlock_acquire(&shrinker_lock);
+    if (nshrinkers == SHRINKER_MAX)
+    {
+        panic("shrinker_register: too many shrinkers\n");
+    }
+    for (i = nshrinkers; i > 0 && shrinkers[i - 1].sh_level > level; i--)
+    {
+        shrinkers[i] = shrinkers[i - 1];
+    }
+    shrinkers[i].sh_name = name;
+    shrinkers[i].sh_level = level;
+    shrinkers[i].sh_shrink = shrink;
+    shrinkers[i].sh_calls = 0;
+    shrinkers[i].sh_pages = 0;
+    nshrinkers++;
+    spinlock_release(&shrinker_lock);
+}
+
+/**
+ * @brief call the shrinkers in order until npages pages have been
+ * given back. If another run is in progress, or this is an allocation
+ * made by a shrinker, nothing is done.
+ *
+ * @param npages
+ * @return unsigned pages given back to the coremap
+ */
+unsigned shrinker_run(unsigned npages)
+{
+    unsigned i, n, freed, total;
+
+    spinlock_acquire(&shrinker_lock);
+    if (shrinker_running)
+    {
+        spinlock_release(&shrinker_lock);
+        return 0;
+    }
+    shrinker_running = true;
+    shrinker_runs++;
+    n = nshrinkers;
+    spinlock_release(&shrinker_lock);
+
+    total = 0;
+    for (i = 0; i < n && total < npages; i++)
+    {
+        freed = shrinkers[i].sh_shrink(npages - total);
+        total += freed;
+
+        spinlock_acquire(&shrinker_lock);
+        shrinkers[i].sh_calls++;
+        shrinkers[i].sh_pages += freed;
+        spinlock_release(&shrinker_lock);
+    }
+
+#if OPT_STATS
+    for (i = 0; i < total; i++)
+    {
+        vmstats_hit(VMSTAT_SHRINK_PAGES);
+    }
+#endif
+
+    spinlock_acquire(&shrinker_lock);
+    if (total < npages)
+    {
+        shrinker_short++;
+    }
+    shrinker_running = false;
+    spinlock_release(&shrinker_lock);
+
+    return total;
+}
+
+/**
+ * @brief print how many times each shrinker was called and the pages
+ * it gave back.
+ */
+void shrinker_print_stats(void)
+{
+    unsigned i;
+
+    spinlock_acquire(&shrinker_lock);
+    kprintf("Shrinkers: %u runs, %u short of the pages asked\n",
+            shrinker_runs, shrinker_short);
+    for (i = 0; i < nshrinkers; i++)
+    {
+        kprintf("  %-10s %u calls, %u pages freed\n",
+                shrinkers[i].sh_name, shrinkers[i].sh_calls, shrinkers[i].sh_pages);
+    }
+    spinlock_release(&shrinker_lock);
+}
@@ -1,8 +1,11 @@
 #include <swapfile.h>
-#include <bitmap.h>
+#include <swapmap.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <lib.h>
 #include <uio.h>
 #include <vfs.h>
+#include <device.h>
 #include <synch.h>
 #include <vm.h>
 #include <vnode.h>
@@ -11,51 +14,467 @@
 #include <vmstats.h>
 #endif
 
-static struct vnode *swapfile;
-static struct bitmap *swapmap;
+/*
+ * A swap area. File areas are accessed through VOP_READ/VOP_WRITE on
+ * the vnode, raw device areas (sa_device != NULL) straight through
+ * DEVOP_IO, with no filesystem in between.
+ */
+struct swap_area {
+    char            *sa_name;       /*  path of the file or name of the device  */
+    struct vnode    *sa_vnode;      /*  file vnode, or device vnode if raw      */
+    struct device   *sa_device;     /*  device of a raw area, NULL if file      */
+    int             sa_priority;    /*  higher priority areas are filled first  */
+    bool            sa_draining;    /*  being removed, no new allocations       */
+    unsigned        sa_npages;      /*  size of the area in pages               */
+    struct swapmap  *sa_map;        /*  slot allocator of the area              */
+    unsigned        sa_reads;       /*  pages read from the area                */
+    unsigned        sa_writes;      /*  pages written to the area               */
+};
+
+static struct swap_area *swap_areas[SWAP_MAX_AREAS];
+static unsigned swap_rr = 0;    /* round robin among areas of equal priority */
 static struct spinlock swaplock = SPINLOCK_INITIALIZER;
 
 
 /**
- * @brief creates the swap file and allocated the data
- * structures needed
- * 
+ * @brief do the I/O on the given area, at page granularity.
+ *
+ * @param sa
+ * @param ku
+ * @return int error
+ */
+static int swap_area_io(struct swap_area *sa, struct uio *ku)
+{
+    if (sa->sa_device != NULL)
+    {
+        return DEVOP_IO(sa->sa_device, ku);
+    }
+    if (ku->uio_rw == UIO_READ)
+    {
+        return VOP_READ(sa->sa_vnode, ku);
+    }
+    return VOP_WRITE(sa->sa_vnode, ku);
+}
+
+/**
+ * @brief choose an area and allocate npages contiguous slots in it.
+ * Areas are tried in order of decreasing priority; among the ones
+ * with the same priority, the starting point rotates so that they
+ * are filled evenly. Must be called holding swaplock.
+ *
+ * @param npages
+ * @param swap_index filled with the swap index of the first slot
+ * @return int 0 on success, ENOSPC if no area has room
+ */
+static int swap_alloc(unsigned npages, unsigned int *swap_index)
+{
+    struct swap_area *sa;
+    unsigned i, k, slot;
+    int prio, nextprio;
+    bool found;
+
+    KASSERT(spinlock_do_i_hold(&swaplock));
+
+    /* start from the highest priority among the usable areas */
+    found = false;
+    prio = 0;
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        sa = swap_areas[i];
+        if (sa != NULL && !sa->sa_draining && (!found || sa->sa_priority > prio))
+        {
+            prio = sa->sa_priority;
+            found = true;
+        }
+    }
+
+    while (found)
+    {
+        swap_rr++;
+        for (k = 0; k < SWAP_MAX_AREAS; k++)
+        {
+            i = (swap_rr + k) % SWAP_MAX_AREAS;
+            sa = swap_areas[i];
+            if (sa == NULL || sa->sa_draining || sa->sa_priority != prio)
+            {
+                continue;
+            }
+            if (swapmap_alloc_run(sa->sa_map, npages, &slot) == 0)
+            {
+                *swap_index = SWAP_INDEX(i, slot);
+                return 0;
+            }
+        }
+
+        /* all the areas of this priority are full, try the next one */
+        found = false;
+        nextprio = 0;
+        for (i = 0; i < SWAP_MAX_AREAS; i++)
+        {
+            sa = swap_areas[i];
+            if (sa != NULL && !sa->sa_draining && sa->sa_priority < prio &&
+                (!found || sa->sa_priority > nextprio))
+            {
+                nextprio = sa->sa_priority;
+                found = true;
+            }
+        }
+        prio = nextprio;
+    }
+
+    return ENOSPC;
+}
+
+/**
+ * @brief get the area of the given swap index, asserting the slot is in use.
+ *
+ * @param swap_index
+ * @return struct swap_area*
+ */
+static struct swap_area *swap_get_area(unsigned int swap_index)
+{
+    struct swap_area *sa;
+
+    KASSERT(SWAP_INDEX_AREA(swap_index) < SWAP_MAX_AREAS);
+
+    spinlock_acquire(&swaplock);
+    sa = swap_areas[SWAP_INDEX_AREA(swap_index)];
+    KASSERT(sa != NULL);
+    KASSERT(swapmap_isset(sa->sa_map, SWAP_INDEX_SLOT(swap_index)));
+    spinlock_release(&swaplock);
+
+    return sa;
+}
+
+/**
+ * @brief creates the default swap file and allocates the data
+ * structures needed. Further areas can be added at runtime with
+ * swap_add.
+ *
  */
 void swap_bootstrap(void)
 {
     int err;
-    char swapfile_name[] = SWAPFILE_NAME;
 
     KASSERT(SWAPFILE_SIZE % PAGE_SIZE == 0);
+    KASSERT(SWAPFILE_NPAGES <= SWAP_AREA_MAXPAGES);
 
-    err = vfs_open(swapfile_name, O_RDWR | O_CREAT | O_TRUNC, 0, &swapfile);
+    err = swap_add(SWAPFILE_NAME, SWAP_PRIO_FILE);
     if (err)
     {
         panic("Cannot open SWAPFILE");
     }
-    swapmap = bitmap_create(SWAPFILE_NPAGES);
 }
 
+/**
+ * @brief add a swap area. A name ending with ':' (e.g. "lhd0:") is a
+ * raw disk device, used as a whole; anything else is a file of
+ * SWAPFILE_SIZE bytes, created or truncated.
+ *
+ * @param name
+ * @param priority
+ * @return int error
+ */
+int swap_add(const char *name, int priority)
+{
+    struct swap_area *sa;
+    char *path;
+    size_t len;
+    unsigned i;
+    int err;
+
+    len = strlen(name);
+    if (len == 0)
+    {
+        return EINVAL;
+    }
+
+    sa = kmalloc(sizeof(struct swap_area));
+    if (sa == NULL)
+    {
+        return ENOMEM;
+    }
+    sa->sa_name = kstrdup(name);
+    if (sa->sa_name == NULL)
+    {
+        kfree(sa);
+        return ENOMEM;
+    }
+    sa->sa_priority = priority;
+    sa->sa_draining = false;
+    sa->sa_reads = 0;
+    sa->sa_writes = 0;
+    sa->sa_device = NULL;
+
+    if (name[len - 1] == ':')
+    {
+        /* raw device: detach it from the VFS and use it directly */
+        sa->sa_name[len - 1] = 0;
+        err = vfs_swapon(sa->sa_name, &sa->sa_vnode);
+        if (err)
+        {
+            goto fail;
+        }
+        sa->sa_device = sa->sa_vnode->vn_data;
+        KASSERT(sa->sa_device != NULL);
+        /* the name comes from the menu: refuse devices with odd blocks */
+        if (sa->sa_device->d_blocksize == 0 ||
+            PAGE_SIZE % sa->sa_device->d_blocksize != 0)
+        {
+            err = EINVAL;
+            goto fail_close;
+        }
+        sa->sa_npages = sa->sa_device->d_blocks / (PAGE_SIZE / sa->sa_device->d_blocksize);
+    }
+    else
+    {
+        /* vfs_open may destroy the path */
+        path = kstrdup(name);
+        if (path == NULL)
+        {
+            err = ENOMEM;
+            goto fail;
+        }
+        err = vfs_open(path, O_RDWR | O_CREAT | O_TRUNC, 0, &sa->sa_vnode);
+        kfree(path);
+        if (err)
+        {
+            goto fail;
+        }
+        sa->sa_npages = SWAPFILE_NPAGES;
+    }
+
+    if (sa->sa_npages > SWAP_AREA_MAXPAGES)
+    {
+        sa->sa_npages = SWAP_AREA_MAXPAGES;
+    }
+    if (sa->sa_npages == 0)
+    {
+        err = EINVAL;
+        goto fail_close;
+    }
+
+    sa->sa_map = swapmap_create(sa->sa_npages);
+    if (sa->sa_map == NULL)
+    {
+        err = ENOMEM;
+        goto fail_close;
+    }
+
+    spinlock_acquire(&swaplock);
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        if (swap_areas[i] == NULL)
+        {
+            swap_areas[i] = sa;
+            break;
+        }
+    }
+    spinlock_release(&swaplock);
+
+    if (i == SWAP_MAX_AREAS)
+    {
+        swapmap_destroy(sa->sa_map);
+        err = ENOSPC;
+        goto fail_close;
+    }
+
+    kprintf("swap: added %s (%u pages, priority %d)\n", name, sa->sa_npages, priority);
+    return 0;
+
+fail_close:
+    if (sa->sa_device != NULL)
+    {
+        VOP_DECREF(sa->sa_vnode);
+        vfs_swapoff(sa->sa_name);
+    }
+    else
+    {
+        vfs_close(sa->sa_vnode);
+    }
+fail:
+    kfree(sa->sa_name);
+    kfree(sa);
+    return err;
+}
+
+/**
+ * @brief release the resources of an area already out of swap_areas.
+ *
+ * @param sa
+ */
+static void swap_area_destroy(struct swap_area *sa)
+{
+    if (sa->sa_device != NULL)
+    {
+        VOP_DECREF(sa->sa_vnode);
+        vfs_swapoff(sa->sa_name);
+    }
+    else
+    {
+        vfs_close(sa->sa_vnode);
+    }
+    swapmap_destroy(sa->sa_map);
+    kfree(sa->sa_name);
+    kfree(sa);
+}
+
+/**
+ * @brief remove the draining areas whose last page has gone. The
+ * frees which empty them can be done holding cm_spinlock, so they
+ * are only removed here, from the swap calls which can sleep.
+ *
+ */
+static void swap_reap_drained(void)
+{
+    struct swap_area *sa;
+    unsigned i;
+
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        spinlock_acquire(&swaplock);
+        sa = swap_areas[i];
+        if (sa == NULL || !sa->sa_draining || sa->sa_map->sm_nfree != sa->sa_npages)
+        {
+            spinlock_release(&swaplock);
+            continue;
+        }
+        swap_areas[i] = NULL;
+        spinlock_release(&swaplock);
+
+        kprintf("swap: removed %s%s, drained\n", sa->sa_name,
+                sa->sa_device != NULL ? ":" : "");
+        swap_area_destroy(sa);
+    }
+}
 
 /**
- * @brief deletes the swap file and frees the data
+ * @brief remove a swap area. If some pages still live in the area, it
+ * is only marked as draining: nothing new is written there, and it is
+ * removed by swap_reap_drained once its pages have been swapped in or
+ * freed (or by a new call once it is empty).
+ *
+ * @param name as given to swap_add
+ * @return int 0 if removed, EBUSY if draining, ENOENT if not found
+ */
+int swap_remove(const char *name)
+{
+    struct swap_area *sa;
+    char *key;
+    size_t len;
+    unsigned i;
+    bool raw;
+
+    swap_reap_drained();
+
+    len = strlen(name);
+    raw = len > 0 && name[len - 1] == ':';
+
+    /* raw areas are stored without the trailing ':' */
+    key = kstrdup(name);
+    if (key == NULL)
+    {
+        return ENOMEM;
+    }
+    if (raw)
+    {
+        key[len - 1] = 0;
+    }
+
+    spinlock_acquire(&swaplock);
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        sa = swap_areas[i];
+        if (sa != NULL && (sa->sa_device != NULL) == raw && !strcmp(sa->sa_name, key))
+        {
+            break;
+        }
+    }
+    kfree(key);
+
+    if (i == SWAP_MAX_AREAS)
+    {
+        spinlock_release(&swaplock);
+        return ENOENT;
+    }
+
+    if (sa->sa_map->sm_nfree != sa->sa_npages)
+    {
+        sa->sa_draining = true;
+        spinlock_release(&swaplock);
+        return EBUSY;
+    }
+
+    swap_areas[i] = NULL;
+    spinlock_release(&swaplock);
+
+    swap_area_destroy(sa);
+    return 0;
+}
+
+/**
+ * @brief print usage and I/O counters of every swap area.
+ *
+ */
+void swap_print_areas(void)
+{
+    struct swap_area *sa;
+    unsigned i;
+
+    swap_reap_drained();
+
+    kprintf("---------------------------\n");
+    kprintf("SWAP AREAS\n");
+    kprintf("---------------------------\n");
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        sa = swap_areas[i];
+        if (sa == NULL)
+        {
+            continue;
+        }
+        kprintf("%s%s: %s, priority %d, %u/%u pages used, %u reads, %u writes%s\n",
+                sa->sa_name, sa->sa_device != NULL ? ":" : "",
+                sa->sa_device != NULL ? "raw device" : "file",
+                sa->sa_priority,
+                sa->sa_npages - sa->sa_map->sm_nfree, sa->sa_npages,
+                sa->sa_reads, sa->sa_writes,
+                sa->sa_draining ? " (draining)" : "");
+    }
+    kprintf("---------------------------\n");
+}
+
+/**
+ * @brief closes all the swap areas and frees the data
  * structures needed
- * 
+ *
  */
 void swap_destroy(void)
 {
-    vfs_close(swapfile);
-    bitmap_destroy(swapmap);
-  
+    struct swap_area *sa;
+    unsigned i;
+
+    for (i = 0; i < SWAP_MAX_AREAS; i++)
+    {
+        spinlock_acquire(&swaplock);
+        sa = swap_areas[i];
+        swap_areas[i] = NULL;
+        spinlock_release(&swaplock);
+
+        if (sa != NULL)
+        {
+            swap_area_destroy(sa);
+        }
+    }
 }
 
 
 /**
- * @brief move a page from the swap file to memory at page_paddr 
+ * @brief move a page from the swap area to memory at page_paddr
  * physical address
- * 
- * @param page_paddr 
- * @param swap_index 
+ *
+ * @param page_paddr
+ * @param swap_index
  */
 void swap_in(paddr_t page_paddr, unsigned int swap_index)
 {
@@ -63,6 +482,8 @@ void swap_in(paddr_t page_paddr, unsigned int swap_index)
     off_t swap_offset;
     struct iovec iov;
     struct uio ku;
+    struct swap_area *sa;
+    bool draining;
 
 #if OPT_STATS
     vmstats_hit(VMSTAT_PAGE_FAULT_DISK);
@@ -70,15 +491,12 @@ void swap_in(paddr_t page_paddr, unsigned int swap_index)
 #endif
 
     KASSERT(page_paddr % PAGE_SIZE == 0);
-    KASSERT(swap_index < SWAPFILE_NPAGES);
-    spinlock_acquire(&swaplock);
-    KASSERT(bitmap_isset(swapmap, swap_index));
-    spinlock_release(&swaplock);
+    sa = swap_get_area(swap_index);
 
-    swap_offset = swap_index * PAGE_SIZE;
+    swap_offset = (off_t)SWAP_INDEX_SLOT(swap_index) * PAGE_SIZE;
 
     uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(page_paddr), PAGE_SIZE, swap_offset, UIO_READ);
-    err = VOP_READ(swapfile, &ku);
+    err = swap_area_io(sa, &ku);
     if (err)
     {
         panic("Error swapping in\n");
@@ -89,61 +507,168 @@ void swap_in(paddr_t page_paddr, unsigned int swap_index)
 	}
 
     spinlock_acquire(&swaplock);
-    bitmap_unmark(swapmap, swap_index);
+    sa->sa_reads++;
+    swapmap_free(sa->sa_map, SWAP_INDEX_SLOT(swap_index));
+    /* once released, sa can be removed by another swap_in */
+    draining = sa->sa_draining;
     spinlock_release(&swaplock);
+
+    if (draining)
+    {
+        swap_reap_drained();
+    }
 }
 
 /**
- * @brief move a page from memory to swap file and
- * return the index within the swapfile
- * 
- * @param page_paddr 
- * @return unsigned int index of the page within the swap file
+ * @brief move a page from memory to a swap area and
+ * return its swap index
+ *
+ * @param page_paddr
+ * @return unsigned int swap index of the page
  */
 unsigned int swap_out(paddr_t page_paddr)
 {
-    int err;
     unsigned int swap_index;
-    off_t swap_offset;
-    struct iovec iov;
-    struct uio ku;
 
-#if OPT_STATS
-    vmstats_hit(VMSTAT_SWAP_WRITE);
+    if (swap_out_cluster(&page_paddr, 1, &swap_index) != 0)
+    {
+        panic("Out of swap space\n");
+    }
+
+    return swap_index;
+}
+
+/**
+ * @brief free the given swap index.
+ * This function only mark the swap page as not used,
+ * not any actual deallocation is done .
+ *
+ * @param swap_index
+ */
+void swap_free(unsigned int swap_index)
+{
+    struct swap_area *sa;
+
+    spinlock_acquire(&swaplock);
+    sa = swap_areas[SWAP_INDEX_AREA(swap_index)];
+    KASSERT(sa != NULL);
+    swapmap_free(sa->sa_map, SWAP_INDEX_SLOT(swap_index));
+    spinlock_release(&swaplock);
+}
+
+#if OPT_FASTEXIT
+/**
+ * @brief start freeing a batch of swap indexes with swap_free_locked,
+ * under a single acquisition of the swap lock. Can be called holding
+ * cm_spinlock. No I/O and no other swap call may be done until
+ * swap_free_end.
+ *
+ */
+void swap_free_begin(void)
+{
+    spinlock_acquire(&swaplock);
+}
+
+/**
+ * @brief same as swap_free, between swap_free_begin and swap_free_end.
+ *
+ * @param swap_index
+ */
+void swap_free_locked(unsigned int swap_index)
+{
+    struct swap_area *sa;
+
+    KASSERT(spinlock_do_i_hold(&swaplock));
+
+    sa = swap_areas[SWAP_INDEX_AREA(swap_index)];
+    KASSERT(sa != NULL);
+    swapmap_free(sa->sa_map, SWAP_INDEX_SLOT(swap_index));
+}
+
+/**
+ * @brief end a batch started by swap_free_begin.
+ *
+ */
+void swap_free_end(void)
+{
+    spinlock_release(&swaplock);
+}
 #endif
 
-    KASSERT(page_paddr % PAGE_SIZE == 0);
+/**
+ * @brief add a reference to the given swap index, shared by one
+ * more page table entry. Each reference is dropped by a swap_in or
+ * a swap_free.
+ *
+ * @param swap_index
+ */
+void swap_dup(unsigned int swap_index)
+{
+    struct swap_area *sa;
+
+    spinlock_acquire(&swaplock);
+    sa = swap_areas[SWAP_INDEX_AREA(swap_index)];
+    KASSERT(sa != NULL);
+    swapmap_dup(sa->sa_map, SWAP_INDEX_SLOT(swap_index));
+    spinlock_release(&swaplock);
+}
+
+/**
+ * @brief move npages frames to a contiguous run of one swap area
+ * with a single write, and return the index of the first one.
+ * The i-th frame ends up at index first_index + i.
+ *
+ * @param pages physical addresses of the frames
+ * @param npages
+ * @param first_index
+ * @return int 0 on success, ENOSPC if no area has a free run of npages
+ */
+int swap_out_cluster(const paddr_t *pages, unsigned npages, unsigned int *first_index)
+{
+    int err;
+    unsigned i;
+    struct iovec iov[SWAP_CLUSTER_MAX];
+    struct uio ku;
+    struct swap_area *sa = NULL;
+
+    KASSERT(npages > 0 && npages <= SWAP_CLUSTER_MAX);
 
     spinlock_acquire(&swaplock);
-    err = bitmap_alloc(swapmap, &swap_index);
+    err = swap_alloc(npages, first_index);
+    if (!err)
+    {
+        sa = swap_areas[SWAP_INDEX_AREA(*first_index)];
+        sa->sa_writes += npages;
+    }
     spinlock_release(&swaplock);
     if (err)
     {
-        panic("Out of swap space\n");
+        return err;
+    }
+
+    for (i = 0; i < npages; i++)
+    {
+        KASSERT(pages[i] % PAGE_SIZE == 0);
+        iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pages[i]);
+        iov[i].iov_len = PAGE_SIZE;
+#if OPT_STATS
+        vmstats_hit(VMSTAT_SWAP_WRITE);
+#endif
     }
 
-    swap_offset = swap_index * PAGE_SIZE;
+    ku.uio_iov = iov;
+    ku.uio_iovcnt = npages;
+    ku.uio_offset = (off_t)SWAP_INDEX_SLOT(*first_index) * PAGE_SIZE;
+    ku.uio_resid = npages * PAGE_SIZE;
+    ku.uio_segflg = UIO_SYSSPACE;
+    ku.uio_rw = UIO_WRITE;
+    ku.uio_space = NULL;
 
-    uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(page_paddr), PAGE_SIZE, swap_offset, UIO_WRITE);
-    err = VOP_WRITE(swapfile, &ku);
+    err = swap_area_io(sa, &ku);
     if (err)
     {
         panic("Error swapping out\n");
     }
 
-    return swap_index;
-}
-
-/**
- * @brief free the given entry of the swap file. 
- * This function only mark the swap page as not used,
- * not any actual deallocation is done .
- * 
- * @param swap_index 
- */ 
-void swap_free(unsigned int swap_index)
-{
-    spinlock_acquire(&swaplock);
-    bitmap_unmark(swapmap, swap_index);
-    spinlock_release(&swaplock);
+    return 0;
 }
@@ -0,0 +1,332 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <swapmap.h>
+
+#define SWAPMAP_FULLWORD 0xffffffff
+
+/**
+ * @brief index of the first zero bit of a word which is not full.
+ * Binary search on the complemented word, the compiler builtins
+ * would need libgcc, which the kernel does not link.
+ *
+ * @param w
+ * @return unsigned
+ */
+static
+unsigned
+swapmap_ffz(uint32_t w)
+{
+    unsigned n = 0;
+    uint32_t x = ~w;
+
+    KASSERT(x != 0);
+
+    if ((x & 0xffff) == 0) { n += 16; x >>= 16; }
+    if ((x & 0xff) == 0)   { n += 8;  x >>= 8;  }
+    if ((x & 0xf) == 0)    { n += 4;  x >>= 4;  }
+    if ((x & 0x3) == 0)    { n += 2;  x >>= 2;  }
+    if ((x & 0x1) == 0)    { n += 1; }
+
+    return n;
+}
+
+/**
+ * @brief mark the slot as used and move the cursor right after it.
+ *
+ * @param sm
+ * @param slot
+ */
+static
+void
+swapmap_mark(struct swapmap *sm, unsigned slot)
+{
+    uint32_t mask = (uint32_t)1 << (slot % SWAPMAP_WORD_SLOTS);
+
+    KASSERT(slot < sm->sm_nslots);
+    KASSERT((sm->sm_map[slot / SWAPMAP_WORD_SLOTS] & mask) == 0);
+    KASSERT(sm->sm_cluster_free[slot / SWAPMAP_CLUSTER_SLOTS] > 0);
+
+    sm->sm_map[slot / SWAPMAP_WORD_SLOTS] |= mask;
+    sm->sm_cluster_free[slot / SWAPMAP_CLUSTER_SLOTS]--;
+    sm->sm_nfree--;
+    sm->sm_cursor = (slot + 1) % sm->sm_nslots;
+}
+
+/**
+ * @brief allocates the allocator for nslots swap slots, all free.
+ *
+ * @param nslots
+ * @return struct swapmap*, NULL if out of memory
+ */
+struct swapmap *
+swapmap_create(unsigned nslots)
+{
+    struct swapmap *sm;
+    unsigned i, last;
+
+    KASSERT(nslots > 0);
+
+    sm = kmalloc(sizeof(struct swapmap));
+    if (sm == NULL) {
+        return NULL;
+    }
+
+    sm->sm_nslots = nslots;
+    sm->sm_nwords = DIVROUNDUP(nslots, SWAPMAP_WORD_SLOTS);
+    sm->sm_nclusters = DIVROUNDUP(nslots, SWAPMAP_CLUSTER_SLOTS);
+    sm->sm_nfree = nslots;
+    sm->sm_cursor = 0;
+
+    sm->sm_map = kmalloc(sm->sm_nwords * sizeof(uint32_t));
+    sm->sm_cluster_free = kmalloc(sm->sm_nclusters * sizeof(uint16_t));
+    sm->sm_refs = kmalloc(nslots * sizeof(uint16_t));
+    if (sm->sm_map == NULL || sm->sm_cluster_free == NULL || sm->sm_refs == NULL) {
+        swapmap_destroy(sm);
+        return NULL;
+    }
+
+    bzero(sm->sm_map, sm->sm_nwords * sizeof(uint32_t));
+    bzero(sm->sm_refs, nslots * sizeof(uint16_t));
+    for (i = 0; i < sm->sm_nclusters; i++) {
+        sm->sm_cluster_free[i] = SWAPMAP_CLUSTER_SLOTS;
+    }
+
+    /* the last cluster may be shorter */
+    last = nslots % SWAPMAP_CLUSTER_SLOTS;
+    if (last != 0) {
+        sm->sm_cluster_free[sm->sm_nclusters - 1] = last;
+    }
+
+    /* mark the leftover bits of the last word as used */
+    for (i = nslots; i < sm->sm_nwords * SWAPMAP_WORD_SLOTS; i++) {
+        sm->sm_map[i / SWAPMAP_WORD_SLOTS] |= (uint32_t)1 << (i % SWAPMAP_WORD_SLOTS);
+    }
+
+    return sm;
+}
+
+/**
+ * @brief deallocates the allocator.
+ *
+ * @param sm
+ */
+void
+swapmap_destroy(struct swapmap *sm)
+{
+    KASSERT(sm != NULL);
+
+    if (sm->sm_map != NULL) {
+        kfree(sm->sm_map);
+    }
+    if (sm->sm_cluster_free != NULL) {
+        kfree(sm->sm_cluster_free);
+    }
+    if (sm->sm_refs != NULL) {
+        kfree(sm->sm_refs);
+    }
+    kfree(sm);
+}
+
+/**
+ * @brief allocate one slot, searching next-fit from the cursor.
+ * Clusters with no free slot are skipped using their counter,
+ * full words are skipped with a single comparison.
+ *
+ * @param sm
+ * @param slot filled with the allocated slot
+ * @return int 0 on success, ENOSPC if the swap area is full
+ */
+int
+swapmap_alloc(struct swapmap *sm, unsigned *slot)
+{
+    unsigned k, c, w, firstword, lastword;
+    unsigned startc;
+
+    KASSERT(sm != NULL);
+
+    if (sm->sm_nfree == 0) {
+        return ENOSPC;
+    }
+
+    startc = sm->sm_cursor / SWAPMAP_CLUSTER_SLOTS;
+
+    /*
+     * The cluster of the cursor is visited twice: first from the
+     * cursor to its end, then (after wrapping around) as a whole.
+     */
+    for (k = 0; k <= sm->sm_nclusters; k++) {
+        c = (startc + k) % sm->sm_nclusters;
+        if (sm->sm_cluster_free[c] == 0) {
+            continue;
+        }
+
+        firstword = (k == 0) ? sm->sm_cursor / SWAPMAP_WORD_SLOTS : c * SWAPMAP_CLUSTER_WORDS;
+        lastword = (c + 1) * SWAPMAP_CLUSTER_WORDS;
+        if (lastword > sm->sm_nwords) {
+            lastword = sm->sm_nwords;
+        }
+
+        for (w = firstword; w < lastword; w++) {
+            if (sm->sm_map[w] != SWAPMAP_FULLWORD) {
+                *slot = w * SWAPMAP_WORD_SLOTS + swapmap_ffz(sm->sm_map[w]);
+                swapmap_mark(sm, *slot);
+                return 0;
+            }
+        }
+    }
+
+    panic("swapmap: free counters out of sync\n");
+    return ENOSPC;
+}
+
+/**
+ * @brief search a run of npages free slots within [from, sm_nslots).
+ *
+ * @param sm
+ * @param from
+ * @param npages
+ * @param first filled with the first slot of the run
+ * @return true if found
+ */
+static
+bool
+swapmap_find_run(struct swapmap *sm, unsigned from, unsigned npages, unsigned *first)
+{
+    unsigned slot, runlen;
+    uint32_t word;
+
+    runlen = 0;
+    slot = from;
+    while (slot < sm->sm_nslots) {
+        if (slot % SWAPMAP_CLUSTER_SLOTS == 0 &&
+            sm->sm_cluster_free[slot / SWAPMAP_CLUSTER_SLOTS] == 0) {
+            runlen = 0;
+            slot += SWAPMAP_CLUSTER_SLOTS;
+            continue;
+        }
+
+        word = sm->sm_map[slot / SWAPMAP_WORD_SLOTS];
+        if (slot % SWAPMAP_WORD_SLOTS == 0 && word == SWAPMAP_FULLWORD) {
+            runlen = 0;
+            slot += SWAPMAP_WORD_SLOTS;
+            continue;
+        }
+        if (slot % SWAPMAP_WORD_SLOTS == 0 && word == 0 &&
+            runlen + SWAPMAP_WORD_SLOTS < npages) {
+            runlen += SWAPMAP_WORD_SLOTS;
+            slot += SWAPMAP_WORD_SLOTS;
+            continue;
+        }
+
+        if (word & ((uint32_t)1 << (slot % SWAPMAP_WORD_SLOTS))) {
+            runlen = 0;
+        }
+        else {
+            runlen++;
+            if (runlen == npages) {
+                *first = slot + 1 - npages;
+                return true;
+            }
+        }
+        slot++;
+    }
+
+    return false;
+}
+
+/**
+ * @brief allocate npages contiguous slots, to be used for clustered
+ * writes. The search starts from the cursor and wraps around once.
+ *
+ * @param sm
+ * @param npages
+ * @param first filled with the first slot of the run
+ * @return int 0 on success, ENOSPC if there is no such run
+ */
+int
+swapmap_alloc_run(struct swapmap *sm, unsigned npages, unsigned *first)
+{
+    unsigned i;
+
+    KASSERT(sm != NULL);
+    KASSERT(npages > 0);
+
+    if (npages == 1) {
+        return swapmap_alloc(sm, first);
+    }
+
+    if (sm->sm_nfree < npages) {
+        return ENOSPC;
+    }
+
+    if (!swapmap_find_run(sm, sm->sm_cursor, npages, first) &&
+        !swapmap_find_run(sm, 0, npages, first)) {
+        return ENOSPC;
+    }
+
+    for (i = 0; i < npages; i++) {
+        swapmap_mark(sm, *first + i);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief drop a reference to the given slot, releasing it if it
+ * was the last one.
+ *
+ * @param sm
+ * @param slot
+ */
+void
+swapmap_free(struct swapmap *sm, unsigned slot)
+{
+    uint32_t mask = (uint32_t)1 << (slot % SWAPMAP_WORD_SLOTS);
+
+    KASSERT(sm != NULL);
+    KASSERT(slot < sm->sm_nslots);
+    KASSERT(sm->sm_map[slot / SWAPMAP_WORD_SLOTS] & mask);
+
+    if (sm->sm_refs[slot] > 0) {
+        sm->sm_refs[slot]--;
+        return;
+    }
+
+    sm->sm_map[slot / SWAPMAP_WORD_SLOTS] &= ~mask;
+    sm->sm_cluster_free[slot / SWAPMAP_CLUSTER_SLOTS]++;
+    sm->sm_nfree++;
+}
+
+/**
+ * @brief add a reference to a slot in use.
+ *
+ * @param sm
+ * @param slot
+ */
+void
+swapmap_dup(struct swapmap *sm, unsigned slot)
+{
+    KASSERT(sm != NULL);
+    KASSERT(slot < sm->sm_nslots);
+    KASSERT(swapmap_isset(sm, slot));
+    KASSERT(sm->sm_refs[slot] < 0xffff);
+
+    sm->sm_refs[slot]++;
+}
+
+/**
+ * @brief check whether the slot is in use.
+ *
+ * @param sm
+ * @param slot
+ * @return true if used
+ */
+bool
+swapmap_isset(struct swapmap *sm, unsigned slot)
+{
+    KASSERT(sm != NULL);
+    KASSERT(slot < sm->sm_nslots);
+
+    return (sm->sm_map[slot / SWAPMAP_WORD_SLOTS] & ((uint32_t)1 << (slot % SWAPMAP_WORD_SLOTS))) != 0;
+}
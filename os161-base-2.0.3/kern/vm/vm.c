@@ -17,6 +17,60 @@
 #include <swapfile.h>
 #include "opt-stats.h"
 #include "opt-noswap_rdonly.h"
+#include "opt-uniformfill.h"
+#include "opt-ksm.h"
+#include "opt-sharedtext.h"
+#include "opt-readahead.h"
+#include "opt-eagerload.h"
+#include "opt-launchprof.h"
+#include "opt-fork.h"
+#include "opt-stackgrow.h"
+#include "opt-mmap.h"
+#include "opt-stride.h"
+#include "opt-zeropage.h"
+#include "opt-fastexit.h"
+#include "opt-pin.h"
+#include "opt-pagebusy.h"
+#include "opt-asrwlock.h"
+#include "opt-vmalloc.h"
+#include "opt-objcache.h"
+#include "opt-shrinker.h"
+#include "opt-cpucache.h"
+
+#if OPT_SHAREDTEXT
+#include <pcache.h>
+#endif
+
+#if OPT_KSM
+#include <ksm.h>
+#endif
+
+#if OPT_LAUNCHPROF
+#include <profile.h>
+#endif
+
+#if OPT_MMAP || OPT_PIN || OPT_OBJCACHE
+#include <segment.h>
+#endif
+#if OPT_MMAP
+#include <mmap.h>
+#endif
+
+#if OPT_FASTEXIT
+#include <reaper.h>
+#endif
+#if OPT_SHRINKER
+#include <shrinker.h>
+#if OPT_OBJCACHE
+#include <objcache.h>
+#endif
+#endif
+#if OPT_ASRWLOCK
+#include <synch.h>
+#endif
+#if OPT_VMALLOC
+#include <vmalloc.h>
+#endif
 
 #if OPT_STATS
 #include <vmstats.h>
@@ -26,12 +80,64 @@
 /* under vm, always have 72k of user stack */
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 
+#if OPT_ZEROPAGE
+/*	frame of zeroes mapped read-only by every page read before written	*/
+static paddr_t vm_zero_paddr;
+#endif
+
 void
 vm_bootstrap(void)
 {
+#if OPT_ZEROPAGE
+	vaddr_t zero;
+#endif
+
+	pt_bootstrap();
+	coremap_pin_bootstrap();
 #if OPT_SWAP
 	swap_bootstrap();
 #endif
+#if OPT_SHAREDTEXT
+	pcache_bootstrap();
+#endif
+#if OPT_KSM
+	ksm_bootstrap();
+#endif
+#if OPT_MMAP
+	mmap_bootstrap();
+#endif
+#if OPT_FASTEXIT
+	reaper_bootstrap();
+#endif
+#if OPT_PAGEBUSY
+	pt_busy_bootstrap();
+#endif
+#if OPT_STRIDE
+	as_stride_bootstrap();
+#endif
+#if OPT_VMALLOC
+	vmalloc_bootstrap();
+#endif
+#if OPT_OBJCACHE
+	as_bootstrap();
+	segment_bootstrap();
+#endif
+#if OPT_SHRINKER
+	/*	the objects first, then the heap pages they were keeping	*/
+	shrinker_register("rmap", SHRINK_OBJECTS, coremap_shrink);
+#if OPT_OBJCACHE
+	shrinker_register("objcache", SHRINK_OBJECTS, objcache_shrink);
+#endif
+#if OPT_CPUCACHE
+	shrinker_register("kmalloc", SHRINK_HEAP, kheap_shrink);
+#endif
+#endif
+#if OPT_ZEROPAGE
+	/*	a kernel page, it is never chosen as a victim	*/
+	zero = alloc_kpages(1);
+	bzero((void *)zero, PAGE_SIZE);
+	vm_zero_paddr = KVADDR_TO_PADDR(zero);
+#endif
 }
 
 /*
@@ -122,20 +228,273 @@ alloc_upage(struct pt_entry *pt_row){
 }
 
 /**
- * @brief deallocate the given page for the user.
+ * @brief deallocate the given page for the user. If the frame is
+ * shared only the reference of pt_row is dropped.
  * 
  * @param addr 
+ * @param pt_row 
  */
 
-void free_upage(paddr_t addr){
-	freeppages(addr);
+void free_upage(paddr_t addr, struct pt_entry *pt_row){
+	coremap_put_upage(addr, pt_row);
 };
 
+#if OPT_PIN
+/**
+ * @brief fault in the pages of a user range of curproc and pin their
+ * frames, so that they are neither evicted nor merged until vm_unpin.
+ * The kernel can then read or write them through their kernel
+ * addresses, with no fault. Pages pinned for writing are made private
+ * (and dirty, for a file mapping) first. Pages only read may share
+ * the zero frame, which is not pinned.
+ * 
+ * @param start user address
+ * @param len not 0, at most VM_PIN_MAXPAGES pages from the page of start
+ * @param write the kernel is going to write the pages
+ * @param frames filled with the frame of each page
+ * @return int 0 on success, EFAULT if a page cannot be accessed as
+ * requested; nothing is left pinned on failure
+ */
+int
+vm_pin(vaddr_t start, size_t len, bool write, paddr_t *frames)
+{
+	struct addrspace *as;
+	struct pt_entry *pt_row;
+	vaddr_t first, page;
+	unsigned i, npages;
+	int seg_type, result;
+	bool readonly, pinned;
+#if OPT_MMAP
+	struct segment *mapping;
+#endif
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+	KASSERT(len > 0);
+
+	if(start + len < start || start + len > USERSPACETOP)
+	{
+		return EFAULT;
+	}
+	first = start & PAGE_FRAME;
+	npages = (ROUNDUP(start + len, PAGE_SIZE) - first) / PAGE_SIZE;
+	KASSERT(npages <= VM_PIN_MAXPAGES);
+
+	/**
+	 * the whole range is checked before anything is pinned: a page
+	 * out of every region is left to vm_fault, which either grows
+	 * the stack or kills the process, as for a copyin.
+	 */
+	for(i = 0, page = first; i < npages; i++, page += PAGE_SIZE)
+	{
+#if OPT_ASRWLOCK
+		/*	vm_fault takes the lock itself	*/
+		rwlock_acquire_read(as->as_lock);
+#endif
+		seg_type = as_get_segment_type(as, page);
+		if(seg_type == 0)
+		{
+#if OPT_ASRWLOCK
+			rwlock_release_read(as->as_lock);
+#endif
+			result = vm_fault(write ? VM_FAULT_WRITE : VM_FAULT_READ, page);
+			if(result)
+			{
+				return result;
+			}
+#if OPT_ASRWLOCK
+			rwlock_acquire_read(as->as_lock);
+#endif
+			seg_type = as_get_segment_type(as, page);
+		}
+		readonly = seg_type == SEGMENT_TEXT;
+#if OPT_MMAP
+		mapping = seg_type == SEGMENT_MMAP ? as_get_mapping(as, page) : NULL;
+		if(mapping != NULL && !mapping->seg_writable)
+		{
+			readonly = true;
+		}
+#endif
+#if OPT_ASRWLOCK
+		rwlock_release_read(as->as_lock);
+#endif
+		if(write && readonly)
+		{
+			return EFAULT;
+		}
+	}
+
+	for(i = 0, page = first; i < npages; i++, page += PAGE_SIZE)
+	{
+		/*	the page can be evicted between the fault and the pin	*/
+		do
+		{
+			/*	vm_fault inserts a new tlb entry for the page	*/
+			tlb_remove_by_vaddr(page);
+			result = vm_fault(write ? VM_FAULT_WRITE : VM_FAULT_READ, page);
+			if(result)
+			{
+				vm_unpin(frames, i);
+				return result;
+			}
+
+			pinned = false;
+#if OPT_ASRWLOCK
+			rwlock_acquire_read(as->as_lock);
+#endif
+			pt_row = pt_get_entry(as, page);
+			if(pt_row == NULL)
+			{
+#if OPT_ASRWLOCK
+				rwlock_release_read(as->as_lock);
+#endif
+				vm_unpin(frames, i);
+				return ENOMEM;
+			}
+			spinlock_acquire(&cm_spinlock);
+			switch(pt_row->pt_status)
+			{
+#if OPT_NOSWAP_RDONLY
+				case IN_MEMORY_RDONLY:
+#endif
+				case IN_MEMORY:
+					/*	merged again in the meantime	*/
+					if(write && pt_row->pt_cow)
+					{
+						break;
+					}
+					frames[i] = pt_row->pt_frame_index * PAGE_SIZE;
+					coremap_pin(frames[i]);
+					pinned = true;
+					break;
+#if OPT_ZEROPAGE
+				case IN_ZERO:
+					if(!write)
+					{
+						frames[i] = vm_zero_paddr;
+						pinned = true;
+					}
+					break;
+#endif
+				default:
+					break;
+			}
+			spinlock_release(&cm_spinlock);
+			pt_put_entry(as, page);
+#if OPT_ASRWLOCK
+			rwlock_release_read(as->as_lock);
+#endif
+		} while(!pinned);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief drop the pins taken by vm_pin.
+ * 
+ * @param frames 
+ * @param npages 
+ */
+void
+vm_unpin(const paddr_t *frames, unsigned npages)
+{
+	unsigned i;
+
+	spinlock_acquire(&cm_spinlock);
+	for(i = 0; i < npages; i++)
+	{
+#if OPT_ZEROPAGE
+		if(frames[i] == vm_zero_paddr)
+		{
+			continue;
+		}
+#endif
+		coremap_unpin(frames[i]);
+	}
+	spinlock_release(&cm_spinlock);
+}
+#endif
+
+#if OPT_KSM || OPT_FORK
+/**
+ * @brief give the entry a private copy of its shared frame before
+ * it is written. If the other sharers went away in the meantime the
+ * frame is simply made writable again.
+ * 
+ * @param pt_row 
+ * @param vaddr virtual address of the page
+ */
+static
+void
+vm_break_cow(struct pt_entry *pt_row, vaddr_t vaddr)
+{
+	paddr_t old_paddr, new_paddr;
+	struct cm_rmap *node;
+
+	/**
+	 * fast path, the frame is not shared anymore. The read-only
+	 * entry which faulted is dropped on every path, as tlb_insert
+	 * does not look for an entry of the same page.
+	 */
+	spinlock_acquire(&cm_spinlock);
+	if(pt_row->pt_cow && coremap_refcount(pt_row->pt_frame_index * PAGE_SIZE) == 1)
+	{
+		pt_row->pt_cow = 0;
+	}
+	if(!pt_row->pt_cow)
+	{
+		tlb_remove_by_vaddr(vaddr);
+		spinlock_release(&cm_spinlock);
+		return;
+	}
+	spinlock_release(&cm_spinlock);
+
+	/**
+	 * the copy is allocated as a kernel page, so that it cannot
+	 * be chosen as a victim before it has been filled.
+	 */
+	new_paddr = getppages(1, NULL);
+
+	spinlock_acquire(&cm_spinlock);
+	old_paddr = pt_row->pt_frame_index * PAGE_SIZE;
+	if(pt_row->pt_status != IN_MEMORY || !pt_row->pt_cow ||
+	   coremap_refcount(old_paddr) == 1)
+	{
+		/*	raced with a swap out or an unshare, the access is retried	*/
+		pt_row->pt_cow = pt_row->pt_status == IN_MEMORY && pt_row->pt_cow &&
+			coremap_refcount(old_paddr) > 1;
+		tlb_remove_by_vaddr(vaddr);
+		spinlock_release(&cm_spinlock);
+		freeppages(new_paddr);
+		return;
+	}
+
+	memcpy((void *)PADDR_TO_KVADDR(new_paddr), (void *)PADDR_TO_KVADDR(old_paddr), PAGE_SIZE);
+	node = coremap_unshare(old_paddr, pt_row);
+	coremap_set_ptentry(new_paddr, pt_row);
+	pt_row->pt_frame_index = new_paddr / PAGE_SIZE;
+	pt_row->pt_cow = 0;
+	tlb_remove_by_vaddr(vaddr);
+#if OPT_STATS
+	vmstats_hit(coremap_is_ksm(old_paddr) ? VMSTAT_KSM_BROKEN : VMSTAT_COW_COPY);
+#endif
+	spinlock_release(&cm_spinlock);
+
+	kfree(node);
+}
+#endif
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
+#if OPT_VMALLOC
+	/*	only the kernel pages of vmalloc are shot down	*/
+	vmalloc_tlbshootdown(ts);
+#else
 	(void)ts;
 	panic("vm tried to do tlb shootdown?!\n");
+#endif
 }
 
 int
@@ -147,6 +506,31 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	int seg_type;
 	int readonly;
 	vaddr_t basefaultaddr;
+#if OPT_SHAREDTEXT
+	struct cm_rmap *node;
+#endif
+#if OPT_UNIFORMFILL
+	uint32_t fill;
+	uint32_t *word;
+	unsigned i;
+#endif
+#if OPT_MMAP
+	struct segment *mapping;
+#endif
+#if OPT_STRIDE
+	bool stride_fault;
+#endif
+#if OPT_PAGEBUSY
+	bool loading;
+#endif
+
+#if OPT_VMALLOC
+	/*	kernel misses in kseg2, counted apart from the user ones	*/
+	if(faultaddress >= MIPS_KSEG2)
+	{
+		return vmalloc_fault(faulttype, faultaddress);
+	}
+#endif
 
 #if OPT_STATS
 	vmstats_hit(VMSTAT_TLB_FAULT);
@@ -160,9 +544,14 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	switch (faulttype)
 	{
  	    case VM_FAULT_READONLY:
+#if OPT_KSM || OPT_FORK || OPT_MMAP || OPT_ZEROPAGE
+			/*	writes to a shared, a clean mapped or a zero page are resolved below	*/
+			break;
+#else
 			kprintf("vm: got VM_FAULT_READONLY, process killed\n");
 			sys__exit(-1);
 			return 0;
+#endif
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 			break;
@@ -188,25 +577,173 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+#if OPT_ASRWLOCK
+	/*	the regions and the page table do not change until the end of the fault	*/
+	rwlock_acquire_read(as->as_lock);
+#endif
+
 	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_data != NULL);
+	KASSERT(as->as_nregions > 0);
 	KASSERT(as->as_stack != NULL);
-	KASSERT(as->as_text != NULL);
 	KASSERT(as->as_ptable != NULL);
 
 	/**
 	 * If as_get_segment_type returns zero, the fault address
 	 * does not belong to a valid segment.
 	 */
-	if(!(seg_type = as_get_segment_type(as, faultaddress))){
+	seg_type = as_get_segment_type(as, faultaddress);
+#if OPT_STACKGROW && OPT_ASRWLOCK
+	/**
+	 * a fault right below the stack extends it. Growing changes the
+	 * regions, so the lock is taken exclusive meanwhile; another
+	 * thread may have grown the stack in between, hence the lookup
+	 * is done again.
+	 */
+	if(seg_type == 0)
+	{
+		rwlock_release_read(as->as_lock);
+		rwlock_acquire_write(as->as_lock);
+		as_grow_stack(as, faultaddress);
+		rwlock_release_write(as->as_lock);
+		rwlock_acquire_read(as->as_lock);
+		seg_type = as_get_segment_type(as, faultaddress);
+	}
+#elif OPT_STACKGROW
+	/*	a fault right below the stack extends it	*/
+	if(seg_type == 0 && as_grow_stack(as, faultaddress))
+	{
+		seg_type = SEGMENT_STACK;
+	}
+#endif
+	if(!seg_type){
+#if OPT_ASRWLOCK
+		rwlock_release_read(as->as_lock);
+#endif
 		kprintf("vm: got faultaddr out of range, process killed\n");
 		sys__exit(-1);
 	}
-	pt_row = pt_get_entry(as, faultaddress);
 	readonly = seg_type == SEGMENT_TEXT;
+#if OPT_MMAP
+	mapping = seg_type == SEGMENT_MMAP ? as_get_mapping(as, faultaddress) : NULL;
+	if(mapping != NULL && !mapping->seg_writable)
+	{
+		readonly = 1;
+	}
+#endif
+#if OPT_KSM || OPT_FORK || OPT_MMAP || OPT_ZEROPAGE
+	if(faulttype == VM_FAULT_READONLY && readonly)
+	{
+#if OPT_ASRWLOCK
+		rwlock_release_read(as->as_lock);
+#endif
+		kprintf("vm: got VM_FAULT_READONLY, process killed\n");
+		sys__exit(-1);
+	}
+#endif
+
+	/*	the leaf of the page table stays in memory until pt_put_entry	*/
+	pt_row = pt_get_entry(as, faultaddress);
+	if(pt_row == NULL)
+	{
+#if OPT_ASRWLOCK
+		rwlock_release_read(as->as_lock);
+#endif
+		return ENOMEM;
+	}
+#if OPT_PAGEBUSY
+	/**
+	 * a page being loaded or swapped out by another thread is waited
+	 * for, then looked at again: most of the times it is resident by
+	 * then and the fault is a tlb reload. Otherwise this thread owns
+	 * the load until pt_unbusy.
+	 */
+	spinlock_acquire(&cm_spinlock);
+	if(pt_wait_busy(pt_row))
+	{
+#if OPT_STATS
+		vmstats_hit(VMSTAT_BUSY_WAIT);
+		if(pt_row->pt_status == IN_MEMORY || pt_row->pt_status == IN_MEMORY_RDONLY)
+		{
+			vmstats_hit(VMSTAT_BUSY_AVOIDED);
+		}
+#endif
+	}
+	loading = pt_row->pt_status != IN_MEMORY && pt_row->pt_status != IN_MEMORY_RDONLY &&
+		!(OPT_ZEROPAGE && pt_row->pt_status == IN_ZERO && faulttype == VM_FAULT_READ);
+	if(loading)
+	{
+		pt_row->pt_busy = 1;
+	}
+	spinlock_release(&cm_spinlock);
+#endif
+#if OPT_STRIDE
+	/*	the streams see the first access to a page, not tlb reloads	*/
+	stride_fault = pt_row->pt_status != IN_MEMORY && pt_row->pt_status != IN_MEMORY_RDONLY &&
+		(!OPT_ZEROPAGE || pt_row->pt_status != IN_ZERO);
+#endif
 	switch(pt_row->pt_status)
 	{
 		case NOT_LOADED:
+#if OPT_MMAP
+			/*	pages of a file mapping are read from the file	*/
+			if(mapping != NULL)
+			{
+				if(as_load_mapped(as, faultaddress, pt_row))
+				{
+#if OPT_PAGEBUSY
+					spinlock_acquire(&cm_spinlock);
+					pt_unbusy(pt_row);
+					spinlock_release(&cm_spinlock);
+#endif
+					pt_put_entry(as, faultaddress);
+#if OPT_ASRWLOCK
+					rwlock_release_read(as->as_lock);
+#endif
+					return ENOMEM;
+				}
+				break;
+			}
+#endif
+#if OPT_SHAREDTEXT
+			/*	text pages already loaded by another process are shared	*/
+			if(readonly && as_check_in_elf(as,faultaddress) &&
+			   (node = coremap_rmap_alloc()) != NULL)
+			{
+				if(coremap_text_lookup(curproc->p_vnode, basefaultaddr, pt_row,
+						OPT_NOSWAP_RDONLY ? IN_MEMORY_RDONLY : IN_MEMORY, node) != 0)
+				{
+					break;
+				}
+				coremap_rmap_free(node);
+			}
+#endif
+#if OPT_READAHEAD
+			/*	file backed pages are read in clusters	*/
+			if(seg_type != SEGMENT_STACK && as_check_in_elf(as,faultaddress) &&
+			   as_load_cluster(as, curproc->p_vnode, faultaddress, pt_row,
+					   (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY))
+			{
+#if OPT_SHAREDTEXT
+				if(readonly)
+				{
+					coremap_text_insert(curproc->p_vnode, basefaultaddr, pt_row);
+				}
+#endif
+				break;
+			}
+#endif
+#if OPT_ZEROPAGE
+			/*	a read of a zero-fill page maps the zero frame, until written	*/
+			if(faulttype == VM_FAULT_READ &&
+			   (seg_type == SEGMENT_STACK || !as_check_in_elf(as,faultaddress)))
+			{
+				pt_set_entry(pt_row, vm_zero_paddr, 0, IN_ZERO);
+#if OPT_STATS
+				vmstats_hit(VMSTAT_ZERO_MAPPED);
+#endif
+				break;
+			}
+#endif
 			/*	alloc a page				*/
 			page_paddr = alloc_upage(pt_row);
 
@@ -222,6 +759,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			if(seg_type != SEGMENT_STACK && as_check_in_elf(as,faultaddress))
 			{
 				as_load_page(as,curproc->p_vnode,faultaddress);
+#if OPT_SHAREDTEXT
+				if(readonly)
+				{
+					coremap_text_insert(curproc->p_vnode, basefaultaddr, pt_row);
+				}
+#endif
 			}
 #if OPT_STATS
 			else
@@ -234,8 +777,45 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		case IN_MEMORY:
 #if OPT_STATS
     		vmstats_hit(VMSTAT_TLB_RELOAD);
+#endif
+#if OPT_READAHEAD
+			if(pt_row->pt_ra)
+			{
+				pt_row->pt_ra = 0;
+				as_readahead_hit(as, faultaddress);
+#if OPT_STRIDE
+				stride_fault = true;
+#endif
+			}
+#endif
+#if OPT_STRIDE
+			if(pt_row->pt_pf)
+			{
+				pt_row->pt_pf = 0;
+				as_stride_hit(as);
+				stride_fault = true;
+			}
 #endif
 			break;
+#if OPT_ZEROPAGE
+		case IN_ZERO:
+			if(faulttype == VM_FAULT_READ)
+			{
+#if OPT_STATS
+				vmstats_hit(VMSTAT_TLB_RELOAD);
+#endif
+				break;
+			}
+
+			/*	the first write gets a private frame, it comes already zeroed	*/
+			page_paddr = alloc_upage(pt_row);
+			pt_set_entry(pt_row,page_paddr,0, (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY);
+			tlb_remove_by_vaddr(basefaultaddr);
+#if OPT_STATS
+			vmstats_hit(VMSTAT_ZERO_COPY);
+#endif
+			break;
+#endif
 		case IN_SWAP:
 #if OPT_SWAP
 			/*	alloc the page				*/
@@ -252,14 +832,122 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			panic("swap not implemented!");
 #endif
 		break;
+#if OPT_UNIFORMFILL
+		case IN_FILL:
+			/*	read the fill word before the entry is overwritten	*/
+			fill = pt_get_fill(pt_row);
+#if OPT_ZEROPAGE
+			/*	a page swapped out as zeroes is read as a never written one	*/
+			if(fill == 0 && faulttype == VM_FAULT_READ)
+			{
+				pt_set_entry(pt_row, vm_zero_paddr, 0, IN_ZERO);
+#if OPT_STATS
+				vmstats_hit(VMSTAT_ZERO_MAPPED);
+#endif
+				break;
+			}
+#endif
+
+			/*	alloc the page, it comes already zeroed	*/
+			page_paddr = alloc_upage(pt_row);
+
+			if(fill != 0)
+			{
+				word = (uint32_t *)PADDR_TO_KVADDR(page_paddr);
+				for(i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+				{
+					word[i] = fill;
+				}
+			}
+
+			pt_set_entry(pt_row,page_paddr,0, (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY);
+#if OPT_STATS
+			vmstats_hit(VMSTAT_SWAP_READ_UNIFORM);
+#endif
+		break;
+#endif
 		default:
 			panic("Cannot resolve fault");
 	}
 
 	KASSERT(seg_type != 0);
 
-	/* update tlb	*/
-	tlb_insert(basefaultaddr, pt_row->pt_frame_index * PAGE_SIZE, readonly); 
+#if OPT_PAGEBUSY
+	if(loading)
+	{
+		spinlock_acquire(&cm_spinlock);
+		pt_unbusy(pt_row);
+		spinlock_release(&cm_spinlock);
+	}
+#endif
+
+#if OPT_ZEROPAGE
+	/*	the zero frame is mapped read-only, its first write faults	*/
+	if(pt_row->pt_status == IN_ZERO)
+	{
+		readonly = 1;
+	}
+#endif
+
+#if OPT_KSM || OPT_FORK
+	/*	a write to a merged or forked page needs a private copy	*/
+	if(faulttype != VM_FAULT_READ && pt_row->pt_cow)
+	{
+		vm_break_cow(pt_row, basefaultaddr);
+	}
+#endif
+
+#if OPT_MMAP
+	/*	the first write to a mapped page makes it dirty or private	*/
+	if(mapping != NULL && faulttype != VM_FAULT_READ && !readonly && !pt_row->pt_dirty)
+	{
+		coremap_file_written(pt_row, mapping->seg_shared);
+		/*	the read-only entry of the clean page is replaced below	*/
+		tlb_remove_by_vaddr(basefaultaddr);
+	}
+#endif
+
+	/**
+	 * update tlb. It is done under the coremap lock, as the entry
+	 * can be redirected to another frame by a concurrent merge.
+	 */
+	spinlock_acquire(&cm_spinlock);
+	/*
+	 * a write to a page mapped read-only finds its entry still in the
+	 * tlb, for instance the last sharer of a frame unshared by a copy
+	 * on write: tlb_insert does not look for it, so it goes first.
+	 */
+	if(faulttype == VM_FAULT_READONLY)
+	{
+		tlb_remove_by_vaddr(basefaultaddr);
+	}
+#if OPT_MMAP
+	/*	a clean mapped page is read-only, so that its first write faults	*/
+	tlb_insert(basefaultaddr, pt_row->pt_frame_index * PAGE_SIZE,
+		   readonly || pt_row->pt_cow || (mapping != NULL && !pt_row->pt_dirty));
+#else
+	tlb_insert(basefaultaddr, pt_row->pt_frame_index * PAGE_SIZE, readonly || pt_row->pt_cow); 
+#endif
+	spinlock_release(&cm_spinlock);
+
+	pt_put_entry(as, faultaddress);
+
+#if OPT_EAGERLOAD
+	as_exec_done(as);
+#endif
+#if OPT_LAUNCHPROF
+	profile_fault(as->as_profile, basefaultaddr);
+#endif
+#if OPT_STRIDE
+	/*	after the tlb insert, see as_stride_fault	*/
+	if(stride_fault)
+	{
+		as_stride_fault(as, curproc->p_vnode, basefaultaddr);
+	}
+#endif
+#if OPT_ASRWLOCK
+	rwlock_release_read(as->as_lock);
+#endif
 
 	return 0;
 }
@@ -72,16 +72,56 @@ void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro)
 }
 
 
+void tlb_remove_by_vaddr(vaddr_t vaddr) {
+    int spl, i;
+
+    KASSERT(vaddr % PAGE_SIZE == 0);
+
+    spl = splhigh();
+
+    i = tlb_probe(vaddr, 0);
+    if (i >= 0) {
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+
+    splx(spl);
+}
+
 void tlb_remove_by_paddr(paddr_t paddr) {
-    
+    int spl;
+
     KASSERT(paddr % PAGE_SIZE == 0);
 
+    spl = splhigh();
+
+    /* a shared frame can be mapped by more than one entry */
     for (int i = 0; i < NUM_TLB; i++) {
         uint32_t ehi, elo;
         tlb_read(&ehi, &elo, i);
-        if (paddr == (elo & PAGE_FRAME)) {
+        if ((elo & TLBLO_VALID) && paddr == (elo & PAGE_FRAME)) {
             tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-            return;
         }
     }
-}
\ No newline at end of file
+
+    splx(spl);
+}
+
+#if OPT_VMALLOC
+void tlb_insert_kernel(vaddr_t vaddr, paddr_t paddr) {
+    int spl;
+
+    KASSERT(vaddr >= MIPS_KSEG2);
+    KASSERT((paddr & PAGE_FRAME) == paddr);
+
+    spl = splhigh();
+
+    /* same replacement as the user pages */
+    tlb_write(vaddr, paddr | TLBLO_VALID | TLBLO_DIRTY, tlb_victim);
+    tlb_victim = (tlb_victim + 1) % NUM_TLB;
+    if (tlb_victim == 0) {
+        tlb_free = false;
+    }
+
+    splx(spl);
+}
+#endif
@@ -0,0 +1,268 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <vm_tlb.h>
+#include <vmalloc.h>
+#include "opt-stats.h"
+#if OPT_STATS
+#include <vmstats.h>
+#endif
+
+/*
+ * Kernel page table of the window: one word for each page, the frame
+ * and the state of the page. A page is reserved while its allocation
+ * is being filled, mapped once its frame is in place; the last page
+ * of every allocation is marked, so that vfree needs no size.
+ */
+#define VMALLOC_RESERVED    0x1
+#define VMALLOC_MAPPED      0x2
+#define VMALLOC_LAST        0x4
+
+static uint32_t         *vmalloc_ptes = NULL;
+static struct spinlock  vmalloc_lock = SPINLOCK_INITIALIZER;    /*  the reservations  */
+static unsigned         vmalloc_next = 0;       /*  where the next search starts  */
+
+/**
+ * @brief allocate the kernel page table of the window. Until then
+ * vmalloc fails and kmalloc uses contiguous frames.
+ */
+void vmalloc_bootstrap(void)
+{
+    uint32_t *ptes;
+
+    KASSERT(VMALLOC_PAGES * sizeof(uint32_t) <= PAGE_SIZE);
+
+    /*  in kseg0: reading it never misses in the TLB  */
+    ptes = (uint32_t *)alloc_kpages(1);
+    bzero(ptes, PAGE_SIZE);
+    vmalloc_ptes = ptes;
+}
+
+/**
+ * @brief reserve npages consecutive free pages of the window, first
+ * fit from where the previous search stopped.
+ * 
+ * @param npages 
+ * @return int index of the first page, -1 if the window is full
+ */
+static int
+vmalloc_reserve(unsigned npages)
+{
+    unsigned start, run, n, i;
+
+    spinlock_acquire(&vmalloc_lock);
+
+    run = 0;
+    start = 0;
+    for (n = 0; n < VMALLOC_PAGES + npages && run < npages; n++)
+    {
+        i = (vmalloc_next + n) % VMALLOC_PAGES;
+        if (i == 0 || vmalloc_ptes[i] != 0)
+        {
+            /*  a run does not wrap around the end of the window  */
+            run = 0;
+            if (vmalloc_ptes[i] != 0)
+            {
+                continue;
+            }
+        }
+        if (run == 0)
+        {
+            start = i;
+        }
+        run++;
+    }
+
+    if (run < npages)
+    {
+        spinlock_release(&vmalloc_lock);
+        return -1;
+    }
+
+    for (i = start; i < start + npages; i++)
+    {
+        vmalloc_ptes[i] = VMALLOC_RESERVED;
+    }
+    vmalloc_next = (start + npages) % VMALLOC_PAGES;
+
+    spinlock_release(&vmalloc_lock);
+
+    return start;
+}
+
+/**
+ * @brief allocate npages pages of kernel memory, contiguous in kseg2
+ * but backed by frames taken one at a time.
+ * 
+ * @param npages 
+ * @return void* address of the first page, NULL if the window has no
+ * room for them (or has not been created yet)
+ */
+void *vmalloc(unsigned npages)
+{
+    int first;
+    unsigned i;
+    paddr_t paddr;
+
+    KASSERT(npages > 0);
+
+    if (vmalloc_ptes == NULL || npages > VMALLOC_PAGES)
+    {
+        return NULL;
+    }
+
+    first = vmalloc_reserve(npages);
+    if (first < 0)
+    {
+        return NULL;
+    }
+
+    /*  the frames can come from a swap out, without the spinlock  */
+    for (i = 0; i < npages; i++)
+    {
+        paddr = KVADDR_TO_PADDR(alloc_kpages(1));
+        vmalloc_ptes[first + i] = paddr | VMALLOC_RESERVED | VMALLOC_MAPPED |
+                                  (i == npages - 1 ? VMALLOC_LAST : 0);
+    }
+
+#if OPT_STATS
+    for (i = 0; i < npages; i++)
+    {
+        vmstats_hit(VMSTAT_VMALLOC_PAGES);
+    }
+#endif
+
+    return (void *)(VMALLOC_BASE + first * PAGE_SIZE);
+}
+
+/**
+ * @brief release an allocation of vmalloc: its pages are unmapped
+ * from the TLB of every CPU, then their frames are freed. The other
+ * CPUs are sent a shootdown and waited for, so with more than one CPU
+ * running it must not be called holding a spinlock.
+ * 
+ * @param ptr as returned by vmalloc
+ */
+void vfree(void *ptr)
+{
+    vaddr_t vaddr;
+    unsigned first, last, i, ncpus, acked;
+    uint32_t pte;
+    struct tlbshootdown ts;
+    int spl;
+
+    vaddr = (vaddr_t)ptr;
+    KASSERT(vaddr % PAGE_SIZE == 0);
+    KASSERT(vaddr >= VMALLOC_BASE && vaddr < VMALLOC_BASE + VMALLOC_PAGES * PAGE_SIZE);
+
+    first = (vaddr - VMALLOC_BASE) / PAGE_SIZE;
+
+    /*  no migration between the local removal and the shootdown  */
+    spl = splhigh();
+    i = first;
+    do
+    {
+        pte = vmalloc_ptes[i];
+        KASSERT(pte & VMALLOC_MAPPED);
+
+        /*  vmalloc_fault does not load it anymore  */
+        vmalloc_ptes[i] = (pte & ~VMALLOC_MAPPED) | VMALLOC_RESERVED;
+        tlb_remove_by_vaddr(VMALLOC_BASE + i * PAGE_SIZE);
+        i++;
+    } while (!(pte & VMALLOC_LAST));
+    last = i;
+
+    acked = 0;
+    ts.ts_vaddr = vaddr;
+    ts.ts_npages = last - first;
+    ts.ts_acked = &acked;
+    ncpus = ipi_tlbshootdown_broadcast(&ts);
+    splx(spl);
+
+    if (ncpus > 0)
+    {
+        KASSERT(curcpu->c_spinlocks == 0);
+
+        /*  the frames go back to the coremap once no TLB maps them  */
+        spinlock_acquire(&vmalloc_lock);
+        while (acked < ncpus)
+        {
+            spinlock_release(&vmalloc_lock);
+            spinlock_acquire(&vmalloc_lock);
+        }
+        spinlock_release(&vmalloc_lock);
+    }
+
+    for (i = first; i < last; i++)
+    {
+        free_kpages(PADDR_TO_KVADDR(vmalloc_ptes[i] & PAGE_FRAME));
+    }
+
+    spinlock_acquire(&vmalloc_lock);
+    for (; first < i; first++)
+    {
+        vmalloc_ptes[first] = 0;
+    }
+    spinlock_release(&vmalloc_lock);
+}
+
+/**
+ * @brief drop the TLB entries of an allocation released by vfree on
+ * another CPU, and tell it this CPU is done. Called by
+ * vm_tlbshootdown in the interprocessor interrupt.
+ * 
+ * @param ts 
+ */
+void vmalloc_tlbshootdown(const struct tlbshootdown *ts)
+{
+    unsigned i;
+
+    for (i = 0; i < ts->ts_npages; i++)
+    {
+        tlb_remove_by_vaddr(ts->ts_vaddr + i * PAGE_SIZE);
+    }
+
+    spinlock_acquire(&vmalloc_lock);
+    (*ts->ts_acked)++;
+    spinlock_release(&vmalloc_lock);
+}
+
+/**
+ * @brief load the mapping of a page of the window in the TLB. Called
+ * by vm_fault on a kernel miss in kseg2, possibly holding spinlocks:
+ * it takes none but the one of the statistics, and reads the kernel
+ * page table without a lock, as a page is mapped before its address
+ * is handed out.
+ * 
+ * @param faulttype 
+ * @param faultaddress 
+ * @return int 0 on success, EFAULT if the page is not mapped
+ */
+int vmalloc_fault(int faulttype, vaddr_t faultaddress)
+{
+    uint32_t pte;
+
+    if (faulttype == VM_FAULT_READONLY || vmalloc_ptes == NULL ||
+        faultaddress >= VMALLOC_BASE + VMALLOC_PAGES * PAGE_SIZE)
+    {
+        return EFAULT;
+    }
+
+    pte = vmalloc_ptes[(faultaddress - VMALLOC_BASE) / PAGE_SIZE];
+    if (!(pte & VMALLOC_MAPPED))
+    {
+        return EFAULT;
+    }
+
+#if OPT_STATS
+    vmstats_hit(VMSTAT_KTLB_FAULT);
+#endif
+    tlb_insert_kernel(faultaddress & PAGE_FRAME, pte & PAGE_FRAME);
+
+    return 0;
+}
@@ -4,7 +4,7 @@
 #include <lib.h>
 #include <vmstats.h>
 
-static int vmstats[10];
+static int vmstats[VMSTAT_COUNT];
 static struct spinlock vmstats_l = SPINLOCK_INITIALIZER;
 
 static const char *vmstats_names[] = {
@@ -17,13 +17,46 @@ static const char *vmstats_names[] = {
     "Page Faults (Disk)",
     "Page Faults from ELF",
     "Page Faults from Swapfile",
-    "Swapfile Writes"};
+    "Swapfile Writes",
+    "Swapfile Writes Avoided (Uniform)",
+    "Swapfile Reads Avoided (Uniform)",
+    "KSM Frames Merged",
+    "KSM Merges Broken",
+    "Page Table Pages Reclaimed",
+    "Page Table Pages Swapped Out",
+    "Page Table Pages Swapped In",
+    "Text Pages Shared",
+    "Readahead Pages Loaded",
+    "Readahead Hits",
+    "Readahead Pages Wasted",
+    "Pages Loaded Eagerly",
+    "Pages Prefetched by Profile",
+    "Pages Shared by Fork",
+    "Copy-on-Write Copies",
+    "Stack Growths",
+    "Heap Pages Released",
+    "Page Faults from Mapped Files",
+    "Mapped Pages Written Back",
+    "Mapped Pages Dropped",
+    "Pages Prefetched by madvise",
+    "Advised Pages Evicted First",
+    "Pages Freed by madvise",
+    "Pages Prefetched on a Stride",
+    "Stride Prefetch Hits",
+    "Stride Prefetched Pages Wasted",
+    "Reads Mapped to the Zero Page",
+    "Zero Page Writes",
+    "Faults Waiting on a Busy Page",
+    "Duplicate Loads Avoided",
+    "Kernel TLB Faults (kseg2)",
+    "Pages Mapped by vmalloc",
+    "Pages Freed by Shrinkers"};
 
 void vmstats_hit(unsigned int stat)
 {
     spinlock_acquire(&vmstats_l);
 
-    KASSERT(stat < 10);
+    KASSERT(stat < VMSTAT_COUNT);
     vmstats[stat]++;
 
     spinlock_release(&vmstats_l);
@@ -34,7 +67,7 @@ void vmstats_print()
     kprintf("---------------------------\n");
     kprintf("VM STATS\n");
     kprintf("---------------------------\n");
-    for (int i = 0; i < 10; i++)
+    for (int i = 0; i < VMSTAT_COUNT; i++)
     {
         kprintf("%s: %d\n", vmstats_names[i], vmstats[i]);
     }
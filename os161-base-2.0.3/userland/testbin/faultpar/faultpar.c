@@ -0,0 +1,107 @@
+/*
+ * faultpar.c
+ *
+ *    Fork a number of workers (4 by default, or the first argument)
+ *    which all fault in NPAGES fresh heap pages at the same time, then
+ *    report the page faults served per second. Running it with a
+ *    different number of CPUs in sys161.conf (or "sys161 -C 31:cpus=N")
+ *    shows how the fault path scales.
+ *
+ *    Each worker is a process with its own address space, so the
+ *    workers contend on the coremap and the swap file, never on the
+ *    same as_lock: there are no user threads to share one.
+ *
+ *    Needs the heap and fork kernel options.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#define PAGESIZE    4096
+#define NPAGES      48		/* per worker, the workers fit in memory */
+#define MAXWORKERS  16
+
+static
+unsigned long
+elapsed_ms(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+void
+worker(int id)
+{
+	char *buf;
+	int i;
+
+	buf = sbrk(NPAGES * PAGESIZE);
+	if (buf == (void *)-1) {
+		printf("faultpar: worker %d: sbrk failed\n", id);
+		_exit(1);
+	}
+	/* one fault for each page, then a check of what was written */
+	for (i = 0; i < NPAGES; i++) {
+		buf[i * PAGESIZE] = (char)(id + i);
+	}
+	for (i = 0; i < NPAGES; i++) {
+		if (buf[i * PAGESIZE] != (char)(id + i)) {
+			printf("faultpar: worker %d: page %d lost its content\n", id, i);
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+	pid_t pids[MAXWORKERS];
+	unsigned long ms;
+	time_t s;
+	unsigned long ns;
+	int nworkers, i, status, failed;
+
+	nworkers = argc > 1 ? atoi(argv[1]) : 4;
+	if (nworkers < 1 || nworkers > MAXWORKERS) {
+		printf("faultpar: between 1 and %d workers\n", MAXWORKERS);
+		return 1;
+	}
+
+	__time(&s, &ns);
+	for (i = 0; i < nworkers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			printf("faultpar: fork failed\n");
+			return 1;
+		}
+		if (pids[i] == 0) {
+			worker(i);
+		}
+	}
+
+	failed = 0;
+	for (i = 0; i < nworkers; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed++;
+		}
+	}
+	ms = elapsed_ms(s, ns);
+
+	if (failed) {
+		printf("faultpar: %d workers failed\n", failed);
+		return 1;
+	}
+	printf("faultpar: %d workers, %d faults in %lu ms, %lu faults/s\n",
+	       nworkers, nworkers * NPAGES, ms,
+	       ms > 0 ? (unsigned long)nworkers * NPAGES * 1000 / ms : 0);
+	printf("faultpar: passed\n");
+	return 0;
+}
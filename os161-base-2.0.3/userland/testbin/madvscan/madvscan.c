@@ -0,0 +1,160 @@
+/*
+ * madvscan.c
+ *
+ *    Fill a heap buffer larger than the physical memory, then give
+ *    the VM hints on parts of it with madvise() and check their effect
+ *    with mincore(): WILLNEED brings pages back before they are
+ *    scanned, DONTNEED makes them the first ones to leave, FREE drops
+ *    them, so that they read as zero.
+ *
+ *    Needs the heap and madvise kernel options.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <kern/mman.h>
+
+#define PAGESIZE  4096
+#define NPAGES    256		/* 1M, more than the memory of the tests */
+#define WINDOW    32		/* pages advised at a time */
+
+/* the libc stubs exist, the prototypes are not in its headers */
+int madvise(void *addr, size_t len, int advice);
+int mincore(void *addr, size_t len, char *vec);
+
+static char vec[NPAGES];
+
+static
+unsigned long
+elapsed_ms(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+int
+resident(char *buf, int first, int npages)
+{
+	int i, n;
+
+	if (mincore(buf + first * PAGESIZE, npages * PAGESIZE, vec) != 0) {
+		printf("madvscan: mincore failed\n");
+		exit(1);
+	}
+	n = 0;
+	for (i = 0; i < npages; i++) {
+		n += vec[i] & 1;
+	}
+	return n;
+}
+
+static
+unsigned long
+scan(char *buf, int first, int npages)
+{
+	unsigned long sum = 0;
+	int i, j;
+
+	for (i = first; i < first + npages; i++) {
+		for (j = 0; j < PAGESIZE; j += sizeof(int)) {
+			sum += *(int *)(buf + i * PAGESIZE + j);
+		}
+	}
+	return sum;
+}
+
+static
+void
+advise(char *buf, int first, int npages, int advice)
+{
+	if (madvise(buf + first * PAGESIZE, npages * PAGESIZE, advice) != 0) {
+		printf("madvscan: madvise %d failed\n", advice);
+		exit(1);
+	}
+}
+
+int
+main(void)
+{
+	char *buf;
+	unsigned long ms_cold, ms_warm;
+	time_t s;
+	unsigned long ns;
+	int i, before;
+
+	/* a page aligned buffer, filled with the index of every page */
+	buf = sbrk(NPAGES * PAGESIZE + PAGESIZE);
+	if (buf == (void *)-1) {
+		printf("madvscan: sbrk failed\n");
+		return 1;
+	}
+	buf = (char *)(((unsigned long)buf + PAGESIZE - 1) & ~(unsigned long)(PAGESIZE - 1));
+	for (i = 0; i < NPAGES; i++) {
+		*(int *)(buf + i * PAGESIZE) = i;
+	}
+	printf("madvscan: %d of %d pages resident after the fill\n",
+	       resident(buf, 0, NPAGES), NPAGES);
+
+	/* the first window is scanned as it is, the second one after WILLNEED */
+	__time(&s, &ns);
+	scan(buf, 0, WINDOW);
+	ms_cold = elapsed_ms(s, ns);
+
+	before = resident(buf, WINDOW, WINDOW);
+	advise(buf, WINDOW, WINDOW, MADV_WILLNEED);
+	printf("madvscan: WILLNEED, %d -> %d of %d pages resident\n",
+	       before, resident(buf, WINDOW, WINDOW), WINDOW);
+	__time(&s, &ns);
+	scan(buf, WINDOW, WINDOW);
+	ms_warm = elapsed_ms(s, ns);
+	printf("madvscan: scan of %d pages, %lu ms without hint, %lu ms after WILLNEED\n",
+	       WINDOW, ms_cold, ms_warm);
+
+	/* pages not needed leave before the ones just scanned */
+	advise(buf, 2 * WINDOW, WINDOW, MADV_DONTNEED);
+	scan(buf, 4 * WINDOW, NPAGES - 4 * WINDOW);
+	printf("madvscan: DONTNEED, %d of %d advised pages and %d of %d scanned pages resident\n",
+	       resident(buf, 2 * WINDOW, WINDOW), WINDOW,
+	       resident(buf, WINDOW, WINDOW), WINDOW);
+
+	/* freed pages are dropped and read as zero */
+	advise(buf, 3 * WINDOW, WINDOW, MADV_FREE);
+	if (resident(buf, 3 * WINDOW, WINDOW) != 0) {
+		printf("madvscan: freed pages still resident\n");
+		return 1;
+	}
+	for (i = 3 * WINDOW; i < 4 * WINDOW; i++) {
+		if (*(int *)(buf + i * PAGESIZE) != 0) {
+			printf("madvscan: freed page %d not zero\n", i);
+			return 1;
+		}
+	}
+
+	/* the access pattern hints only change the readahead */
+	advise(buf, 0, NPAGES, MADV_SEQUENTIAL);
+	advise(buf, 0, NPAGES, MADV_RANDOM);
+	advise(buf, 0, NPAGES, MADV_NORMAL);
+
+	/* every other page kept its content */
+	for (i = 0; i < NPAGES; i++) {
+		if ((i < 3 * WINDOW || i >= 4 * WINDOW) &&
+		    *(int *)(buf + i * PAGESIZE) != i) {
+			printf("madvscan: page %d lost its content\n", i);
+			return 1;
+		}
+	}
+
+	/* a range beyond the break is not mapped */
+	if (mincore(buf + NPAGES * PAGESIZE + PAGESIZE, PAGESIZE, vec) == 0) {
+		printf("madvscan: mincore accepted an unmapped page\n");
+		return 1;
+	}
+
+	printf("madvscan: passed\n");
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * mmapscan.c
+ *
+ *    Scan a file larger than the physical memory twice, once with
+ *    read() and once through mmap(), and compare the times. Then
+ *    modify every page through a shared mapping and check with read()
+ *    that the changes reached the file.
+ *
+ *    Needs the filetable and mmap kernel options.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <kern/mman.h>
+
+#define FILENAME  "mmapscan.dat"
+#define CHUNK     4096
+#define NCHUNKS   256		/* 1M, more than the memory of the tests */
+#define FILESIZE  (CHUNK * NCHUNKS)
+
+/* the libc stubs exist, the prototypes are not in its headers */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+
+static char buf[CHUNK];
+
+static
+unsigned long
+elapsed_ms(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+static
+void
+create_file(void)
+{
+	int fd, i, j;
+
+	fd = open(FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		printf("mmapscan: cannot create %s\n", FILENAME);
+		exit(1);
+	}
+	for (i = 0; i < NCHUNKS; i++) {
+		for (j = 0; j < CHUNK; j++) {
+			buf[j] = (char)(i * 7 + j);
+		}
+		if (write(fd, buf, CHUNK) != CHUNK) {
+			printf("mmapscan: short write\n");
+			exit(1);
+		}
+	}
+	close(fd);
+}
+
+static
+unsigned long
+scan_read(void)
+{
+	unsigned long sum = 0;
+	int fd, n, j;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		printf("mmapscan: cannot open %s\n", FILENAME);
+		exit(1);
+	}
+	while ((n = read(fd, buf, CHUNK)) > 0) {
+		for (j = 0; j < n; j++) {
+			sum += (unsigned char)buf[j];
+		}
+	}
+	close(fd);
+	return sum;
+}
+
+static
+unsigned long
+scan_mmap(void)
+{
+	unsigned long sum = 0;
+	unsigned char *p;
+	int fd, j;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		printf("mmapscan: cannot open %s\n", FILENAME);
+		exit(1);
+	}
+	p = mmap(NULL, FILESIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		printf("mmapscan: mmap failed\n");
+		exit(1);
+	}
+	close(fd);
+
+	for (j = 0; j < FILESIZE; j++) {
+		sum += p[j];
+	}
+	munmap(p, FILESIZE);
+	return sum;
+}
+
+static
+void
+touch_shared(void)
+{
+	unsigned char *p;
+	int fd, i;
+
+	fd = open(FILENAME, O_RDWR);
+	if (fd < 0) {
+		printf("mmapscan: cannot open %s\n", FILENAME);
+		exit(1);
+	}
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		printf("mmapscan: shared mmap failed\n");
+		exit(1);
+	}
+	close(fd);
+
+	/* one more in the first byte of every page */
+	for (i = 0; i < NCHUNKS; i++) {
+		p[i * CHUNK] = (unsigned char)(p[i * CHUNK] + 1);
+	}
+	munmap(p, FILESIZE);
+}
+
+int
+main(void)
+{
+	unsigned long sum_read, sum_mmap, sum_after, ms_read, ms_mmap;
+	time_t s;
+	unsigned long ns;
+	unsigned char old;
+	int i;
+
+	create_file();
+
+	__time(&s, &ns);
+	sum_read = scan_read();
+	ms_read = elapsed_ms(s, ns);
+
+	__time(&s, &ns);
+	sum_mmap = scan_mmap();
+	ms_mmap = elapsed_ms(s, ns);
+
+	printf("mmapscan: read %lu ms, mmap %lu ms (%d KB)\n",
+	       ms_read, ms_mmap, FILESIZE / 1024);
+	if (sum_read != sum_mmap) {
+		printf("mmapscan: checksums differ (%lu, %lu)\n", sum_read, sum_mmap);
+		return 1;
+	}
+
+	touch_shared();
+	sum_after = scan_read();
+
+	/* every first byte has been incremented, 255 wraps to 0 */
+	for (i = 0; i < NCHUNKS; i++) {
+		old = (unsigned char)(i * 7);
+		sum_read = sum_read - old + (unsigned char)(old + 1);
+	}
+	if (sum_after != sum_read) {
+		printf("mmapscan: shared writes lost (%lu, expected %lu)\n",
+		       sum_after, sum_read);
+		return 1;
+	}
+
+	printf("mmapscan: passed\n");
+	return 0;
+}